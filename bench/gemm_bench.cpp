@@ -0,0 +1,84 @@
+/*
+ * Compares the packed GEMM of the CPU backend to OpenBLAS.
+ * Build with -DPLEARN_BENCH=ON, run as gemm_bench [repetitions].
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+#include <backend/cpu/cpu_op_impl.h>
+#include <backend/cpu/cpu_gemm.h>
+
+using namespace plearn::backend::cpu;
+
+namespace {
+
+	struct problem {
+		uint64_t m, n, k;
+		bool transpose_A, transpose_B;
+	};
+
+	//best GFLOP/s of `reps` runs
+	double gflops(const problem& p, int reps, const std::function<void()>& run) {
+		run(); //warm up, packing buffers are allocated on the first call
+		double best = 0;
+		for (int r = 0; r < reps; ++r) {
+			auto start = std::chrono::steady_clock::now();
+			run();
+			std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+			best = std::max(best, 2.0 * p.m * p.n * p.k / secs.count() / 1e9);
+		}
+		return best;
+	}
+
+	std::vector<float> sample(uint64_t len) {
+		std::vector<float> v(len);
+		for (uint64_t i = 0; i < len; ++i) v[i] = std::sin(0.1f * i);
+		return v;
+	}
+
+}
+
+int main(int argc, char** argv) {
+	int reps = argc > 1 ? std::atoi(argv[1]) : 5;
+	std::vector<problem> problems{
+		{64, 64, 64, false, false},
+		{128, 784, 256, false, false},
+		{256, 256, 256, false, false},
+		{512, 512, 512, false, false},
+		{1024, 1024, 1024, false, false},
+		{512, 512, 512, true, false},
+		{512, 512, 512, false, true},
+		{1, 1024, 1024, false, false},
+		{1000, 1000, 10, false, false},
+	};
+
+	std::printf("%6s %6s %6s %3s %3s %10s %10s\n", "m", "n", "k", "tA", "tB", "packed", "openblas");
+	for (auto& p: problems) {
+		auto A = sample(p.m * p.n), B = sample(p.n * p.k);
+		std::vector<float> C(p.m * p.k);
+		auto lda = p.transpose_A ? p.m : p.n;
+		auto ldb = p.transpose_B ? p.n : p.k;
+
+		auto packed = gflops(p, reps, [&] {
+			gemm::sgemm(A.data(), B.data(), C.data(), p.m, p.n, p.k, lda, ldb, p.k,
+					false, p.transpose_A, p.transpose_B);
+		});
+#if USE_OPENBLAS
+		auto blas = gflops(p, reps, [&] {
+			cblas_sgemm(CblasRowMajor,
+					p.transpose_A ? CblasTrans : CblasNoTrans,
+					p.transpose_B ? CblasTrans : CblasNoTrans,
+					p.m, p.k, p.n, 1.f, A.data(), lda, B.data(), ldb, 0.f, C.data(), p.k);
+		});
+#else
+		double blas = NAN;
+#endif
+		std::printf("%6lu %6lu %6lu %3d %3d %10.2f %10.2f\n", p.m, p.n, p.k,
+				p.transpose_A, p.transpose_B, packed, blas);
+	}
+	return 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace plearn::backend::cpu {
+
+	/**
+	 * Counters of a buffer_pool.
+	 */
+	struct pool_stats {
+		//buffers allocated from the heap
+		uint64_t heap_allocs_{};
+		//acquires served by a recycled buffer
+		uint64_t reuses_{};
+		//buffers handed out and not released yet
+		uint64_t in_use_{};
+		//bytes of the released buffers kept for reuse
+		uint64_t cached_bytes_{};
+	};
+
+	/**
+	 * Recycles tensor buffers by size class.
+	 * Sizes are rounded up to a quarter of their power of two, so a buffer is at most
+	 * 25% larger than asked for. Released buffers go to a free list of their class,
+	 * small ones to a cache of the releasing thread first, so the hot path takes no lock.
+	 * Buffers are aligned to cache lines.
+	 */
+	class buffer_pool {
+		public:
+			static constexpr std::size_t alignment = 64;
+			//floats of the smallest class
+			static constexpr uint64_t min_floats = 64;
+			//classes kept in the thread caches, up to 1MB, and buffers per class there
+			static constexpr unsigned local_classes = 49;
+			static constexpr unsigned local_limit = 4;
+			static constexpr unsigned classes = 233;
+
+			buffer_pool() = default;
+			buffer_pool(const buffer_pool&) = delete;
+			buffer_pool& operator=(const buffer_pool&) = delete;
+
+			~buffer_pool() { trim(); }
+
+			/**
+			 * The pool of the cpu tensors. It is never destroyed, so tensors released
+			 * during static destruction still find it.
+			 */
+			static buffer_pool& global() {
+				static auto pool = new buffer_pool();
+				return *pool;
+			}
+
+			static unsigned class_of(uint64_t size) {
+				if (size <= min_floats) return 0;
+				unsigned exp = std::bit_width(size - 1) - 1;
+				uint64_t step = uint64_t{1} << (exp - 2);
+				uint64_t quarters = (size - (uint64_t{1} << exp) + step - 1) / step;
+				return (exp - 6) * 4 + quarters;
+			}
+
+			static uint64_t class_size(unsigned cls) {
+				if (cls == 0) return min_floats;
+				unsigned exp = 6 + (cls - 1) / 4;
+				return (uint64_t{1} << exp) + ((cls - 1) % 4 + 1) * (uint64_t{1} << (exp - 2));
+			}
+
+			/**
+			 * A buffer of at least `size` floats, its content is undefined.
+			 */
+			float* acquire(uint64_t size) {
+				auto cls = class_of(size);
+				float* buf = nullptr;
+				if (auto cache = local(cls); cache && cache->count_ > 0) {
+					buf = cache->buffers_[--cache->count_];
+				} else {
+					std::lock_guard lock{mutex_};
+					if (!free_[cls].empty()) {
+						buf = free_[cls].back();
+						free_[cls].pop_back();
+					}
+				}
+				auto bytes = class_size(cls) * sizeof(float);
+				if (buf) {
+					reuses_.fetch_add(1, std::memory_order_relaxed);
+					cached_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+				} else {
+					buf = static_cast<float*>(::operator new(bytes, std::align_val_t{alignment}));
+					heap_allocs_.fetch_add(1, std::memory_order_relaxed);
+				}
+				in_use_.fetch_add(1, std::memory_order_relaxed);
+				return buf;
+			}
+
+			/**
+			 * Returns a buffer acquired with the same size.
+			 */
+			void release(float* buf, uint64_t size) {
+				auto cls = class_of(size);
+				in_use_.fetch_sub(1, std::memory_order_relaxed);
+				cached_bytes_.fetch_add(class_size(cls) * sizeof(float), std::memory_order_relaxed);
+				if (auto cache = local(cls); cache && cache->count_ < local_limit) {
+					cache->buffers_[cache->count_++] = buf;
+					return;
+				}
+				std::lock_guard lock{mutex_};
+				free_[cls].push_back(buf);
+			}
+
+			/**
+			 * Frees the buffers of the free lists, thread caches are kept.
+			 */
+			void trim() {
+				std::lock_guard lock{mutex_};
+				for (unsigned cls = 0; cls < classes; ++cls) {
+					for (auto buf: free_[cls]) {
+						cached_bytes_.fetch_sub(class_size(cls) * sizeof(float), std::memory_order_relaxed);
+						::operator delete(buf, std::align_val_t{alignment});
+					}
+					free_[cls].clear();
+				}
+			}
+
+			pool_stats stats() const {
+				return {heap_allocs_.load(), reuses_.load(), in_use_.load(), cached_bytes_.load()};
+			}
+
+		private:
+			struct local_slot {
+				float* buffers_[local_limit];
+				unsigned count_{0};
+			};
+
+			//buffers a thread released last, handed back to the global pool when it exits
+			struct local_cache {
+				std::array<local_slot, local_classes> slots_{};
+
+				~local_cache() {
+					auto& pool = global();
+					std::lock_guard lock{pool.mutex_};
+					for (unsigned cls = 0; cls < local_classes; ++cls) {
+						auto& slot = slots_[cls];
+						pool.free_[cls].insert(pool.free_[cls].end(), slot.buffers_, slot.buffers_ + slot.count_);
+					}
+					exited() = true;
+				}
+
+				//set once the cache of the thread is gone, buffers released later skip it
+				static bool& exited() {
+					thread_local bool flag = false;
+					return flag;
+				}
+			};
+
+			//the thread cache of a class, only the global pool has them
+			local_slot* local(unsigned cls) {
+				if (cls >= local_classes || this != &global() || local_cache::exited()) return nullptr;
+				thread_local local_cache cache;
+				return &cache.slots_[cls];
+			}
+
+			std::mutex mutex_;
+			std::array<std::vector<float*>, classes> free_;
+			std::atomic<uint64_t> heap_allocs_{0};
+			std::atomic<uint64_t> reuses_{0};
+			std::atomic<uint64_t> in_use_{0};
+			std::atomic<uint64_t> cached_bytes_{0};
+	};
+
+}
@@ -3,22 +3,122 @@
 #include "backend/cpu/cpu_bw_grad.h"
 #include <memory>
 #include <cstdlib>
+#include <thread>
 
 #include <rep/rep_types.h>
 #include <environ/env_types.h>
 #include <backend/cpu/cpu_types.h>
 #include <backend/cpu/cpu_ops.h>
 #include <backend/cpu/cpu_fp_grad.h>
+#include <backend/cpu/cpu_optim.h>
+#include <backend/cpu/cpu_parallel.h>
+#include <environ/thread_pool.h>
 
 namespace plearn::backend::cpu {
 
+	struct cpu_backend_options {
+		//threads an op is split over, 0 for one per core, 1 runs ops on the calling thread only
+		unsigned intra_op_threads{0};
+		//elements an op touches from which it is split
+		uint64_t parallel_threshold{intra_op_settings{}.threshold_};
+	};
+
+	/**
+	 * Runs the kernels of a diff backend with the intra-op settings of its cpu_backend.
+	 */
+	class cpu_scoped_bw_diff : public bw_op_diff_backend_t {
+		public:
+			cpu_scoped_bw_diff(unique_ptr<bw_op_diff_backend_t>&& inner,
+					const intra_op_settings& settings) :
+				inner_(std::move(inner)), settings_(settings) {}
+
+			void reset(const vector<tensor_p>& inputs, const tensor_p& output) override {
+				intra_op_scope scope{settings_};
+				inner_->reset(inputs, output);
+			}
+
+			void update_grad(unsigned input_idx, const gradient& out_outn_grad,
+					gradient& in_outn_grad, bool accumulate = true) override {
+				intra_op_scope scope{settings_};
+				inner_->update_grad(input_idx, out_outn_grad, in_outn_grad, accumulate);
+			}
+
+		private:
+			unique_ptr<bw_op_diff_backend_t> inner_;
+			const intra_op_settings& settings_;
+	};
+
+	class cpu_scoped_fw_diff : public fw_op_diff_backend_t {
+		public:
+			cpu_scoped_fw_diff(unique_ptr<fw_op_diff_backend_t>&& inner,
+					const intra_op_settings& settings) :
+				inner_(std::move(inner)), settings_(settings) {}
+
+			void reset(const vector<tensor_p>& inputs, const tensor_p& output) override {
+				intra_op_scope scope{settings_};
+				inner_->reset(inputs, output);
+			}
+
+			void update_tangent(const vector<tensor_p>& in_tangents,
+					const tensor_p& out_tangent, uint64_t directions) override {
+				intra_op_scope scope{settings_};
+				inner_->update_tangent(in_tangents, out_tangent, directions);
+			}
+
+		private:
+			unique_ptr<fw_op_diff_backend_t> inner_;
+			const intra_op_settings& settings_;
+	};
+
+	class cpu_scoped_param_update : public param_update_backend_t {
+		public:
+			cpu_scoped_param_update(unique_ptr<param_update_backend_t>&& inner,
+					const intra_op_settings& settings) :
+				inner_(std::move(inner)), settings_(settings) {}
+
+			void update(const tensor_p& param, gradient& grad,
+					const vector<tensor_p>& state, uint64_t step) override {
+				intra_op_scope scope{settings_};
+				inner_->update(param, grad, state, step);
+			}
+
+		private:
+			unique_ptr<param_update_backend_t> inner_;
+			const intra_op_settings& settings_;
+	};
+
+
+	/**
+	 * Executes ops on the CPU. Large ops are split over the intra-op pool of the backend,
+	 * every kernel the backend runs, binds or creates finds it through intra_op().
+	 * Backends are independent, each one has its own pool and threshold.
+	 */
 	class cpu_backend : public backend_t {
 		public:
+			explicit cpu_backend(const cpu_backend_options& options = {}) {
+				unsigned threads = options.intra_op_threads ?
+					options.intra_op_threads : std::thread::hardware_concurrency();
+				//the thread calling a kernel takes one of the parts
+				if (threads > 1) pool_ = std::make_unique<env::thread_pool>(threads - 1);
+				settings_ = {pool_.get(), options.parallel_threshold};
+			}
+
+			cpu_backend(const cpu_backend&) = delete;
+			cpu_backend& operator=(const cpu_backend&) = delete;
+
+			/**
+			 * The settings kernels of this backend run with, see intra_op_scope.
+			 */
+			const intra_op_settings& parallel_settings() const { return settings_; }
+
+			borrowed_ptr<env::thread_pool> intra_op_pool() const { return pool_.get(); }
+
 			void exec_op(
 					const operation& op, 
 					const vector<tensor_p>& inputs, 
 					tensor_p& output
 			) override {
+				intra_op_scope scope{settings_};
 				cpu_tensor* out = static_cast<cpu_tensor*>(output->back());
 				vector<cpu_tensor*> in(inputs.size());
 				std::transform(inputs.begin(), inputs.end(), in.begin(), 
@@ -26,10 +126,12 @@ namespace plearn::backend::cpu {
 
 				switch (op.type_) {
 					case op_type::noop:
-					case op_type::identity: //TODO
+						throw std::runtime_error("Noop has no value to compute");
+					case op_type::identity:
+						cpu_identity(op, in, out);
 						break;
 					case op_type::matmul:
-						cpu_matmul(op, in, out);
+						cpu_matmul(op, inputs, output);
 						break;
 					case op_type::vecmatmul:
 						cpu_vecmatmul(op, in, out);
@@ -58,6 +160,113 @@ namespace plearn::backend::cpu {
 					case op_type::dot_product:
 						cpu_dot_product(op, in, out);
 						break;
+					case op_type::fused:
+						cpu_fused(op, in, out);
+						break;
+					case op_type::dense:
+						cpu_dense(op, in, out);
+						break;
+					case op_type::reshape:
+					case op_type::transpose:
+					case op_type::slice:
+					case op_type::broadcast:
+						throw std::runtime_error("View ops are resolved by the exec page");
+				}
+			}
+
+			bound_kernel bind_op(
+					const operation& op,
+					const vector<tensor_p>& inputs,
+					const tensor_p& output
+			) override {
+				auto k = cpu_bind_op(op, inputs, output);
+				if (!k) return k;
+				//the kernel runs with the settings of this backend on whichever thread calls it
+				k.inner_ = k.fn_;
+				k.ctx_ = &settings_;
+				k.fn_ = [](const bound_kernel& k) {
+					intra_op_scope scope{*static_cast<read_ptr<intra_op_settings>>(k.ctx_)};
+					k.inner_(k);
+				};
+				return k;
+			}
+
+			void materialize(const tensor_p& view, const tensor_p& dst) override {
+				intra_op_scope scope{settings_};
+				cpu_materialize(view, dst);
+			}
+
+			bool reads_strided(const operation& op, unsigned idx, const tensor_p& input) override {
+				return cpu_reads_strided(op, idx, input);
+			}
+
+			void exec_batch_op(
+					const operation& op, 
+					const vector<tensor_p>& inputs, 
+					tensor_p& output,
+					uint64_t batch_size,
+					const vector<bool>& batched
+			) override {
+				intra_op_scope scope{settings_};
+				if (std::ranges::none_of(batched, [](bool b) { return b; })) {
+					//every input is shared, calculate one sample and copy it
+					exec_op(op, inputs, output);
+					cpu_replicate_sample(static_cast<cpu_tensor*>(output->back()), batch_size);
+					return;
+				}
+				cpu_tensor* out = static_cast<cpu_tensor*>(output->back());
+				vector<cpu_tensor*> in(inputs.size());
+				std::transform(inputs.begin(), inputs.end(), in.begin(), 
+						[](auto& p) { return static_cast<cpu_tensor*>(p->back()); });
+				cpu_batch batch{batch_size, batched};
+
+				switch (op.type_) {
+					case op_type::noop:
+						throw std::runtime_error("Noop has no value to compute");
+					case op_type::identity:
+						cpu_identity(op, in, out);
+						break;
+					case op_type::matmul:
+						cpu_batch_matmul(op, in, out, batch);
+						break;
+					case op_type::vecmatmul:
+						cpu_batch_vecmatmul(op, in, out, batch);
+						break;
+					case op_type::matvecmul:
+						cpu_batch_matvecmul(op, in, out, batch);
+						break;
+					case op_type::add:
+						cpu_batch_add(op, in, out, batch);
+						break;
+					case op_type::sub:
+						cpu_batch_sub(op, in, out, batch);
+						break;
+					case op_type::mult:
+						cpu_batch_mult(op, in, out, batch);
+						break;
+					case op_type::square:
+						cpu_batch_square(op, in, out, batch);
+						break;
+					case op_type::reduce_sum:
+						cpu_batch_reduce_sum(op, in, out, batch);
+						break;
+					case op_type::reduce_mean:
+						cpu_batch_reduce_mean(op, in, out, batch);
+						break;
+					case op_type::dot_product:
+						cpu_batch_dot_product(op, in, out, batch);
+						break;
+					case op_type::fused:
+						cpu_batch_fused(op, in, out, batch);
+						break;
+					case op_type::dense:
+						cpu_batch_dense(op, in, out, batch);
+						break;
+					case op_type::reshape:
+					case op_type::transpose:
+					case op_type::slice:
+					case op_type::broadcast:
+						throw std::runtime_error("View ops are resolved by the exec page");
 				}
 			}
 
@@ -83,31 +292,80 @@ namespace plearn::backend::cpu {
 			}
 
 			unique_ptr<tensor_back_t> create_tensor(const shape_t& shape, float* data) override {
-				return unique_ptr<cpu_tensor>(tens_fac_.create(shape, data));
+				return create_tensor(shape, data, deleter_of(ownership::owned));
+			}
+
+			unique_ptr<tensor_back_t> create_tensor(const shape_t& shape, float* data,
+					buffer_deleter deleter) override {
+				return unique_ptr<cpu_tensor>(tens_fac_.create(shape, data, std::move(deleter)));
+			}
+
+			unique_ptr<tensor_back_t> create_view(tensor_back_t& base, uint64_t offset,
+					const shape_t& shape) override {
+				return unique_ptr<cpu_tensor>(
+						tens_fac_.view(static_cast<cpu_tensor&>(base), offset, shape));
 			}
 
 			unique_ptr<fw_op_diff_backend_t> create_op_fw_diff_backend(
 					const operation& op 
 			) override {
+				return std::make_unique<cpu_scoped_fw_diff>(create_fw_diff(op), settings_);
+			}
+
+			unique_ptr<bw_op_diff_backend_t> create_op_bw_diff_backend(
+					const operation& op 
+			) override {
+				return std::make_unique<cpu_scoped_bw_diff>(create_bw_diff(op), settings_);
+			}
+
+			unique_ptr<param_update_backend_t> create_param_update_backend(
+					const optimizer_params& params
+			) override {
+				return std::make_unique<cpu_scoped_param_update>(
+						std::make_unique<cpu_param_update>(params), settings_);
+			}
+
+		private:
+			unique_ptr<fw_op_diff_backend_t> create_fw_diff(const operation& op) {
 				switch (op.type_) {
 					case op_type::noop:
-					case op_type::identity: //TODO
-						break;
+						throw std::runtime_error("Noop has no value to differentiate");
+					case op_type::identity:
+						return std::make_unique<cpu_fp_identity>();
 					case op_type::matmul:
 						return std::make_unique<cpu_fp_matmul>();
 					case op_type::vecmatmul:
 						return std::make_unique<cpu_fp_vecmatmul>();
+					case op_type::matvecmul:
+						return std::make_unique<cpu_fp_matvecmul>();
+					case op_type::square:
+						return std::make_unique<cpu_fp_square>();
 					case op_type::add:
-						break;
-					default:
-						break;
+						return std::make_unique<cpu_fp_add>();
+					case op_type::sub:
+						return std::make_unique<cpu_fp_sub>();
+					case op_type::mult:
+						return std::make_unique<cpu_fp_mult>();
+					case op_type::reduce_sum:
+						return std::make_unique<cpu_fp_reduce>(reduced_axes(op), false);
+					case op_type::reduce_mean:
+						return std::make_unique<cpu_fp_reduce>(reduced_axes(op), true);
+					case op_type::dot_product:
+						return std::make_unique<cpu_fp_dot_product>();
+					case op_type::fused:
+						return std::make_unique<cpu_fp_fused>(op.block_);
+					case op_type::dense:
+						return std::make_unique<cpu_fp_dense>(dense_activation(op));
+					case op_type::reshape:
+					case op_type::transpose:
+					case op_type::slice:
+					case op_type::broadcast:
+						return std::make_unique<cpu_fp_view>(op);
 				}
 				throw std::runtime_error("Not implemented");
 			}
 
-			unique_ptr<bw_op_diff_backend_t> create_op_bw_diff_backend(
-					const operation& op 
-			) override {
+			unique_ptr<bw_op_diff_backend_t> create_bw_diff(const operation& op) {
 				switch (op.type_) {
 					case op_type::noop:
 					case op_type::identity: //TODO
@@ -127,18 +385,28 @@ namespace plearn::backend::cpu {
 					case op_type::mult:
 						return std::make_unique<cpu_bw_mult>();
 					case op_type::reduce_sum:
-						return std::make_unique<cpu_bw_reduce_sum>(op.iarg0_);
+						return std::make_unique<cpu_bw_reduce_sum>(reduced_axes(op));
 					case op_type::reduce_mean:
-						return std::make_unique<cpu_bw_reduce_mean>(op.iarg0_);
+						return std::make_unique<cpu_bw_reduce_mean>(reduced_axes(op));
 					case op_type::dot_product:
 						return std::make_unique<cpu_bw_dot_product>();
+					case op_type::fused:
+						return std::make_unique<cpu_bw_fused>(op.block_);
+					case op_type::dense:
+						return std::make_unique<cpu_bw_dense>(dense_activation(op));
+					case op_type::reshape:
+					case op_type::transpose:
+					case op_type::slice:
+					case op_type::broadcast:
+						return std::make_unique<cpu_bw_view>(op);
 
 				}
 				throw std::runtime_error("Not implemented");
 			}
 
-		private:
 			cpu_tensor_factory tens_fac_;
+			unique_ptr<env::thread_pool> pool_;
+			intra_op_settings settings_;
 	};
 }
 
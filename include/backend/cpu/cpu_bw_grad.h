@@ -6,13 +6,36 @@
 #include <backend/cpu/cpu_ops.h>
 #include <backend/cpu/cpu_types.h>
 #include <backend/cpu/cpu_op_impl.h>
+#include <backend/cpu/cpu_fused.h>
 
 namespace plearn::backend::cpu {
 
+	/**
+	 * The first writer of a gradient overwrites it, later writers accumulate.
+	 */
+	inline void grad_write(float& dst, float value, bool accumulate) {
+		dst = accumulate ? dst + value : value;
+	}
+
+	/**
+	 * Runs fn(i) for every row i of a gradient, split over the intra-op pool if it is large.
+	 */
+	template<typename Fn>
+	void for_each_grad_row(uint64_t size, uint64_t cols, Fn&& fn) {
+		parallel_for(size, size*cols, [&](uint64_t begin, uint64_t end) {
+			for (uint64_t i = begin; i < end; ++i) fn(i);
+		});
+	}
+
+	/*
+	 * Gradients of products are products themselves. A gradient buffer is [node, cols],
+	 * so the columns of the gradient of a product are the columns of one GEMM.
+	 */
+
 	class cpu_bw_vecmatmul : public bw_op_diff_backend_t {
 		public: 
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto other_input_ten = inputs_->at(1-in_idx);
@@ -20,17 +43,13 @@ namespace plearn::backend::cpu {
 
 			auto M = inputs_->at(0)->shape().dims[0];
 			auto N = inputs_->at(1)->shape().dims[1];
-			const auto out_size = out_outn_grad.out_shape.size();
+			const auto cols = out_outn_grad.cols();
 			if (in_idx == 0) {
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_matvecmul(other_input_buf, out_outn_grad_buf + a, in_outn_grad_buf + a,
-							M, N);
-				}
+				//[M, cols] = B [M, N] x grad [N, cols]
+				_cpu_matmul(other_input_buf, out_outn_grad_buf, in_outn_grad_buf, M, N, cols, accumulate);
 			} else { //in_idx == 1
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_matmul(other_input_buf, out_outn_grad_buf + a, in_outn_grad_buf + a,
-							M, 1, N, true);
-				}
+				//[M, N*cols] = a [M, 1] x grad [1, N*cols]
+				_cpu_matmul(other_input_buf, out_outn_grad_buf, in_outn_grad_buf, M, 1, N*cols, accumulate);
 			}
 		}
 	};
@@ -38,7 +57,7 @@ namespace plearn::backend::cpu {
 	class cpu_bw_matvecmul : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto other_input_ten = inputs_->at(1-in_idx);
@@ -46,17 +65,22 @@ namespace plearn::backend::cpu {
 
 			auto M = inputs_->at(0)->shape().dims[0];
 			auto N = inputs_->at(0)->shape().dims[1];
-			const auto out_size = out_outn_grad.out_shape.size();
+			const auto cols = out_outn_grad.cols();
 			if (in_idx == 0) {
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_matmul(out_outn_grad_buf + a, other_input_buf, in_outn_grad_buf + a,
-							M, 1, N, true);
+				if (cols == 1) {
+					//[M, N] = grad [M, 1] x b [1, N]
+					_cpu_matmul(out_outn_grad_buf, other_input_buf, in_outn_grad_buf, M, 1, N, accumulate);
+					return;
 				}
-			} else { //in_idx == 1
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_vecmatmul(out_outn_grad_buf + a, other_input_buf, in_outn_grad_buf + a,
-							M, N);
+				//row m: [N, cols] = b [N, 1] x grad [1, cols]
+				for (uint64_t m = 0; m < M; ++m) {
+					_cpu_matmul(other_input_buf, out_outn_grad_buf + m*cols, in_outn_grad_buf + m*N*cols,
+							N, 1, cols, accumulate);
 				}
+			} else { //in_idx == 1
+				//[N, cols] = A^T [N, M] x grad [M, cols]
+				_cpu_matmul(other_input_buf, out_outn_grad_buf, in_outn_grad_buf, N, M, cols,
+						accumulate, true, false);
 			}
 		}
 	};
@@ -64,7 +88,7 @@ namespace plearn::backend::cpu {
 	class cpu_bw_matmul : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto other_input_ten = inputs_->at(1-in_idx);
@@ -73,55 +97,109 @@ namespace plearn::backend::cpu {
 			auto M = inputs_->at(0)->shape().dims[0];
 			auto N = inputs_->at(0)->shape().dims[1];
 			auto K = inputs_->at(1)->shape().dims[1];
-			const auto out_size = out_outn_grad.out_shape.size();
+			const auto cols = out_outn_grad.cols();
 			if (in_idx == 0) {
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_matmul(out_outn_grad_buf + a, other_input_buf, in_outn_grad_buf + a,
-							M, K, N, true, false, true);
+				if (cols == 1) {
+					//[M, N] = grad [M, K] x B^T [K, N]
+					_cpu_matmul(out_outn_grad_buf, other_input_buf, in_outn_grad_buf,
+							M, K, N, accumulate, false, true);
+					return;
+				}
+				//row m: [N, cols] = B [N, K] x grad [K, cols]
+				for (uint64_t m = 0; m < M; ++m) {
+					_cpu_matmul(other_input_buf, out_outn_grad_buf + m*K*cols, in_outn_grad_buf + m*N*cols,
+							N, K, cols, accumulate);
 				}
 			} else { //in_idx == 1
-				for (uint64_t a = 0; a < out_size; ++a) {
-					_cpu_matmul(other_input_buf, out_outn_grad_buf + a, in_outn_grad_buf + a,
-							N, M, K, true, true, false);
+				//[N, K*cols] = A^T [N, M] x grad [M, K*cols]
+				_cpu_matmul(other_input_buf, out_outn_grad_buf, in_outn_grad_buf,
+						N, M, K*cols, accumulate, true, false);
+			}
+		}
+	};
+
+	/**
+	 * Gradient of act(x A + b). The output gradient is masked by the activation once,
+	 * then every input is a single GEMM over all columns of the gradient.
+	 */
+	class cpu_bw_dense : public bw_op_diff_backend_t {
+		public:
+		cpu_bw_dense(activation act) : act(act) {}
+		void update_grad(unsigned in_idx,
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
+			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
+			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
+			auto x_buf = ((cpu_tensor*)inputs_->at(0)->back())->get_content()->buf;
+			auto A_buf = ((cpu_tensor*)inputs_->at(1)->back())->get_content()->buf;
+			auto M = inputs_->at(1)->shape().dims[0];
+			auto N = inputs_->at(1)->shape().dims[1];
+			const auto cols = out_outn_grad.cols();
+
+			//gradient at the GEMM output, [N, cols]
+			auto grad = out_outn_grad_buf;
+			if (act == activation::relu) {
+				auto out_buf = ((cpu_tensor*)(*output_)->back())->get_content()->buf;
+				masked.resize(N * cols);
+				for (uint64_t j = 0; j < N; ++j) {
+					for (uint64_t c = 0; c < cols; ++c) {
+						masked[j*cols + c] = out_buf[j] > 0.f ? out_outn_grad_buf[j*cols + c] : 0.f;
+					}
 				}
+				grad = masked.data();
+			}
+
+			switch (in_idx) {
+				case 0: //[M, cols] = A [M, N] x grad [N, cols]
+					_cpu_matmul(A_buf, grad, in_outn_grad_buf, M, N, cols, accumulate);
+					break;
+				case 1: //[M, N*cols] = x [M, 1] x grad [1, N*cols]
+					_cpu_matmul(x_buf, grad, in_outn_grad_buf, M, 1, N*cols, accumulate);
+					break;
+				default: //bias
+					for (uint64_t i = 0; i < N*cols; ++i)
+						grad_write(in_outn_grad_buf[i], grad[i], accumulate);
 			}
 		}
+
+		private:
+		activation act;
+		vector<float> masked;
 	};
 
 	class cpu_bw_square : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned, 
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto in_buf = ((cpu_tensor*)inputs_->at(0)->back())->get_content()->buf;
 			auto& shape = in_outn_grad.in_shape;
 			auto size = shape.size();
-			auto& outn_shape = out_outn_grad.out_shape;
-			auto outn_size = outn_shape.size();
-			for (uint64_t i = 0; i < size; ++i) {
+			auto outn_size = out_outn_grad.cols();
+			for_each_grad_row(size, outn_size, [&](uint64_t i) {
 				for (uint64_t j = 0; j < outn_size; ++j) {
-					in_outn_grad_buf[i *outn_size +j] += 2 * in_buf[i] * out_outn_grad_buf[i *outn_size + j];
+					grad_write(in_outn_grad_buf[i *outn_size +j],
+							2 * in_buf[i] * out_outn_grad_buf[i *outn_size + j], accumulate);
 				}
-			}
+			});
 		}
 	};
 
 	class cpu_bw_add : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto& shape = in_outn_grad.in_shape;
 			auto size = shape.size();
-			auto& outn_shape = out_outn_grad.out_shape;
-			auto outn_size = outn_shape.size();
-			for (uint64_t i = 0; i < size; ++i) {
+			auto outn_size = out_outn_grad.cols();
+			for_each_grad_row(size, outn_size, [&](uint64_t i) {
 				for (uint64_t j = 0; j < outn_size; ++j) {
-					in_outn_grad_buf[i *outn_size +j] += out_outn_grad_buf[i *outn_size + j];
+					grad_write(in_outn_grad_buf[i *outn_size +j],
+							out_outn_grad_buf[i *outn_size + j], accumulate);
 				}
-			}
+			});
 		}
 	};
 
@@ -129,25 +207,26 @@ namespace plearn::backend::cpu {
 	class cpu_bw_sub : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto& shape = in_outn_grad.in_shape;
 			auto size = shape.size();
-			auto& outn_shape = out_outn_grad.out_shape;
-			auto outn_size = outn_shape.size();
+			auto outn_size = out_outn_grad.cols();
 			if (in_idx == 0) {
-				for (uint64_t i = 0; i < size; ++i) {
+				for_each_grad_row(size, outn_size, [&](uint64_t i) {
 					for (uint64_t j = 0; j < outn_size; ++j) {
-						in_outn_grad_buf[i *outn_size +j] += out_outn_grad_buf[i *outn_size + j];
+						grad_write(in_outn_grad_buf[i *outn_size +j],
+								out_outn_grad_buf[i *outn_size + j], accumulate);
 					}
-				}
+				});
 			} else {
-				for (uint64_t i = 0; i < size; ++i) {
+				for_each_grad_row(size, outn_size, [&](uint64_t i) {
 					for (uint64_t j = 0; j < outn_size; ++j) {
-						in_outn_grad_buf[i *outn_size +j] -= out_outn_grad_buf[i *outn_size + j];
+						grad_write(in_outn_grad_buf[i *outn_size +j],
+								-out_outn_grad_buf[i *outn_size + j], accumulate);
 					}
-				}
+				});
 			}
 		}
 	};
@@ -155,100 +234,175 @@ namespace plearn::backend::cpu {
 	class cpu_bw_mult : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto& shape = in_outn_grad.in_shape;
 			auto size = shape.size();
-			auto& outn_shape = out_outn_grad.out_shape;
-			auto outn_size = outn_shape.size();
+			auto outn_size = out_outn_grad.cols();
 			auto other_input_buf = ((cpu_tensor*)inputs_->at(1 - in_idx)->back())->get_content()->buf;
-			for (uint64_t i = 0; i < size; ++i) {
+			for_each_grad_row(size, outn_size, [&](uint64_t i) {
 				for (uint64_t j = 0; j < outn_size; ++j) {
-					in_outn_grad_buf[i *outn_size +j] += other_input_buf[i] * out_outn_grad_buf[i *outn_size + j];
+					grad_write(in_outn_grad_buf[i *outn_size +j],
+							other_input_buf[i] * out_outn_grad_buf[i *outn_size + j], accumulate);
 				}
-			}
+			});
 		}
 	};
 
 	class cpu_bw_dot_product : public bw_op_diff_backend_t {
 		public:
 		void update_grad(unsigned in_idx,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
 			auto& shape = in_outn_grad.in_shape;
 			auto size = shape.size();
-			auto& outn_shape = out_outn_grad.out_shape;
-			auto outn_size = outn_shape.size();
+			auto outn_size = out_outn_grad.cols();
 			auto other_input_buf = ((cpu_tensor*)inputs_->at(1 - in_idx)->back())->get_content()->buf;
-			for (uint64_t i = 0; i < size; ++i) {
+			for_each_grad_row(size, outn_size, [&](uint64_t i) {
 				for (uint64_t j = 0; j < outn_size; ++j) {
-					in_outn_grad_buf[i *outn_size +j] += other_input_buf[i] * out_outn_grad_buf[j];
+					grad_write(in_outn_grad_buf[i *outn_size +j],
+							other_input_buf[i] * out_outn_grad_buf[j], accumulate);
 				}
-			}
+			});
 		}
 	};
 
-	class cpu_bw_reduce_sum : public bw_op_diff_backend_t {
+	/**
+	 * Spreads the gradient of a reduction over the reduced axes of its input,
+	 * scaled by 1/count for a mean.
+	 */
+	class cpu_bw_reduce : public bw_op_diff_backend_t {
 		public:
-		cpu_bw_reduce_sum(unsigned axis) : axis(axis) {}
+		cpu_bw_reduce(vector<unsigned> axes, bool mean) : axes(std::move(axes)), mean(mean) {}
 		void update_grad(unsigned,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
-			auto size = in_outn_grad.in_shape.size();
-			uint64_t M = 1;
-			for (unsigned i = 0; i < axis; ++i) {
-				M *= in_outn_grad.in_shape.dims[i];
-			}
-			uint64_t AXIS_SIZE = in_outn_grad.in_shape.dims[axis];
-			uint64_t N = 1;
-			for (unsigned i = axis + 1; i < in_outn_grad.in_shape.dims.size(); ++i) {
-				N *= in_outn_grad.in_shape.dims[i];
+			auto& dims = in_outn_grad.in_shape.dims;
+			auto rank = dims.size();
+
+			//stride in the output of every input axis, 0 for the reduced ones
+			vector<uint64_t> out_strides(rank, 0);
+			uint64_t count = 1;
+			uint64_t stride = 1;
+			for (auto i = rank; i-- > 0;) {
+				if (std::ranges::find(axes, i) != axes.end()) {
+					count *= dims[i];
+					continue;
+				}
+				out_strides[i] = stride;
+				stride *= dims[i];
 			}
-			for (uint64_t m = 0; m < M; ++m) {
-				for (uint64_t a = 0; a < AXIS_SIZE; ++a) {
-					for (uint64_t n = 0; n < N; ++n) {
-						in_outn_grad_buf[m * AXIS_SIZE*N + a *N + n] += out_outn_grad_buf[m *N + n];
+			float scale = mean ? 1.f / count : 1.f;
+
+			//walk ranges of the input in order, keeping the index of the matching output element
+			auto size = in_outn_grad.in_shape.size();
+			parallel_for(size, size, [&](uint64_t begin, uint64_t end) {
+				vector<uint64_t> index(rank, 0);
+				uint64_t out_idx = 0;
+				for (auto d = rank, rest = begin; d-- > 0; rest /= dims[d]) {
+					index[d] = rest % dims[d];
+					out_idx += index[d] * out_strides[d];
+				}
+				for (uint64_t i = begin; i < end; ++i) {
+					grad_write(in_outn_grad_buf[i], out_outn_grad_buf[out_idx] * scale, accumulate);
+					for (auto d = rank; d-- > 0;) {
+						out_idx += out_strides[d];
+						if (++index[d] < dims[d]) break;
+						out_idx -= out_strides[d] * dims[d];
+						index[d] = 0;
 					}
 				}
-			}
+			});
 		}
 			
 		private:
-		unsigned axis;
+		vector<unsigned> axes;
+		bool mean;
 	};
 
-	class cpu_bw_reduce_mean : public bw_op_diff_backend_t {
+	class cpu_bw_reduce_sum : public cpu_bw_reduce {
 		public:
-		cpu_bw_reduce_mean(unsigned axis) : axis(axis) {}
-		void update_grad(unsigned,
-				const gradient& out_outn_grad, gradient& in_outn_grad) override {
+		cpu_bw_reduce_sum(unsigned axis) : cpu_bw_reduce({axis}, false) {}
+		cpu_bw_reduce_sum(vector<unsigned> axes) : cpu_bw_reduce(std::move(axes), false) {}
+	};
+
+	class cpu_bw_reduce_mean : public cpu_bw_reduce {
+		public:
+		cpu_bw_reduce_mean(unsigned axis) : cpu_bw_reduce({axis}, true) {}
+		cpu_bw_reduce_mean(vector<unsigned> axes) : cpu_bw_reduce(std::move(axes), true) {}
+	};
+
+	/**
+	 * Gradient of a fused block. The derivatives of the block wrt the input are carried
+	 * forward through its instructions a chunk at a time, then scaled by the gradient of
+	 * the output element every input element reduces into.
+	 */
+	class cpu_bw_fused : public bw_op_diff_backend_t {
+		public:
+		cpu_bw_fused(std::shared_ptr<const fused_block> block) : block(std::move(block)) {}
+		void update_grad(unsigned in_idx,
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
 			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
 			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
-			auto size = in_outn_grad.in_shape.size();
-			uint64_t M = 1;
-			for (unsigned i = 0; i < axis; ++i) {
-				M *= in_outn_grad.in_shape.dims[i];
-			}
-			uint64_t AXIS_SIZE = in_outn_grad.in_shape.dims[axis];
-			uint64_t N = 1;
-			for (unsigned i = axis + 1; i < in_outn_grad.in_shape.dims.size(); ++i) {
-				N *= in_outn_grad.in_shape.dims[i];
-			}
-			for (uint64_t m = 0; m < M; ++m) {
-				for (uint64_t a = 0; a < AXIS_SIZE; ++a) {
-					for (uint64_t n = 0; n < N; ++n) {
-						in_outn_grad_buf[m * AXIS_SIZE*N + a *N + n] += out_outn_grad_buf[m *N + n] / AXIS_SIZE;
+			vector<const float*> bufs(inputs_->size());
+			std::ranges::transform(*inputs_, bufs.begin(),
+					[](auto& in) { return ((cpu_tensor*)in->back())->get_content()->buf; });
+
+			auto dims = fused_view(*block, inputs_->at(0)->shape().dims);
+			auto scale = fused_scale(*block, dims);
+			auto outn_size = out_outn_grad.cols();
+			fused_eval eval{*block, bufs};
+			for_each_segment(dims, [&](uint64_t begin, uint64_t len, uint64_t out, bool) {
+				auto tangent = eval.tangent(in_idx, begin, len);
+				for (uint64_t e = 0; e < len; ++e) {
+					auto i = begin + e;
+					auto r = dims.inner_ == 1 ? out : out + e;
+					for (uint64_t j = 0; j < outn_size; ++j) {
+						grad_write(in_outn_grad_buf[i *outn_size +j],
+								tangent[e] * scale * out_outn_grad_buf[r *outn_size + j], accumulate);
 					}
 				}
-			}
+			});
 		}
-			
+
 		private:
-		unsigned axis;
+		std::shared_ptr<const fused_block> block;
 	};
 
-}
+	/**
+	 * Gathers the gradient of a view op back to the elements of its input,
+	 * the gradients of elements a broadcast repeats add up.
+	 */
+	class cpu_bw_view : public bw_op_diff_backend_t {
+		public:
+		cpu_bw_view(operation op) : op(std::move(op)) {}
+		void update_grad(unsigned,
+				const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) override {
+			auto out_outn_grad_buf = ((cpu_tensor*)out_outn_grad.back_.get())->get_content()->buf;
+			auto in_outn_grad_buf = ((cpu_tensor*)in_outn_grad.back_.get())->get_content()->buf;
+			auto& in_shape = in_outn_grad.in_shape;
+			auto& out_shape = out_outn_grad.in_shape;
+			auto outn_size = out_outn_grad.cols();
+			auto layout = *view_of(op, in_shape, in_shape.strides(), out_shape);
+
+			if (!accumulate) std::fill_n(in_outn_grad_buf, in_shape.size() * outn_size, 0.f);
+			auto inner = out_shape.dims.back();
+			auto stride = layout.strides_[out_shape.dims.size() - 1];
+			auto row = out_outn_grad_buf;
+			_cpu_strided_rows(out_shape.dims, layout.strides_, [&](uint64_t offset) {
+				for (uint64_t e = 0; e < inner; ++e) {
+					auto dst = in_outn_grad_buf + (layout.offset_ + offset + e*stride) * outn_size;
+					for (uint64_t j = 0; j < outn_size; ++j) dst[j] += row[j];
+					row += outn_size;
+				}
+			});
+		}
 
+		private:
+		operation op;
+	};
+
+}
@@ -1,170 +1,278 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <vector>
+
 #include <rep/rep_types.h>
+#include <rep/views.h>
 #include <environ/env_types.h>
 #include <backend/cpu/cpu_ops.h>
 #include <backend/cpu/cpu_types.h>
 #include <backend/cpu/cpu_op_impl.h>
+#include <backend/cpu/cpu_fused.h>
+#include <backend/cpu/cpu_parallel.h>
 
+/*
+ * Forward mode kernels. Tangents hold the tangents of all directions one after the
+ * other, so the tangent of a direction has the layout of the node and the tangents of
+ * a product over all directions are mostly a single GEMM.
+ */
 namespace plearn::backend::cpu {
 
-class cpu_fp_matmul : public fw_op_diff_backend_t {
-	void update_grad(unsigned input_idx,
-			const gradient& var_in_grad,  gradient& var_out_grad) override {
-		auto var_in_grad_buf = ((cpu_tensor*)var_in_grad.back_.get())->get_content()->buf;
-		auto var_out_grad_buf = ((cpu_tensor*)var_out_grad.back_.get())->get_content()->buf;
-		auto other_input_buf = ((cpu_tensor*)inputs_->at(1-input_idx)->back())->get_content()->buf;
-		auto& in1_shape = inputs_->at(0)->shape();
-		auto& in2_shape = inputs_->at(1)->shape();
-		auto M = in1_shape.dims[0];
-		auto N = in1_shape.dims[1];
-		auto K = in2_shape.dims[1];
-		if (input_idx == 0) {
-			//shape of var_i_grad: [A, M,N]
-			//shape of i_out_grad: [M,N, M,K]
-			//shape of var_out_grad: [A, M,K]
-			//var_out_grad[a, m2,k] = sum(m1,n) var_i_grad[a, m1,n] * i_out_grad[m1,n, m2,k]
-			//           = sum(n) var_i_grad[a, m2,n] * other[n,k]
-#define VAR_OUT_GRAD(a,m2,k) var_out_grad_buf[a *M*K + m2 *K + k]
-#define VAR_I_GRAD(a,m2,n) var_in_grad_buf[a *M*N + m2 *N + n]
-			for (uint64_t a = 0; a < var_in_grad.in_shape.size(); a++) {
-				for (uint64_t m2 = 0; m2 < M; m2++) {
-					for (uint64_t n = 0; n < N; n++) {
-						for (uint64_t k = 0; k < K; k++) {
-							VAR_OUT_GRAD(a,m2,k) += VAR_I_GRAD(a,m2,n) * other_input_buf[n *K + k];
-						}
-					}
-				}
-			}
-#undef VAR_OUT_GRAD
-#undef VAR_I_GRAD
-		} else { //input_idx == 1
-#define VAR_OUT_GRAD(a,m,k2) var_out_grad_buf[a *M*K + m *K + k2]
-#define VAR_I_GRAD(a,n,k2) var_in_grad_buf[a *N*K + n *K + k2]
-			for (uint64_t a = 0; a < var_in_grad.in_shape.size(); a++) {
-				for (uint64_t m = 0; m < M; m++) {
-					for (uint64_t n = 0; n < N; n++) {
-						for (uint64_t k2 = 0; k2 < K; k2++) {
-							VAR_OUT_GRAD(a,m,k2) += VAR_I_GRAD(a,n,k2) * other_input_buf[m *N + n];
-						}
-					}
-				}
+	inline float* value_buf(const tensor_p& t) {
+		return ((cpu_tensor*)t->back())->get_content()->buf;
+	}
+
+	//buffer of a tangent, null if it is zero
+	inline float* tangent_buf(const tensor_p& t) {
+		return t ? t->data() : nullptr;
+	}
+
+	/**
+	 * C[i] = fn(i) over len elements, split over the intra-op pool if large.
+	 */
+	template<typename Fn>
+	void for_each_tangent(float* C, uint64_t len, Fn&& fn) {
+		parallel_for(len, len, [&](uint64_t begin, uint64_t end) {
+			for (uint64_t i = begin; i < end; ++i) C[i] = fn(i);
+		});
+	}
+
+	class cpu_fp_add : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto dA = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dC = out_tangent->data();
+			auto len = (*output_)->shape().size() * directions;
+			if (dA && dB) _cpu_add(dA, dB, dC, len);
+			else std::copy_n(dA ? dA : dB, len, dC);
+		}
+	};
+
+	class cpu_fp_sub : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto dA = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dC = out_tangent->data();
+			auto len = (*output_)->shape().size() * directions;
+			if (dA && dB) _cpu_sub(dA, dB, dC, len);
+			else if (dA) std::copy_n(dA, len, dC);
+			else for_each_tangent(dC, len, [=](uint64_t i) { return -dB[i]; });
+		}
+	};
+
+	class cpu_fp_mult : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto A = value_buf(inputs_->at(0)), B = value_buf(inputs_->at(1));
+			auto dA = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dC = out_tangent->data();
+			auto size = (*output_)->shape().size();
+			//a' b + a b'
+			for_each_tangent(dC, size * directions, [=](uint64_t i) {
+				auto e = i % size;
+				return (dA ? dA[i] * B[e] : 0.f) + (dB ? A[e] * dB[i] : 0.f);
+			});
+		}
+	};
+
+	class cpu_fp_square : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto A = value_buf(inputs_->at(0));
+			auto dA = tangent_buf(in_tangents[0]);
+			auto size = (*output_)->shape().size();
+			for_each_tangent(out_tangent->data(), size * directions,
+					[=](uint64_t i) { return 2 * A[i % size] * dA[i]; });
+		}
+	};
+
+	class cpu_fp_matmul : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto A = value_buf(inputs_->at(0)), B = value_buf(inputs_->at(1));
+			auto dA = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dC = out_tangent->data();
+			auto M = inputs_->at(0)->shape().dims[0];
+			auto N = inputs_->at(0)->shape().dims[1];
+			auto K = inputs_->at(1)->shape().dims[1];
+			//the directions of dA stacked, [directions*M, N] x B [N, K]
+			if (dA) _cpu_matmul(dA, B, dC, directions*M, N, K);
+			if (dB) {
+				for (uint64_t d = 0; d < directions; ++d)
+					_cpu_matmul(A, dB + d*N*K, dC + d*M*K, M, N, K, dA != nullptr);
 			}
-#undef VAR_OUT_GRAD
-#undef VAR_I_GRAD
 		}
-	}
+	};
 
-	void update_grad_with_identity(unsigned input_idx, 
-			gradient& var_out_grad) override { 
-		auto var_out_grad_buf = ((cpu_tensor*)var_out_grad.back_.get())->get_content()->buf;
-		auto other_input_buf = ((cpu_tensor*)inputs_->at(1-input_idx)->back())->get_content()->buf;
-		auto& in1_shape = inputs_->at(0)->shape();
-		auto& in2_shape = inputs_->at(1)->shape();
-		auto M = in1_shape.dims[0];
-		auto N = in1_shape.dims[1];
-		auto K = in2_shape.dims[1];
-
-		if (input_idx == 0) {
-
-#define VAR_OUT_GRAD(m1,n,m2,k) var_out_grad_buf[m1 * N * M * K + n * M * K + m2 * K + k]
-			for (uint64_t m1 = 0; m1 < M; m1++) {
-				for (uint64_t n = 0; n < N; n++) {
-					for (uint64_t k = 0; k < K; k++) {
-						auto m2 = m1;
-						VAR_OUT_GRAD(m1,n,m2,k) = other_input_buf[n*K + k];
-
-					}
-				}
+	class cpu_fp_vecmatmul : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto a = value_buf(inputs_->at(0)), B = value_buf(inputs_->at(1));
+			auto da = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dc = out_tangent->data();
+			auto M = inputs_->at(1)->shape().dims[0];
+			auto N = inputs_->at(1)->shape().dims[1];
+			//da [directions, M] x B [M, N]
+			if (da) _cpu_matmul(da, B, dc, directions, M, N);
+			if (dB) {
+				for (uint64_t d = 0; d < directions; ++d)
+					_cpu_vecmatmul(a, dB + d*M*N, dc + d*N, M, N, da != nullptr);
 			}
-#undef VAR_OUT_GRAD
-		} else { //input_idx == 1
-#define VAR_OUT_GRAD(n,k1,m,k2) var_out_grad_buf[n *M*K*K + k1 *M*K + m*K + k2]
-			for (uint64_t n = 0; n < N; n++) {
-				for (uint64_t m = 0; m < M; m++) {
-					for (uint64_t k1 = 0; k1 < K; k1++) {
-						auto k2 = k1;
-						VAR_OUT_GRAD(n,k1,m,k2) += other_input_buf[m *N + n];
-					}
-				}
+		}
+	};
+
+	class cpu_fp_matvecmul : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto A = value_buf(inputs_->at(0)), b = value_buf(inputs_->at(1));
+			auto dA = tangent_buf(in_tangents[0]), db = tangent_buf(in_tangents[1]);
+			auto dc = out_tangent->data();
+			auto M = inputs_->at(0)->shape().dims[0];
+			auto N = inputs_->at(0)->shape().dims[1];
+			//dA [directions*M, N] x b [N]
+			if (dA) _cpu_matvecmul(dA, b, dc, directions*M, N);
+			//db [directions, N] x A^T [N, M]
+			if (db) _cpu_matmul(db, A, dc, directions, N, M, dA != nullptr, false, true);
+		}
+	};
+
+	class cpu_fp_dot_product : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto A = value_buf(inputs_->at(0)), B = value_buf(inputs_->at(1));
+			auto dA = tangent_buf(in_tangents[0]), dB = tangent_buf(in_tangents[1]);
+			auto dC = out_tangent->data();
+			auto size = inputs_->at(0)->shape().size();
+			for (uint64_t d = 0; d < directions; ++d) {
+				if (dA) _cpu_dot_product(dA + d*size, B, dC + d, size);
+				if (dB) _cpu_dot_product(A, dB + d*size, dC + d, size, dA != nullptr);
 			}
-#undef VAR_OUT_GRAD
+		}
+	};
 
+	/**
+	 * Reductions are linear, the tangents are reduced like the values.
+	 */
+	class cpu_fp_reduce : public fw_op_diff_backend_t {
+		public:
+		cpu_fp_reduce(std::vector<unsigned> axes, bool mean) : axes(std::move(axes)), mean(mean) {}
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto dA = tangent_buf(in_tangents[0]);
+			auto dC = out_tangent->data();
+			auto& shape = inputs_->at(0)->shape();
+			auto out_size = (*output_)->shape().size();
+			for (uint64_t d = 0; d < directions; ++d) {
+				if (mean) _cpu_reduce_mean(dA + d*shape.size(), dC + d*out_size, axes, shape.dims);
+				else _cpu_reduce_sum(dA + d*shape.size(), dC + d*out_size, axes, shape.dims);
+			}
 		}
 
-	}
-};
-
-
-
-class cpu_fp_vecmatmul : public fw_op_diff_backend_t {
-	void update_grad(unsigned input_idx,
-			const gradient& var_in_grad,  gradient& var_out_grad) override {
-		auto var_in_grad_buf = ((cpu_tensor*)var_in_grad.back_.get())->get_content()->buf;
-		auto var_out_grad_buf = ((cpu_tensor*)var_out_grad.back_.get())->get_content()->buf;
-		auto other_input_ten = inputs_->at(1-input_idx);
-		auto other_input_buf = ((cpu_tensor*)other_input_ten->back())->get_content()->buf;
-		auto M = var_in_grad.out_shape.dims[0];
-		auto N = var_out_grad.out_shape.dims[0];
-		if (input_idx == 0) {
-			//shape of var_i_grad: [A, M]
-			//shape of i_out_grad: [M, N]
-			//shape of var_out_grad: [A, N]
-			//var_out_grad[a, n] = sum(m) var_i_grad[a, m] * i_out_grad[m, n]
-			//		   = sum(m) var_i_grad[a, m] * second[m,n]
-#define VAR_OUT_GRAD(a,n) var_out_grad_buf[a *N + n]
-#define VAR_I_GRAD(a,m) var_in_grad_buf[a *M + m]
-			for (uint64_t a = 0; a < var_in_grad.in_shape.size(); a++) {
-				for (uint64_t m = 0; m < M; m++) {
-					for (uint64_t n = 0; n < N; n++) {
-						VAR_OUT_GRAD(a,n) += VAR_I_GRAD(a,m) * other_input_buf[m *N + n];
-					}
-				}
+		private:
+		std::vector<unsigned> axes;
+		bool mean;
+	};
+
+	/**
+	 * Tangent of act(x A + b): the tangent at the GEMM output, dx A + x dA + db,
+	 * masked by the activation.
+	 */
+	class cpu_fp_dense : public fw_op_diff_backend_t {
+		public:
+		cpu_fp_dense(activation act) : act(act) {}
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto x = value_buf(inputs_->at(0)), A = value_buf(inputs_->at(1));
+			auto dx = tangent_buf(in_tangents[0]), dA = tangent_buf(in_tangents[1]);
+			auto db = in_tangents.size() > 2 ? tangent_buf(in_tangents[2]) : nullptr;
+			auto dy = out_tangent->data();
+			auto M = inputs_->at(1)->shape().dims[0];
+			auto N = inputs_->at(1)->shape().dims[1];
+
+			if (db) std::copy_n(db, directions*N, dy);
+			bool add = db != nullptr;
+			//dx [directions, M] x A [M, N]
+			if (dx) _cpu_matmul(dx, A, dy, directions, M, N, add);
+			add |= dx != nullptr;
+			if (dA) {
+				for (uint64_t d = 0; d < directions; ++d)
+					_cpu_vecmatmul(x, dA + d*M*N, dy + d*N, M, N, add);
 			}
-#undef VAR_OUT_GRAD
-#undef VAR_I_GRAD
-		} else { //input_idx == 1
-				 //var_out_grad[a, n2] = sum(m,n1) var_i_grad[a, m,n1] * i_out_grad[m,n1, n2]
-				 //		   = sum(m) var_i_grad[a, m,n2] * first[m]
-#define VAR_OUT_GRAD(a,n2) var_out_grad_buf[a *N + n2]
-#define VAR_I_GRAD(a,m,n2) var_in_grad_buf[a *M*N + m *N + n2]
-			for (uint64_t a = 0; a < var_in_grad.in_shape.size(); a++) {
-				for (uint64_t m = 0; m < M; m++) {
-					for (uint64_t n2 = 0; n2 < N; n2++) {
-						VAR_OUT_GRAD(a,n2) += VAR_I_GRAD(a,m,n2) * other_input_buf[m];
-					}
-				}
+			if (act == activation::relu) {
+				auto y = value_buf(*output_);
+				for_each_tangent(dy, directions*N,
+						[=](uint64_t i) { return y[i % N] > 0.f ? dy[i] : 0.f; });
 			}
-#undef VAR_OUT_GRAD
-#undef VAR_I_GRAD
 		}
-	}
 
+		private:
+		activation act;
+	};
 
-	void update_grad_with_identity(unsigned input_idx, 
-			gradient& var_out_grad) override {
-		auto other_input_ten = inputs_->at(1-input_idx);
-		auto other_input_buf = ((cpu_tensor*)other_input_ten->back())->get_content()->buf;
-		auto var_out_grad_buf = ((cpu_tensor*)var_out_grad.back_.get())->get_content()->buf;
-		auto M = inputs_->at(0)->shape().dims[0];
-		auto N = var_out_grad.out_shape.dims[0];
-		if (input_idx == 0) {
-			for (uint64_t m = 0; m < M; m++) {
-				for (uint64_t n = 0; n < N; n++) {
-					var_out_grad_buf[m *N + n] += other_input_buf[m *N + n];
+	class cpu_fp_fused : public fw_op_diff_backend_t {
+		public:
+		cpu_fp_fused(std::shared_ptr<const fused_block> block) : block(std::move(block)) {}
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			vector<const float*> bufs(inputs_->size());
+			std::ranges::transform(*inputs_, bufs.begin(), value_buf);
+			auto dims = fused_view(*block, inputs_->at(0)->shape().dims);
+			auto in_size = dims.size(), out_size = dims.outer_ * dims.inner_;
+			vector<const float*> tangents(in_tangents.size());
+			for (uint64_t d = 0; d < directions; ++d) {
+				for (unsigned i = 0; i < in_tangents.size(); ++i) {
+					auto dA = tangent_buf(in_tangents[i]);
+					tangents[i] = dA ? dA + d*in_size : nullptr;
 				}
+				_cpu_fused_jvp(*block, bufs, tangents, out_tangent->data() + d*out_size,
+						dims, fused_scale(*block, dims));
 			}
-		} else { //input_idx == 1
-			for (uint64_t m0 = 0; m0 < M; m0++) {
-				for (uint64_t n0 = 0; n0 < N; n0++) {
-					auto n2 = n0;
-					var_out_grad_buf[m0 *N*N + n0 *N + n2] += other_input_buf[m0];
-				}
+		}
+
+		private:
+		std::shared_ptr<const fused_block> block;
+	};
+
+	/**
+	 * The tangent of a view is the same view of the tangent of its input, copied.
+	 */
+	class cpu_fp_identity : public fw_op_diff_backend_t {
+		public:
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto len = (*output_)->shape().size() * directions;
+			std::copy_n(tangent_buf(in_tangents[0]), len, out_tangent->data());
+		}
+	};
+
+	class cpu_fp_view : public fw_op_diff_backend_t {
+		public:
+		cpu_fp_view(operation op) : op(std::move(op)) {}
+		void update_tangent(const vector<tensor_p>& in_tangents,
+				const tensor_p& out_tangent, uint64_t directions) override {
+			auto dA = tangent_buf(in_tangents[0]);
+			auto dC = out_tangent->data();
+			auto& in_shape = inputs_->at(0)->shape();
+			auto& out_shape = (*output_)->shape();
+			auto layout = *view_of(op, in_shape, in_shape.strides(), out_shape);
+			for (uint64_t d = 0; d < directions; ++d) {
+				_cpu_copy_strided(dA + d*in_shape.size() + layout.offset_, dC + d*out_shape.size(),
+						out_shape.dims, layout.strides_);
 			}
 		}
-	}
-};
 
-}
+		private:
+		operation op;
+	};
 
+}
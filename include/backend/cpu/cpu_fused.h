@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include <rep/ops.h>
+#include <backend/cpu/cpu_op_impl.h>
+#include <backend/cpu/cpu_simd.h>
+
+namespace plearn::backend::cpu {
+
+	//elements a fused block evaluates at once, the rows of all instructions stay in L1
+	inline constexpr uint64_t fused_chunk = 256;
+
+	/**
+	 * Evaluates a fused block on chunks of its inputs.
+	 * Every instruction writes a row of fused_chunk floats, so no intermediate tensor
+	 * is materialized.
+	 */
+	class fused_eval {
+		public:
+			fused_eval(const rep::fused_block& block, std::span<const float* const> inputs) :
+				block_{block}, inputs_{inputs}, k_{simd::active()},
+				rows_(block.instrs_.size() * fused_chunk) {}
+
+			/**
+			 * Values of elements [begin, begin + len), the last instruction writes to out if set.
+			 */
+			const float* eval(uint64_t begin, uint64_t len, float* out = nullptr) {
+				auto& instrs = block_.instrs_;
+				for (unsigned i = 0; i < instrs.size(); ++i) {
+					auto dst = out && i + 1 == instrs.size() ? out : row(i);
+					auto a = value(instrs[i].a_, begin);
+					auto b = value(instrs[i].b_, begin);
+					switch (instrs[i].type_) {
+						case rep::op_type::add:
+							k_.add(a, b, dst, len);
+							break;
+						case rep::op_type::sub:
+							k_.sub(a, b, dst, len);
+							break;
+						case rep::op_type::mult:
+							k_.mult(a, b, dst, len);
+							break;
+						case rep::op_type::square:
+							k_.square(a, dst, len);
+							break;
+						default:
+							throw std::runtime_error("Op not fusable");
+					}
+					if (dst != row(i)) return dst;
+				}
+				return row(instrs.size() - 1);
+			}
+
+			/**
+			 * Derivatives of elements [begin, begin + len) of the result wrt input `wrt`,
+			 * carried forward through the instructions with the values.
+			 */
+			const float* tangent(unsigned wrt, uint64_t begin, uint64_t len) {
+				return propagate(begin, len, [&](unsigned operand) {
+					return operand == wrt ? ones_.data() : zeros_.data();
+				});
+			}
+
+			/**
+			 * Tangents of elements [begin, begin + len) of the result, given tangents of the
+			 * inputs. A null input tangent is zero.
+			 */
+			const float* tangent(std::span<const float* const> in_tangents, uint64_t begin, uint64_t len) {
+				return propagate(begin, len, [&](unsigned operand) {
+					return in_tangents[operand] ? in_tangents[operand] + begin : zeros_.data();
+				});
+			}
+
+		private:
+			//in_tangent(operand) is the tangent row of an input operand
+			template<typename InTangent>
+			const float* propagate(uint64_t begin, uint64_t len, InTangent&& in_tangent) {
+				auto& instrs = block_.instrs_;
+				tangents_.resize(rows_.size());
+				if (ones_.empty()) {
+					ones_.assign(fused_chunk, 1.f);
+					zeros_.assign(fused_chunk, 0.f);
+					tmp_.resize(fused_chunk);
+				}
+				eval(begin, len);
+				auto tan = [&](unsigned operand) -> const float* {
+					if (operand >= block_.inputs_)
+						return tangents_.data() + (operand - block_.inputs_) * fused_chunk;
+					return in_tangent(operand);
+				};
+				for (unsigned i = 0; i < instrs.size(); ++i) {
+					auto dst = tangents_.data() + i * fused_chunk;
+					auto& ins = instrs[i];
+					switch (ins.type_) {
+						case rep::op_type::add:
+							k_.add(tan(ins.a_), tan(ins.b_), dst, len);
+							break;
+						case rep::op_type::sub:
+							k_.sub(tan(ins.a_), tan(ins.b_), dst, len);
+							break;
+						case rep::op_type::mult:
+							//a' b + a b'
+							k_.mult(tan(ins.a_), value(ins.b_, begin), dst, len);
+							k_.mult(value(ins.a_, begin), tan(ins.b_), tmp_.data(), len);
+							k_.add(dst, tmp_.data(), dst, len);
+							break;
+						case rep::op_type::square:
+							//2 a a'
+							k_.mult(value(ins.a_, begin), tan(ins.a_), dst, len);
+							k_.add(dst, dst, dst, len);
+							break;
+						default:
+							throw std::runtime_error("Op not fusable");
+					}
+				}
+				return tangents_.data() + (instrs.size() - 1) * fused_chunk;
+			}
+
+			float* row(unsigned instr) { return rows_.data() + instr * fused_chunk; }
+
+			const float* value(unsigned operand, uint64_t begin) {
+				if (operand < block_.inputs_) return inputs_[operand] + begin;
+				return row(operand - block_.inputs_);
+			}
+
+			const rep::fused_block& block_;
+			std::span<const float* const> inputs_;
+			const simd::kernels& k_;
+			std::vector<float> rows_;
+			std::vector<float> tangents_;
+			std::vector<float> ones_, zeros_, tmp_;
+	};
+
+	/**
+	 * The reduction view of a block on inputs of `shape`, [1, 1, size] if it has no reduction.
+	 */
+	inline reduce_dims fused_view(const rep::fused_block& block, const rep::shape_dims& shape) {
+		if (block.reduce_.type_ == rep::op_type::noop) {
+			uint64_t size = 1;
+			for (auto d: shape) size *= d;
+			return {1, 1, size};
+		}
+		auto axes = rep::reduced_axes(block.reduce_);
+		return reduce_view(shape, axes.front(), axes.back());
+	}
+
+	inline float fused_scale(const rep::fused_block& block, const reduce_dims& dims) {
+		return block.reduce_.type_ == rep::op_type::reduce_mean ? 1.f / dims.axis_ : 1.f;
+	}
+
+	/**
+	 * Visits the elements of a reduction view in contiguous segments of at most fused_chunk
+	 * elements, calling fn(begin, len, out, first). If the innermost axis is reduced the whole
+	 * segment reduces into output element out, otherwise element e of the segment goes to
+	 * out + e. first is set for the first segment reaching an output element.
+	 */
+	template<typename Fn>
+	void for_each_segment(const reduce_dims& dims, Fn&& fn) {
+		auto [outer, axis_len, inner] = dims;
+		for (uint64_t o = 0; o < outer; ++o) {
+			if (inner == 1) {
+				for (uint64_t a0 = 0; a0 < axis_len; a0 += fused_chunk)
+					fn(o*axis_len + a0, std::min(fused_chunk, axis_len - a0), o, a0 == 0);
+				continue;
+			}
+			for (uint64_t a = 0; a < axis_len; ++a) {
+				for (uint64_t j0 = 0; j0 < inner; j0 += fused_chunk)
+					fn((o*axis_len + a)*inner + j0, std::min(fused_chunk, inner - j0), o*inner + j0, a == 0);
+			}
+		}
+	}
+
+	//a fused block on the elements of a view
+	inline void _cpu_fused_view(const rep::fused_block& block, std::span<const float* const> inputs,
+			float* C, const reduce_dims& dims, float scale) {
+		auto& k = simd::active();
+		fused_eval eval{block, inputs};
+		if (dims.inner_ == 1) {
+			for_each_segment(dims, [&](uint64_t begin, uint64_t len, uint64_t out, bool first) {
+				auto sum = k.sum(eval.eval(begin, len), len);
+				C[out] = first ? sum : C[out] + sum;
+			});
+		} else {
+			for_each_segment(dims, [&](uint64_t begin, uint64_t len, uint64_t out, bool first) {
+				if (first) eval.eval(begin, len, C + out);
+				else k.add(C + out, eval.eval(begin, len), C + out, len);
+			});
+		}
+		if (scale != 1.f) {
+			for (uint64_t i = 0; i < dims.outer_ * dims.inner_; ++i) C[i] *= scale;
+		}
+	}
+
+	/**
+	 * Tangents of a fused block on the view dims of its inputs from tangents of the inputs,
+	 * a null input tangent is zero. C is overwritten.
+	 */
+	inline void _cpu_fused_jvp(const rep::fused_block& block, std::span<const float* const> inputs,
+			std::span<const float* const> in_tangents, float* C, const reduce_dims& dims, float scale) {
+		auto& k = simd::active();
+		fused_eval eval{block, inputs};
+		for_each_segment(dims, [&](uint64_t begin, uint64_t len, uint64_t out, bool first) {
+			auto tangent = eval.tangent(in_tangents, begin, len);
+			if (dims.inner_ == 1) {
+				auto sum = k.sum(tangent, len);
+				C[out] = first ? sum : C[out] + sum;
+			} else if (first) {
+				std::copy_n(tangent, len, C + out);
+			} else {
+				k.add(C + out, tangent, C + out, len);
+			}
+		});
+		if (scale != 1.f) {
+			for (uint64_t i = 0; i < dims.outer_ * dims.inner_; ++i) C[i] *= scale;
+		}
+	}
+
+	/**
+	 * Runs a fused block on the view dims of its inputs, C is overwritten.
+	 * Large blocks are split over the intra-op pool, by outer rows of the reduction,
+	 * or by ranges of elements if the block has no reduction.
+	 */
+	inline void _cpu_fused(const rep::fused_block& block, std::span<const float* const> inputs,
+			float* C, const reduce_dims& dims, float scale) {
+		auto elementwise = block.reduce_.type_ == rep::op_type::noop;
+		auto work = dims.size() * block.instrs_.size();
+		auto n = elementwise ? dims.inner_ : dims.outer_;
+		//elements of the input and the output per unit of n
+		auto in_step = elementwise ? 1 : dims.axis_ * dims.inner_;
+		auto out_step = elementwise ? 1 : dims.inner_;
+		parallel_for(n, work, [&](uint64_t begin, uint64_t end) {
+			auto part = elementwise ? reduce_dims{1, 1, end - begin} :
+				reduce_dims{end - begin, dims.axis_, dims.inner_};
+			if (begin == 0) {
+				_cpu_fused_view(block, inputs, C, part, scale);
+				return;
+			}
+			std::vector<const float*> offset(inputs.size());
+			for (unsigned i = 0; i < inputs.size(); ++i) offset[i] = inputs[i] + begin*in_step;
+			_cpu_fused_view(block, offset, C + begin*out_step, part, scale);
+		});
+	}
+
+	/**
+	 * Runs a fused block on inputs of `shape`, C is overwritten.
+	 */
+	inline void _cpu_fused(const rep::fused_block& block, std::span<const float* const> inputs,
+			float* C, const rep::shape_dims& shape) {
+		auto dims = fused_view(block, shape);
+		_cpu_fused(block, inputs, C, dims, fused_scale(block, dims));
+	}
+
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <immintrin.h>
+#include <vector>
+
+#include <backend/cpu/cpu_simd.h>
+
+/*
+ * Packed, register blocked SGEMM and SGEMV, used when the backend is built
+ * without OpenBLAS. Sizes follow the kernels: C [m, k] = op(A) [m, n] x op(B) [n, k].
+ */
+namespace plearn::backend::cpu::gemm {
+
+	//rows and columns of C a micro kernel keeps in registers, 12 of the 16 ymm registers
+	inline constexpr uint64_t tile_rows = 6;
+	inline constexpr uint64_t tile_cols = 16;
+
+	//panel sizes, a packed B slice of inner_block rows stays in L1 and a packed A block in L2
+	inline constexpr uint64_t inner_block = 256;
+	inline constexpr uint64_t rows_block = 72;
+	inline constexpr uint64_t cols_block = 2048;
+
+	/**
+	 * Adds the product of a packed row panel [tile_rows, n] and a packed column panel
+	 * [n, tile_cols] to the tile of C with leading dimension ldc, or writes it there
+	 * if `add` is not set.
+	 */
+	using micro_kernel = void (*)(const float* A, const float* B, float* C, uint64_t ldc,
+			uint64_t n, bool add);
+
+	inline void micro_scalar(const float* A, const float* B, float* C, uint64_t ldc,
+			uint64_t n, bool add) {
+		float acc[tile_rows * tile_cols]{};
+		for (uint64_t l = 0; l < n; ++l) {
+			for (uint64_t r = 0; r < tile_rows; ++r) {
+				for (uint64_t c = 0; c < tile_cols; ++c)
+					acc[r*tile_cols + c] += A[l*tile_rows + r] * B[l*tile_cols + c];
+			}
+		}
+		for (uint64_t r = 0; r < tile_rows; ++r) {
+			for (uint64_t c = 0; c < tile_cols; ++c) {
+				auto& dst = C[r*ldc + c];
+				dst = add ? dst + acc[r*tile_cols + c] : acc[r*tile_cols + c];
+			}
+		}
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void micro_avx2(const float* A, const float* B, float* C, uint64_t ldc,
+			uint64_t n, bool add) {
+		//every loop over the rows is unrolled, so the accumulators stay in registers
+		__m256 acc[tile_rows][2];
+		#pragma GCC unroll 6
+		for (uint64_t r = 0; r < tile_rows; ++r) acc[r][0] = acc[r][1] = _mm256_setzero_ps();
+		for (uint64_t l = 0; l < n; ++l) {
+			auto b0 = _mm256_loadu_ps(B + l*tile_cols);
+			auto b1 = _mm256_loadu_ps(B + l*tile_cols + 8);
+			#pragma GCC unroll 6
+			for (uint64_t r = 0; r < tile_rows; ++r) {
+				auto a = _mm256_broadcast_ss(A + l*tile_rows + r);
+				acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+				acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+			}
+		}
+		#pragma GCC unroll 6
+		for (uint64_t r = 0; r < tile_rows; ++r) {
+			auto dst = C + r*ldc;
+			if (add) {
+				acc[r][0] = _mm256_add_ps(acc[r][0], _mm256_loadu_ps(dst));
+				acc[r][1] = _mm256_add_ps(acc[r][1], _mm256_loadu_ps(dst + 8));
+			}
+			_mm256_storeu_ps(dst, acc[r][0]);
+			_mm256_storeu_ps(dst + 8, acc[r][1]);
+		}
+	}
+
+	inline micro_kernel micro_for(simd::isa set) {
+		return set == simd::isa::scalar ? micro_scalar : micro_avx2;
+	}
+
+	/**
+	 * Copies rows [i0, i0 + rows) and inner indices [l0, l0 + n) of op(A) into row panels
+	 * of tile_rows, column major inside a panel. Missing rows of the last panel are zero.
+	 */
+	inline void pack_a(const float* A, uint64_t lda, bool transpose, uint64_t i0, uint64_t rows,
+			uint64_t l0, uint64_t n, float* dst) {
+		for (uint64_t p = 0; p < rows; p += tile_rows) {
+			auto panel = std::min(tile_rows, rows - p);
+			for (uint64_t l = 0; l < n; ++l) {
+				for (uint64_t r = 0; r < tile_rows; ++r) {
+					auto i = i0 + p + r, li = l0 + l;
+					*dst++ = r >= panel ? 0.f : transpose ? A[li*lda + i] : A[i*lda + li];
+				}
+			}
+		}
+	}
+
+	/**
+	 * Copies inner indices [l0, l0 + n) and columns [j0, j0 + cols) of op(B) into column
+	 * panels of tile_cols, row major inside a panel. Missing columns of the last panel are zero.
+	 */
+	inline void pack_b(const float* B, uint64_t ldb, bool transpose, uint64_t l0, uint64_t n,
+			uint64_t j0, uint64_t cols, float* dst) {
+		for (uint64_t p = 0; p < cols; p += tile_cols) {
+			auto panel = std::min(tile_cols, cols - p);
+			for (uint64_t l = 0; l < n; ++l) {
+				auto li = l0 + l;
+				if (!transpose && panel == tile_cols) {
+					std::copy_n(B + li*ldb + j0 + p, tile_cols, dst);
+					dst += tile_cols;
+					continue;
+				}
+				for (uint64_t c = 0; c < tile_cols; ++c) {
+					auto j = j0 + p + c;
+					*dst++ = c >= panel ? 0.f : transpose ? B[j*ldb + li] : B[li*ldb + j];
+				}
+			}
+		}
+	}
+
+	//C [k] = A [n] x B [n, k] with leading dimension ldb, in column blocks of 32
+	__attribute__((target("avx2,fma")))
+	inline void vecmat_avx2(const float* A, const float* B, float* C, uint64_t n, uint64_t k,
+			uint64_t ldb, bool add) {
+		uint64_t j = 0;
+		for (; j + 32 <= k; j += 32) {
+			__m256 acc[4];
+			for (unsigned v = 0; v < 4; ++v)
+				acc[v] = add ? _mm256_loadu_ps(C + j + 8*v) : _mm256_setzero_ps();
+			for (uint64_t l = 0; l < n; ++l) {
+				auto a = _mm256_broadcast_ss(A + l);
+				for (unsigned v = 0; v < 4; ++v)
+					acc[v] = _mm256_fmadd_ps(a, _mm256_loadu_ps(B + l*ldb + j + 8*v), acc[v]);
+			}
+			for (unsigned v = 0; v < 4; ++v) _mm256_storeu_ps(C + j + 8*v, acc[v]);
+		}
+		for (; j + 8 <= k; j += 8) {
+			auto acc = add ? _mm256_loadu_ps(C + j) : _mm256_setzero_ps();
+			for (uint64_t l = 0; l < n; ++l)
+				acc = _mm256_fmadd_ps(_mm256_broadcast_ss(A + l), _mm256_loadu_ps(B + l*ldb + j), acc);
+			_mm256_storeu_ps(C + j, acc);
+		}
+		for (; j < k; ++j) {
+			float acc = add ? C[j] : 0.f;
+			for (uint64_t l = 0; l < n; ++l) acc += A[l] * B[l*ldb + j];
+			C[j] = acc;
+		}
+	}
+
+	inline void vecmat_scalar(const float* A, const float* B, float* C, uint64_t n, uint64_t k,
+			uint64_t ldb, bool add) {
+		if (!add) std::fill_n(C, k, 0.f);
+		for (uint64_t l = 0; l < n; ++l) {
+			for (uint64_t j = 0; j < k; ++j) C[j] += A[l] * B[l*ldb + j];
+		}
+	}
+
+	/**
+	 * C [k] = A [n] x B [n, k], B row major with leading dimension ldb.
+	 */
+	inline void sgemv_t(const float* A, const float* B, float* C, uint64_t n, uint64_t k,
+			uint64_t ldb, bool add, simd::isa set = simd::best_isa()) {
+		if (set == simd::isa::scalar) vecmat_scalar(A, B, C, n, k, ldb, add);
+		else vecmat_avx2(A, B, C, n, k, ldb, add);
+	}
+
+	/**
+	 * C [m] = A [m, n] x B [n], A row major with leading dimension lda.
+	 */
+	inline void sgemv(const float* A, const float* B, float* C, uint64_t m, uint64_t n,
+			uint64_t lda, bool add, simd::isa set = simd::best_isa()) {
+		auto& k = simd::kernels_for(set);
+		for (uint64_t i = 0; i < m; ++i) {
+			auto dot = k.dot(A + i*lda, B, n);
+			C[i] = add ? C[i] + dot : dot;
+		}
+	}
+
+	/**
+	 * C [m, k] = op(A) [m, n] x op(B) [n, k], accumulated into C if `add` is set.
+	 * B is packed per cols_block x inner_block slice and A per rows_block x inner_block
+	 * block, the micro kernel then runs on tiles of C from the packed panels.
+	 */
+	inline void sgemm(const float* A, const float* B, float* C,
+			uint64_t m, uint64_t n, uint64_t k, uint64_t lda, uint64_t ldb, uint64_t ldc,
+			bool add, bool transpose_A, bool transpose_B, simd::isa set = simd::best_isa()) {
+		if (m == 0 || k == 0) return;
+		if (n == 0) {
+			if (!add) for (uint64_t i = 0; i < m; ++i) std::fill_n(C + i*ldc, k, 0.f);
+			return;
+		}
+		if (m == 1 && !transpose_A && !transpose_B) {
+			//a single row is not worth packing
+			sgemv_t(A, B, C, n, k, ldb, add, set);
+			return;
+		}
+		auto micro = micro_for(set);
+		thread_local std::vector<float> packed_a, packed_b;
+		packed_a.resize(rows_block * inner_block);
+		packed_b.resize(cols_block * inner_block);
+		float tile[tile_rows * tile_cols];
+
+		for (uint64_t j0 = 0; j0 < k; j0 += cols_block) {
+			auto cols = std::min(cols_block, k - j0);
+			for (uint64_t l0 = 0; l0 < n; l0 += inner_block) {
+				auto inner = std::min(inner_block, n - l0);
+				//the first slice of the inner dimension overwrites C unless asked to accumulate
+				auto accumulate = add || l0 > 0;
+				pack_b(B, ldb, transpose_B, l0, inner, j0, cols, packed_b.data());
+				for (uint64_t i0 = 0; i0 < m; i0 += rows_block) {
+					auto rows = std::min(rows_block, m - i0);
+					pack_a(A, lda, transpose_A, i0, rows, l0, inner, packed_a.data());
+					for (uint64_t jt = 0; jt < cols; jt += tile_cols) {
+						auto tc = std::min(tile_cols, cols - jt);
+						auto b = packed_b.data() + jt*inner;
+						for (uint64_t it = 0; it < rows; it += tile_rows) {
+							auto tr = std::min(tile_rows, rows - it);
+							auto a = packed_a.data() + it*inner;
+							auto c = C + (i0 + it)*ldc + j0 + jt;
+							if (tr == tile_rows && tc == tile_cols) {
+								micro(a, b, c, ldc, inner, accumulate);
+								continue;
+							}
+							//edge tiles go through a full local tile
+							for (uint64_t r = 0; r < tr; ++r) {
+								if (accumulate) std::copy_n(c + r*ldc, tc, tile + r*tile_cols);
+							}
+							micro(a, b, tile, tile_cols, inner, accumulate);
+							for (uint64_t r = 0; r < tr; ++r) std::copy_n(tile + r*tile_cols, tc, c + r*ldc);
+						}
+					}
+				}
+			}
+		}
+	}
+
+}
@@ -4,140 +4,375 @@
 #define USE_OPENBLAS 1
 #endif
 
+#include <algorithm>
 #include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
+#include <rep/rep_types.h>
+#include <backend/cpu/cpu_parallel.h>
+#include <backend/cpu/cpu_simd.h>
+
 #if USE_OPENBLAS
 #include <cblas.h>
+#else
+#include <backend/cpu/cpu_gemm.h>
 #endif
 
 namespace plearn::backend::cpu {
 
-	inline void _cpu_matmul(float* A, float* B, float* C, 
-			uint64_t m, uint64_t n, uint64_t k, 
-			bool add = false, bool transpose_A = false, bool transpose_B = false) {
+	/*
+	 * Kernels overwrite their output, unless `add` is set, in which case they
+	 * accumulate into it.
+	 */
+
+	/**
+	 * C [m, k] = op(A) [m, n] x op(B) [n, k] with explicit leading dimensions.
+	 */
+	inline void _cpu_gemm(float* A, float* B, float* C,
+			uint64_t m, uint64_t n, uint64_t k, uint64_t lda, uint64_t ldb, uint64_t ldc,
+			bool add, bool transpose_A, bool transpose_B) {
 #if USE_OPENBLAS
 		cblas_sgemm(CblasRowMajor, 
 				transpose_A? CblasTrans : CblasNoTrans,
 				transpose_B? CblasTrans : CblasNoTrans,
 				m, k, n, 
 				1.0f, 
-				A, transpose_A ? m : n, 
-				B, transpose_B ? n : k, 
+				A, lda, 
+				B, ldb, 
 				add ? 1.0f : 0.0f, 
-				C, k);
+				C, ldc);
 #else
-		for (uint64_t i = 0; i < m; ++i) {
-			for (uint64_t l = 0; l < n; ++l) {
-				for (uint64_t j = 0; j < k; ++j) {
-					C[i*k +j] += A[i*n +l] * B[l*k +j];
-				}
-			}
-		}
+		gemm::sgemm(A, B, C, m, n, k, lda, ldb, ldc, add, transpose_A, transpose_B);
 #endif
 	}
 
+	//a multiply-add costs less than an element moved by the memory bound kernels
+	inline constexpr uint64_t gemm_flops_per_element = 16;
+
+	/**
+	 * Large products are split over the rows of C, or its columns if it has few rows.
+	 */
+	inline void _cpu_matmul(float* A, float* B, float* C, 
+			uint64_t m, uint64_t n, uint64_t k, 
+			bool add = false, bool transpose_A = false, bool transpose_B = false) {
+		auto lda = transpose_A ? m : n;
+		auto ldb = transpose_B ? n : k;
+		auto work = m * n * k / gemm_flops_per_element;
+		if (m >= k) {
+			parallel_for(m, work, [=](uint64_t begin, uint64_t end) {
+				_cpu_gemm(transpose_A ? A + begin : A + begin*lda, B, C + begin*k,
+						end - begin, n, k, lda, ldb, k, add, transpose_A, transpose_B);
+			});
+		} else {
+			parallel_for(k, work, [=](uint64_t begin, uint64_t end) {
+				_cpu_gemm(A, transpose_B ? B + begin*ldb : B + begin, C + begin,
+						m, n, end - begin, lda, ldb, k, add, transpose_A, transpose_B);
+			});
+		}
+	}
+
 	
-	inline void _cpu_vecmatmul(float* A, float*B, float* C, uint64_t m, uint64_t n) {
+	/**
+	 * C [n] = A [m] x B [m, n], split over the columns of B.
+	 */
+	inline void _cpu_vecmatmul(float* A, float*B, float* C, uint64_t m, uint64_t n,
+			bool add = false) {
+		parallel_for(n, m*n, [=](uint64_t begin, uint64_t end) {
 	#if USE_OPENBLAS
 			cblas_sgemv(CblasRowMajor, CblasTrans, 
-					m, n, 
-					1.0f, B, n, 
+					m, end - begin, 
+					1.0f, B + begin, n, 
 					A, 1, 
-					0.0f, C, 1);
+					add ? 1.0f : 0.0f, C + begin, 1);
 	#else
-			for (uint64_t i = 0; i < m; ++i) {
-				for (uint64_t j = 0; j < n; ++j) {
-					C[j] += A[i] * B[i*n + j];
-				}
-			}
+			gemm::sgemv_t(A, B + begin, C + begin, m, end - begin, n, add);
 	#endif
+		});
 	}
 	
-	inline void _cpu_matvecmul(float* A, float* B, float* C, uint64_t m, uint64_t n) {
+	/**
+	 * C [m] = A [m, n] x B [n], split over the rows of A.
+	 */
+	inline void _cpu_matvecmul(float* A, float* B, float* C, uint64_t m, uint64_t n,
+			bool add = false) {
+		parallel_for(m, m*n, [=](uint64_t begin, uint64_t end) {
 	#if USE_OPENBLAS
 	        cblas_sgemv(CblasRowMajor, CblasNoTrans, 
-					m, n, 
-					1.0f, A, n, 
+					end - begin, n, 
+					1.0f, A + begin*n, n, 
 					B, 1,
-					0.0f, C, 1);
+					add ? 1.0f : 0.0f, C + begin, 1);
 	#else
-	        for (uint64_t i = 0; i < m; ++i) {
-	            for (uint64_t l = 0; l < n; ++l) {
-	                C[i] += A[i*n +l] * B[l];
-	            }
-	        }
+			gemm::sgemv(A + begin*n, B, C + begin, end - begin, n, n, add);
 	#endif
+		});
 	}
 
-	inline void _cpu_add(float* A, float* B, float* C, uint64_t len) {
-		for (uint64_t i = 0; i < len; i++) {
-			C[i] = A[i] + B[i];
+	inline void _cpu_activate(float* C, uint64_t len, rep::activation act) {
+		switch (act) {
+			case rep::activation::none:
+				break;
+			case rep::activation::relu:
+				for (uint64_t i = 0; i < len; ++i) C[i] = std::max(C[i], 0.f);
+				break;
 		}
 	}
 
+	//rows of a dense op computed at once, so they are still in cache for the epilogue
+	inline constexpr uint64_t dense_block_rows = 32;
+
+	/**
+	 * C = act(X A + b) for X [rows, m], A [m, n] and b [n], b may be null.
+	 * The bias is loaded into C and the GEMM accumulates onto it. Blocks of rows are
+	 * split over the intra-op pool.
+	 */
+	inline void _cpu_dense(float* X, float* A, float* b, float* C,
+			uint64_t rows, uint64_t m, uint64_t n, rep::activation act = rep::activation::none) {
+		auto blocks = (rows + dense_block_rows - 1) / dense_block_rows;
+		parallel_for(blocks, rows*m*n / gemm_flops_per_element, [=](uint64_t begin, uint64_t end) {
+			for (uint64_t r0 = begin*dense_block_rows; r0 < std::min(end*dense_block_rows, rows);
+					r0 += dense_block_rows) {
+				auto block = std::min(dense_block_rows, rows - r0);
+				auto c = C + r0*n;
+				if (b) {
+					for (uint64_t r = 0; r < block; ++r) std::copy_n(b, n, c + r*n);
+				}
+				if (block == 1) _cpu_vecmatmul(X + r0*m, A, c, m, n, b != nullptr);
+				else _cpu_matmul(X + r0*m, A, c, block, m, n, b != nullptr);
+				_cpu_activate(c, block*n, act);
+			}
+		});
+	}
+
+	inline void _cpu_add(float* A, float* B, float* C, uint64_t len) {
+		parallel_for(len, len, [=](uint64_t begin, uint64_t end) {
+			simd::active().add(A + begin, B + begin, C + begin, end - begin);
+		});
+	}
+
 	inline void _cpu_sub(float* A, float* B, float* C, uint64_t len) {
-		for (uint64_t i = 0; i < len; i++) {
-			C[i] = A[i] - B[i];
-		}
+		parallel_for(len, len, [=](uint64_t begin, uint64_t end) {
+			simd::active().sub(A + begin, B + begin, C + begin, end - begin);
+		});
 	}
 
 	inline void _cpu_mult(float* A, float* B, float* C, uint64_t len) {
-		for (uint64_t i = 0; i < len; i++) {
-			C[i] = A[i] * B[i];
-		}
+		parallel_for(len, len, [=](uint64_t begin, uint64_t end) {
+			simd::active().mult(A + begin, B + begin, C + begin, end - begin);
+		});
 	}
 
 	inline void _cpu_square(float* A, float* B, uint64_t len) {
-		for (uint64_t i = 0; i < len; i++) {
-			B[i] = A[i] * A[i];
-		}
+		parallel_for(len, len, [=](uint64_t begin, uint64_t end) {
+			simd::active().square(A + begin, B + begin, end - begin);
+		});
 	}
 
-	inline void _cpu_dot_product(float* A, float* B, float* C, uint64_t len) {
-		for (uint64_t i = 0; i < len; i++) {
-			C[0] += A[i] * B[i];
-		}
+	inline void _cpu_dot_product(float* A, float* B, float* C, uint64_t len, bool add = false) {
+		std::mutex mutex;
+		float sum = 0.f;
+		parallel_for(len, len, [&](uint64_t begin, uint64_t end) {
+			auto part = simd::active().dot(A + begin, B + begin, end - begin);
+			std::lock_guard lock{mutex};
+			sum += part;
+		});
+		C[0] = (add ? C[0] : 0.f) + sum;
 	}
 
-	inline void _cpu_reduce_sum(float* A, float* C, unsigned axis, 
-			const std::vector<uint64_t>& shape) {
-		uint64_t m = 1;
-		uint64_t n = 1;
-		for (unsigned i = 0; i < axis; i++) {
-			m *= shape[i];
+	/**
+	 * Input of a reduction seen as [outer, axis, inner], the middle dimension is reduced.
+	 */
+	struct reduce_dims {
+		uint64_t outer_{1};
+		uint64_t axis_{1};
+		uint64_t inner_{1};
+
+		uint64_t size() const { return outer_ * axis_ * inner_; }
+	};
+
+	/**
+	 * The view of shape reducing the contiguous axes first..last.
+	 */
+	inline reduce_dims reduce_view(const rep::shape_dims& shape, unsigned first, unsigned last) {
+		reduce_dims dims;
+		for (unsigned i = 0; i < shape.size(); i++) {
+			if (i < first) dims.outer_ *= shape[i];
+			else if (i <= last) dims.axis_ *= shape[i];
+			else dims.inner_ *= shape[i];
 		}
-		for (unsigned i = axis + 1; i < shape.size(); i++) {
-			n *= shape[i];
+		return dims;
+	}
+
+	//floats of the output rows summed at once by the leading and middle axis kernels
+	inline constexpr uint64_t reduce_block = 2048;
+
+	//innermost axis: one horizontal sum per output element
+	inline void _cpu_reduce_inner(const float* A, float* C, uint64_t outer, uint64_t axis_len,
+			float scale, bool add) {
+		auto& k = simd::active();
+		for (uint64_t i = 0; i < outer; i++) {
+			auto sum = k.sum(A + i*axis_len, axis_len) * scale;
+			C[i] = add ? C[i] + sum : sum;
 		}
-		auto axis_len = shape[axis];
-		for (uint64_t i = 0; i < m; i++) {
-			for (uint64_t k = 0; k < axis_len; k++) {
-				for (uint64_t j = 0; j < n; j++) {
-					C[i*n + j] += A[i *axis_len*n + k*n + j];
+	}
+
+	//leading axis: rows of A are added to C, a block of C at a time so it stays in cache
+	inline void _cpu_reduce_outer(const float* A, float* C, uint64_t axis_len, uint64_t inner,
+			uint64_t begin, uint64_t end, float scale, bool add) {
+		auto& k = simd::active();
+		for (uint64_t j0 = begin; j0 < end; j0 += reduce_block) {
+			auto len = std::min(reduce_block, end - j0);
+			auto c = C + j0;
+			uint64_t row = 0;
+			if (!add) {
+				if (axis_len == 0) {
+					std::fill_n(c, len, 0.f);
+					continue;
 				}
+				std::copy_n(A + j0, len, c);
+				row = 1;
+			} else if (scale != 1.f) {
+				//the sum is scaled as a whole, so is the accumulated value
+				for (uint64_t j = 0; j < len; j++) c[j] /= scale;
+			}
+			for (; row < axis_len; row++)
+				k.add(c, A + row*inner + j0, c, len);
+			if (scale != 1.f) {
+				for (uint64_t j = 0; j < len; j++) c[j] *= scale;
 			}
 		}
 	}
 
-	inline void _cpu_reduce_mean(float* A, float* C, unsigned axis,
-			const std::vector<uint64_t>& shape) {
-		uint64_t m = 1;
-		uint64_t n = 1;
-		for (unsigned i = 0; i < axis; i++) {
-			m *= shape[i];
+	/**
+	 * Reduce the middle dimension of A, C has shape [outer, inner] and is scaled by `scale`.
+	 * Large inputs are split over the outer dimension, or the inner one if there is a
+	 * single outer row. The split uses `pool` if given, the intra-op pool otherwise.
+	 */
+	inline void _cpu_reduce(const float* A, float* C, reduce_dims dims, float scale = 1.f,
+			bool add = false, borrowed_ptr<env::thread_pool> pool = nullptr) {
+		auto [outer, axis_len, inner] = dims;
+		auto rows = [=](uint64_t begin, uint64_t end) {
+			if (inner == 1) {
+				_cpu_reduce_inner(A + begin*axis_len, C + begin, end - begin, axis_len, scale, add);
+				return;
+			}
+			//middle axis: a leading axis reduction per outer row
+			for (uint64_t i = begin; i < end; i++)
+				_cpu_reduce_outer(A + i*axis_len*inner, C + i*inner, axis_len, inner,
+						0, inner, scale, add);
+		};
+		auto cols = [=](uint64_t begin, uint64_t end) {
+			_cpu_reduce_outer(A, C, axis_len, inner, begin*reduce_block,
+					std::min(end*reduce_block, inner), scale, add);
+		};
+
+		auto blocks = (inner + reduce_block - 1) / reduce_block;
+		bool by_rows = outer > 1 || inner == 1;
+		if (pool) {
+			if (by_rows) parallel_for(*pool, outer, rows);
+			else parallel_for(*pool, blocks, cols);
+			return;
 		}
-		for (unsigned i = axis + 1; i < shape.size(); i++) {
-			n *= shape[i];
+		if (by_rows) parallel_for(outer, dims.size(), rows);
+		else parallel_for(blocks, dims.size(), cols);
+	}
+
+	/**
+	 * Reduce the sorted `axes` of A. Runs of contiguous axes are reduced at once,
+	 * the innermost run first.
+	 */
+	inline void _cpu_reduce(const float* A, float* C, const std::vector<unsigned>& axes,
+			rep::shape_dims shape, float scale, bool add,
+			borrowed_ptr<env::thread_pool> pool = nullptr) {
+		//runs of contiguous axes, innermost first
+		std::vector<std::pair<unsigned, unsigned>> runs;
+		for (auto it = axes.rbegin(); it != axes.rend(); ++it) {
+			if (!runs.empty() && runs.back().first == *it + 1) runs.back().first = *it;
+			else runs.push_back({*it, *it});
 		}
-		auto axis_len = shape[axis];
-		for (uint64_t i = 0; i < m; i++) {
-			for (uint64_t k = 0; k < axis_len; k++) {
-				for (uint64_t j = 0; j < n; j++) {
-					C[i*n + j] += A[i *axis_len*n + k*n + j] / axis_len;
-				}
+		if (runs.empty()) throw std::runtime_error("No axis to reduce");
+
+		std::vector<float> tmp, next;
+		const float* in = A;
+		for (unsigned r = 0; r < runs.size(); r++) {
+			auto [first, last] = runs[r];
+			auto dims = reduce_view(shape, first, last);
+			if (r + 1 == runs.size()) {
+				_cpu_reduce(in, C, dims, scale, add, pool);
+				break;
 			}
+			next.resize(dims.outer_ * dims.inner_);
+			_cpu_reduce(in, next.data(), dims, 1.f, false, pool);
+			std::swap(tmp, next);
+			in = tmp.data();
+			shape.erase(shape.begin() + first, shape.begin() + last + 1);
+			shape.insert(shape.begin() + first, 1);
 		}
 	}
 
+	inline void _cpu_reduce_sum(const float* A, float* C, const std::vector<unsigned>& axes,
+			const rep::shape_dims& shape, bool add = false,
+			borrowed_ptr<env::thread_pool> pool = nullptr) {
+		_cpu_reduce(A, C, axes, shape, 1.f, add, pool);
+	}
+
+	inline void _cpu_reduce_mean(const float* A, float* C, const std::vector<unsigned>& axes,
+			const rep::shape_dims& shape, bool add = false,
+			borrowed_ptr<env::thread_pool> pool = nullptr) {
+		uint64_t count = 1;
+		for (auto axis: axes) count *= shape[axis];
+		_cpu_reduce(A, C, axes, shape, 1.f / count, add, pool);
+	}
+
+	inline void _cpu_reduce_sum(const float* A, float* C, unsigned axis,
+			const rep::shape_dims& shape, bool add = false) {
+		_cpu_reduce(A, C, reduce_view(shape, axis, axis), 1.f, add);
+	}
+
+	inline void _cpu_reduce_mean(const float* A, float* C, unsigned axis,
+			const rep::shape_dims& shape, bool add = false) {
+		_cpu_reduce(A, C, reduce_view(shape, axis, axis), 1.f / shape[axis], add);
+	}
+
+	/**
+	 * Calls fn(offset) for every row of the innermost axis of a strided view, in row
+	 * major order. Offsets are in elements of the viewed memory.
+	 */
+	template <typename Fn>
+	inline void _cpu_strided_rows(const rep::shape_dims& dims, const rep::shape_dims& strides, Fn&& fn) {
+		auto rank = dims.size();
+		uint64_t rows = 1;
+		for (unsigned d = 0; d + 1 < rank; ++d) rows *= dims[d];
+		if (rank == 0 || dims[rank - 1] == 0) return;
+		auto index = dims;
+		std::fill(index.begin(), index.end(), 0);
+		uint64_t offset = 0;
+		for (uint64_t row = 0; row < rows; ++row) {
+			fn(offset);
+			for (auto d = rank - 1; d-- > 0;) {
+				offset += strides[d];
+				if (++index[d] < dims[d]) break;
+				offset -= strides[d] * dims[d];
+				index[d] = 0;
+			}
+		}
+	}
+
+	/**
+	 * Copy the strided view A to the contiguous C.
+	 */
+	inline void _cpu_copy_strided(const float* A, float* C, const rep::shape_dims& dims,
+			const rep::shape_dims& strides) {
+		auto inner = dims.back();
+		auto stride = strides[dims.size() - 1];
+		_cpu_strided_rows(dims, strides, [&](uint64_t offset) {
+			if (stride == 1) std::copy_n(A + offset, inner, C);
+			else for (uint64_t j = 0; j < inner; ++j) C[j] = A[offset + j*stride];
+			C += inner;
+		});
+	}
+
 }
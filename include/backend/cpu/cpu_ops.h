@@ -2,38 +2,63 @@
 
 #include <backend/cpu/cpu_types.h>
 #include <backend/cpu/cpu_op_impl.h>
+#include <backend/cpu/cpu_fused.h>
 
 namespace plearn::backend::cpu {
 
-	inline void cpu_matmul(operation, const vector<cpu_tensor*>& inputs, cpu_tensor* output) {
-		auto mat1 = inputs[0]->get_content()->buf;		
-		auto mat2 = inputs[1]->get_content()->buf;		
-		auto mat_out = output->get_content()->buf;
-		auto shape1 = inputs[0]->shape();
-		auto shape2 = inputs[1]->shape();
-		_cpu_matmul(mat1, mat2, mat_out, shape1.dims[shape1.rank-2], 
-				shape1.dims[shape1.rank-1], shape2.dims[shape2.rank -1]);
+	/**
+	 * Copy of the input, also of a batched one. Nothing to do if the output is the input.
+	 * A shared input is copied to the first sample of a batched output, which
+	 * cpu_replicate_sample repeats over the batch.
+	 */
+	inline void cpu_identity(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output) {
+		auto size = inputs[0]->shape().size();
+		if (output->shape().size() < size) throw std::runtime_error("Shape mismatch");
+		auto in = inputs[0]->get_content()->buf;
+		auto out = output->get_content()->buf;
+		if (in != out) std::copy_n(in, size, out);
+	}
+
+	/**
+	 * Reads the transposed views cpu_reads_strided accepts through the GEMM flags,
+	 * their buffers are laid out as the untransposed matrix.
+	 */
+	inline void cpu_matmul(const operation&, const vector<tensor_p>& inputs, const tensor_p& output) {
+		auto& shape1 = inputs[0]->shape();
+		auto& shape2 = inputs[1]->shape();
+		_cpu_matmul(inputs[0]->data(), inputs[1]->data(), output->data(),
+				shape1.dims[shape1.rank-2], shape1.dims[shape1.rank-1], shape2.dims[shape2.rank-1],
+				false, !inputs[0]->contiguous(), !inputs[1]->contiguous());
 	}
 
-	inline void cpu_vecmatmul(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_vecmatmul(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto vec = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
-		auto shape2 = inputs[1]->shape();
+		auto& shape2 = inputs[1]->shape();
 		_cpu_vecmatmul(vec, mat2, mat_out, shape2.dims[shape2.rank-2], 
 				shape2.dims[shape2.rank-1]);
 	}
 
-	inline void cpu_matvecmul(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_dense(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+		auto vec = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto bias = inputs.size() > 2 ? inputs[2]->get_content()->buf : nullptr;
+		auto mat_out = output->get_content()->buf;
+		auto& shape2 = inputs[1]->shape();
+		_cpu_dense(vec, mat2, bias, mat_out, 1, shape2.dims[0], shape2.dims[1], dense_activation(op));
+	}
+
+	inline void cpu_matvecmul(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
-		auto shape1 = inputs[0]->shape();
+		auto& shape1 = inputs[0]->shape();
 		_cpu_matvecmul(mat1, mat2, mat_out, shape1.dims[shape1.rank-2], 
 				shape1.dims[shape1.rank-1]);
 	}
 
-	inline void cpu_add(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_add(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
@@ -41,7 +66,7 @@ namespace plearn::backend::cpu {
 		_cpu_add(mat1, mat2, mat_out, size);
 	}
 
-	inline void cpu_sub(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_sub(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
@@ -49,14 +74,14 @@ namespace plearn::backend::cpu {
 		_cpu_sub(mat1, mat2, mat_out, size);
 	}
 
-	inline void cpu_square(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_square(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
 		auto size = inputs[0]->shape().size();
 		_cpu_square(mat1, mat_out, size);
 	}
 
-	inline void cpu_mult(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_mult(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
@@ -64,7 +89,7 @@ namespace plearn::backend::cpu {
 		_cpu_mult(mat1, mat2, mat_out, size);
 	}
 
-	inline void cpu_dot_product(operation, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_dot_product(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat2 = inputs[1]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
@@ -72,21 +97,356 @@ namespace plearn::backend::cpu {
 		_cpu_dot_product(mat1, mat2, mat_out, size);
 	}
 	
-	inline void cpu_reduce_sum(operation op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_reduce_sum(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
 		auto& shape = inputs[0]->shape();
-		auto axis = op.iarg0_;
-		_cpu_reduce_sum(mat1, mat_out, axis, shape.dims);
+		_cpu_reduce_sum(mat1, mat_out, reduced_axes(op), shape.dims);
 	}
 
-	inline void cpu_reduce_mean(operation op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+	inline void cpu_reduce_mean(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
 		auto mat1 = inputs[0]->get_content()->buf;		
 		auto mat_out = output->get_content()->buf;
 		auto& shape = inputs[0]->shape();
-		auto axis = op.iarg0_;
-		_cpu_reduce_mean(mat1, mat_out, axis, shape.dims);
+		_cpu_reduce_mean(mat1, mat_out, reduced_axes(op), shape.dims);
 	}
 
-}
+	inline void cpu_fused(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor*& output) {
+		vector<const float*> bufs(inputs.size());
+		std::ranges::transform(inputs, bufs.begin(), [](auto in) { return in->get_content()->buf; });
+		_cpu_fused(*op.block_, bufs, output->get_content()->buf, inputs[0]->shape().dims);
+	}
+
+	/**
+	 * Bind a single sample op to the buffers of its arguments, see bound_kernel.
+	 * Ops without a fixed kernel, like reductions over axes that are not contiguous,
+	 * are left to cpu_backend::exec_op.
+	 */
+	inline bound_kernel cpu_bind_op(const operation& op, const vector<tensor_p>& inputs,
+			const tensor_p& output) {
+		bound_kernel k;
+		if (inputs.empty() || inputs.size() > bound_kernel::max_args) return k;
+		for (auto& in: inputs) k.in_[k.args_++] = in->data();
+		k.out_ = output->data();
+		k.op_ = &op;
+		auto& shape1 = inputs[0]->shape();
+		auto size = shape1.size();
+
+		switch (op.type_) {
+			case op_type::noop:
+			case op_type::identity:
+			case op_type::reshape:
+			case op_type::transpose:
+			case op_type::slice:
+			case op_type::broadcast:
+				return {};
+			case op_type::matmul: {
+				auto& shape2 = inputs[1]->shape();
+				k.dims_[0] = shape1.dims[shape1.rank-2];
+				k.dims_[1] = shape1.dims[shape1.rank-1];
+				k.dims_[2] = shape2.dims[shape2.rank-1];
+				//transposed views, see cpu_reads_strided
+				k.flags_ = (inputs[0]->contiguous() ? 0 : 1) | (inputs[1]->contiguous() ? 0 : 2);
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_matmul(k.in_[0], k.in_[1], k.out_, k.dims_[0], k.dims_[1], k.dims_[2],
+							false, k.flags_ & 1, k.flags_ & 2);
+				};
+				break;
+			}
+			case op_type::vecmatmul: {
+				auto& shape2 = inputs[1]->shape();
+				k.dims_[0] = shape2.dims[shape2.rank-2];
+				k.dims_[1] = shape2.dims[shape2.rank-1];
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_vecmatmul(k.in_[0], k.in_[1], k.out_, k.dims_[0], k.dims_[1]);
+				};
+				break;
+			}
+			case op_type::matvecmul:
+				k.dims_[0] = shape1.dims[shape1.rank-2];
+				k.dims_[1] = shape1.dims[shape1.rank-1];
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_matvecmul(k.in_[0], k.in_[1], k.out_, k.dims_[0], k.dims_[1]);
+				};
+				break;
+			case op_type::dense: {
+				auto& shape2 = inputs[1]->shape();
+				k.dims_[0] = shape2.dims[0];
+				k.dims_[1] = shape2.dims[1];
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_dense(k.in_[0], k.in_[1], k.args_ > 2 ? k.in_[2] : nullptr, k.out_,
+							1, k.dims_[0], k.dims_[1], dense_activation(*k.op_));
+				};
+				break;
+			}
+			case op_type::add:
+				k.dims_[0] = size;
+				k.fn_ = [](const bound_kernel& k) { _cpu_add(k.in_[0], k.in_[1], k.out_, k.dims_[0]); };
+				break;
+			case op_type::sub:
+				k.dims_[0] = size;
+				k.fn_ = [](const bound_kernel& k) { _cpu_sub(k.in_[0], k.in_[1], k.out_, k.dims_[0]); };
+				break;
+			case op_type::mult:
+				k.dims_[0] = size;
+				k.fn_ = [](const bound_kernel& k) { _cpu_mult(k.in_[0], k.in_[1], k.out_, k.dims_[0]); };
+				break;
+			case op_type::square:
+				k.dims_[0] = size;
+				k.fn_ = [](const bound_kernel& k) { _cpu_square(k.in_[0], k.out_, k.dims_[0]); };
+				break;
+			case op_type::dot_product:
+				k.dims_[0] = size;
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_dot_product(k.in_[0], k.in_[1], k.out_, k.dims_[0]);
+				};
+				break;
+			case op_type::reduce_sum:
+			case op_type::reduce_mean: {
+				auto axes = reduced_axes(op);
+				if (axes.back() - axes.front() + 1 != axes.size()) return {};
+				auto dims = reduce_view(shape1.dims, axes.front(), axes.back());
+				k.dims_[0] = dims.outer_;
+				k.dims_[1] = dims.axis_;
+				k.dims_[2] = dims.inner_;
+				if (op.type_ == op_type::reduce_mean) k.scale_ = 1.f / dims.axis_;
+				k.fn_ = [](const bound_kernel& k) {
+					_cpu_reduce(k.in_[0], k.out_, {k.dims_[0], k.dims_[1], k.dims_[2]}, k.scale_);
+				};
+				break;
+			}
+			case op_type::fused: {
+				auto dims = fused_view(*op.block_, shape1.dims);
+				k.dims_[0] = dims.outer_;
+				k.dims_[1] = dims.axis_;
+				k.dims_[2] = dims.inner_;
+				k.scale_ = fused_scale(*op.block_, dims);
+				k.fn_ = [](const bound_kernel& k) {
+					std::span<const float* const> bufs{static_cast<const float* const*>(k.in_), k.args_};
+					_cpu_fused(*k.op_->block_, bufs, k.out_, {k.dims_[0], k.dims_[1], k.dims_[2]}, k.scale_);
+				};
+				break;
+			}
+		}
+		return k;
+	}
+
+
+	/**
+	 * Matmul reads the transposed view of a contiguous matrix through the transpose
+	 * flags of the GEMM.
+	 */
+	inline bool cpu_reads_strided(const operation& op, unsigned idx, const tensor_p& input) {
+		auto& shape = input->shape();
+		auto& strides = input->strides();
+		return op.type_ == op_type::matmul && idx < 2 && shape.rank == 2 &&
+			strides[0] == 1 && strides[1] == shape.dims[0];
+	}
+
+	inline void cpu_materialize(const tensor_p& view, const tensor_p& dst) {
+		_cpu_copy_strided(view->data(), dst->data(), view->shape().dims, view->strides());
+	}
+
+	/**
+	 * Batch layout of an op: the output and the inputs flagged in `batched`
+	 * have a leading dimension of `size`, other inputs are shared by the batch.
+	 */
+	struct cpu_batch {
+		uint64_t size;
+		const vector<bool>& batched;
+
+		//floats between consecutive samples of an input, 0 if shared by the batch
+		uint64_t stride(const vector<cpu_tensor*>& inputs, unsigned idx) const {
+			return batched[idx] ? inputs[idx]->shape().size() / size : 0;
+		}
+	};
+
+	/**
+	 * Copy the first sample of a batched tensor to the rest of the batch.
+	 */
+	inline void cpu_replicate_sample(cpu_tensor* tens, uint64_t batch_size) {
+		auto buf = tens->get_content()->buf;
+		auto len = tens->shape().size() / batch_size;
+		for (uint64_t b = 1; b < batch_size; ++b)
+			std::copy_n(buf, len, buf + b*len);
+	}
+
+	inline void cpu_batch_matmul(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		auto& shape1 = inputs[0]->shape();
+		auto& shape2 = inputs[1]->shape();
+		auto M = shape1.dims[shape1.rank-2];
+		auto N = shape1.dims[shape1.rank-1];
+		auto K = shape2.dims[shape2.rank-1];
+		if (batch.batched[0] && !batch.batched[1]) {
+			//samples are stacked as rows of a single GEMM
+			_cpu_matmul(mat1, mat2, mat_out, batch.size * M, N, K);
+			return;
+		}
+		auto stride1 = batch.stride(inputs, 0);
+		auto stride2 = batch.stride(inputs, 1);
+		for (uint64_t b = 0; b < batch.size; ++b)
+			_cpu_matmul(mat1 + b*stride1, mat2 + b*stride2, mat_out + b*M*K, M, N, K);
+	}
+
+	inline void cpu_batch_vecmatmul(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto vec = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		auto& shape2 = inputs[1]->shape();
+		auto M = shape2.dims[shape2.rank-2];
+		auto N = shape2.dims[shape2.rank-1];
+		if (batch.batched[0] && !batch.batched[1]) {
+			//[B,M] x [M,N] as one GEMM instead of B GEMVs
+			_cpu_matmul(vec, mat2, mat_out, batch.size, M, N);
+			return;
+		}
+		auto stride1 = batch.stride(inputs, 0);
+		auto stride2 = batch.stride(inputs, 1);
+		for (uint64_t b = 0; b < batch.size; ++b)
+			_cpu_vecmatmul(vec + b*stride1, mat2 + b*stride2, mat_out + b*N, M, N);
+	}
+
+	inline void cpu_batch_dense(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto vec = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto bias = inputs.size() > 2 ? inputs[2]->get_content()->buf : nullptr;
+		auto mat_out = output->get_content()->buf;
+		auto& shape2 = inputs[1]->shape();
+		auto M = shape2.dims[shape2.rank-2];
+		auto N = shape2.dims[shape2.rank-1];
+		auto act = dense_activation(op);
+		if (std::ranges::none_of(batch.batched.begin() + 1, batch.batched.end(), [](bool b) { return b; })) {
+			//the samples are the rows of one GEMM
+			_cpu_dense(vec, mat2, bias, mat_out, batch.size, M, N, act);
+			return;
+		}
+		auto stride1 = batch.stride(inputs, 0);
+		auto stride2 = batch.stride(inputs, 1);
+		auto stride3 = bias ? batch.stride(inputs, 2) : 0;
+		for (uint64_t b = 0; b < batch.size; ++b)
+			_cpu_dense(vec + b*stride1, mat2 + b*stride2, bias ? bias + b*stride3 : nullptr,
+					mat_out + b*N, 1, M, N, act);
+	}
+
+	inline void cpu_batch_matvecmul(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto vec = inputs[1]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		auto& shape1 = inputs[0]->shape();
+		auto M = shape1.dims[shape1.rank-2];
+		auto N = shape1.dims[shape1.rank-1];
+		if (!batch.batched[0] && batch.batched[1]) {
+			//[B,N] x [M,N]^T as one GEMM
+			_cpu_matmul(vec, mat1, mat_out, batch.size, N, M, false, false, true);
+			return;
+		}
+		auto stride1 = batch.stride(inputs, 0);
+		auto stride2 = batch.stride(inputs, 1);
+		for (uint64_t b = 0; b < batch.size; ++b)
+			_cpu_matvecmul(mat1 + b*stride1, vec + b*stride2, mat_out + b*M, M, N);
+	}
+
+	inline void cpu_batch_dot_product(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		auto len = batch.batched[0] ? inputs[1]->shape().size() : inputs[0]->shape().size();
+		if (batch.batched[0] != batch.batched[1]) {
+			//a batch of vectors against a shared one is a GEMV
+			auto batched_buf = batch.batched[0] ? mat1 : mat2;
+			auto shared_buf = batch.batched[0] ? mat2 : mat1;
+			_cpu_matvecmul(batched_buf, shared_buf, mat_out, batch.size, len);
+			return;
+		}
+		len = inputs[0]->shape().size() / batch.size;
+		for (uint64_t b = 0; b < batch.size; ++b)
+			_cpu_dot_product(mat1 + b*len, mat2 + b*len, mat_out + b, len);
+	}
 
+	/**
+	 * Elementwise binary ops, inputs shared by the batch are broadcast over it.
+	 */
+	template <typename Kernel>
+	inline void cpu_batch_elementwise(const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch, Kernel&& kernel) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat2 = inputs[1]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		if (batch.batched[0] && batch.batched[1]) {
+			kernel(mat1, mat2, mat_out, output->shape().size());
+			return;
+		}
+		auto len = output->shape().size() / batch.size;
+		auto stride1 = batch.stride(inputs, 0);
+		auto stride2 = batch.stride(inputs, 1);
+		for (uint64_t b = 0; b < batch.size; ++b)
+			kernel(mat1 + b*stride1, mat2 + b*stride2, mat_out + b*len, len);
+	}
+
+	inline void cpu_batch_add(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		cpu_batch_elementwise(inputs, output, batch, _cpu_add);
+	}
+
+	inline void cpu_batch_sub(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		cpu_batch_elementwise(inputs, output, batch, _cpu_sub);
+	}
+
+	inline void cpu_batch_mult(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		cpu_batch_elementwise(inputs, output, batch, _cpu_mult);
+	}
+
+	inline void cpu_batch_square(const operation&, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch&) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		_cpu_square(mat1, mat_out, output->shape().size());
+	}
+
+	//the batch is the leading axis of the input, so the reduced axes shift by one
+	inline vector<unsigned> batch_reduced_axes(const operation& op) {
+		auto axes = reduced_axes(op);
+		for (auto& axis: axes) axis++;
+		return axes;
+	}
+
+	inline void cpu_batch_reduce_sum(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch&) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		_cpu_reduce_sum(mat1, mat_out, batch_reduced_axes(op), inputs[0]->shape().dims);
+	}
+
+	inline void cpu_batch_reduce_mean(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch&) {
+		auto mat1 = inputs[0]->get_content()->buf;		
+		auto mat_out = output->get_content()->buf;
+		_cpu_reduce_mean(mat1, mat_out, batch_reduced_axes(op), inputs[0]->shape().dims);
+	}
+
+	//one sample at a time, the reduction axes refer to the shape of a sample
+	inline void cpu_batch_fused(const operation& op, const vector<cpu_tensor*>& inputs, cpu_tensor* output,
+			const cpu_batch& batch) {
+		auto dims = inputs[0]->shape().dims;
+		if (batch.batched[0]) dims.erase(dims.begin());
+		auto mat_out = output->get_content()->buf;
+		auto len = output->shape().size() / batch.size;
+		vector<const float*> bufs(inputs.size());
+		for (uint64_t b = 0; b < batch.size; ++b) {
+			for (unsigned idx = 0; idx < inputs.size(); ++idx)
+				bufs[idx] = inputs[idx]->get_content()->buf + b*batch.stride(inputs, idx);
+			_cpu_fused(*op.block_, bufs, mat_out + b*len, dims);
+		}
+	}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <environ/env_types.h>
+#include <backend/cpu/cpu_types.h>
+#include <backend/cpu/cpu_parallel.h>
+#include <backend/cpu/cpu_simd.h>
+
+/*
+ * Optimizer updates. Every parameter is updated in one pass reading its gradient and
+ * moments and writing the parameter and the moments back, split over the intra-op pool.
+ */
+namespace plearn::backend::cpu {
+
+	inline void _cpu_sgd_update(float* P, const float* G, float* V, uint64_t len,
+			const simd::sgd_coeffs& coeffs) {
+		parallel_for(len, len, [=, &coeffs](uint64_t begin, uint64_t end) {
+			simd::active().sgd(P + begin, G + begin, V ? V + begin : nullptr, end - begin, coeffs);
+		});
+	}
+
+	inline void _cpu_adam_update(float* P, const float* G, float* M, float* V, uint64_t len,
+			const simd::adam_coeffs& coeffs) {
+		parallel_for(len, len, [=, &coeffs](uint64_t begin, uint64_t end) {
+			simd::active().adam(P + begin, G + begin, M + begin, V + begin, end - begin, coeffs);
+		});
+	}
+
+	class cpu_param_update : public param_update_backend_t {
+		public:
+		cpu_param_update(const optimizer_params& params) : params(params) {}
+
+		void update(const tensor_p& param, gradient& grad,
+				const vector<tensor_p>& state, uint64_t step) override {
+			auto len = param->shape().size();
+			if (!param->contiguous()) throw std::runtime_error("Parameter is not contiguous");
+			if (grad.in_shape.size() * grad.cols() * grad.batch_size != len)
+				throw std::runtime_error("Gradient is not of a scalar loss");
+			auto P = param->data();
+			auto G = grad.data();
+			auto buf = [&](unsigned idx) { return state.at(idx)->data(); };
+
+			if (params.type_ == optimizer_type::sgd) {
+				simd::sgd_coeffs coeffs{params.lr_, params.momentum_, params.weight_decay_};
+				_cpu_sgd_update(P, G, state.empty() ? nullptr : buf(0), len, coeffs);
+				return;
+			}
+			bool decoupled = params.type_ == optimizer_type::adamw;
+			simd::adam_coeffs coeffs{
+				params.lr_, params.beta1_, params.beta2_, params.eps_,
+				decoupled ? 0.f : params.weight_decay_,
+				decoupled ? params.weight_decay_ : 0.f,
+				1.f / (1.f - std::pow(params.beta1_, float(step))),
+				1.f / (1.f - std::pow(params.beta2_, float(step)))};
+			_cpu_adam_update(P, G, buf(0), buf(1), len, coeffs);
+		}
+
+		private:
+		optimizer_params params;
+	};
+
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <rep/rep_types.h>
+#include <environ/thread_pool.h>
+
+namespace plearn::backend::cpu {
+
+	using rep::borrowed_ptr;
+
+	using rep::read_ptr;
+
+	/**
+	 * Where the kernels split their work, held by the cpu_backend owning the pool.
+	 * Kernels touching fewer than threshold_ elements run on the calling thread.
+	 */
+	struct intra_op_settings {
+		borrowed_ptr<env::thread_pool> pool_{nullptr};
+		uint64_t threshold_{1 << 18};
+	};
+
+	inline read_ptr<intra_op_settings>& current_intra_op() {
+		static const intra_op_settings serial{};
+		thread_local read_ptr<intra_op_settings> current = &serial;
+		return current;
+	}
+
+	/**
+	 * The settings of the backend running a kernel on this thread, kernels called
+	 * outside of a backend run on the calling thread.
+	 */
+	inline const intra_op_settings& intra_op() { return *current_intra_op(); }
+
+	/**
+	 * Makes the settings of a backend the ones of this thread while it runs its kernels.
+	 * Scopes nest, every backend keeps its own pool however many are alive.
+	 */
+	class intra_op_scope {
+		public:
+			explicit intra_op_scope(const intra_op_settings& settings) :
+				previous_(current_intra_op()) {
+				current_intra_op() = &settings;
+			}
+
+			~intra_op_scope() { current_intra_op() = previous_; }
+
+			intra_op_scope(const intra_op_scope&) = delete;
+			intra_op_scope& operator=(const intra_op_scope&) = delete;
+
+		private:
+			read_ptr<intra_op_settings> previous_;
+	};
+
+	/**
+	 * Split [0, n) into one contiguous range per thread and run fn(begin, end) on them.
+	 * The calling thread runs the first range, then helps with the queued tasks of the pool
+	 * until the other ranges are done, so nested calls from workers cannot deadlock.
+	 * Calls from a worker of another pool, fx. an inter-op executor, run inline, since
+	 * that pool already occupies the cores.
+	 * The ranges run with the intra-op settings of the caller.
+	 */
+	template<typename Fn>
+	void parallel_for(env::thread_pool& pool, uint64_t n, Fn&& fn) {
+		uint64_t parts = std::min<uint64_t>(n, pool.size() + 1);
+		if (parts <= 1 || (env::thread_pool::on_worker_thread() && !pool.in_worker())) {
+			fn(uint64_t{0}, n);
+			return;
+		}
+
+		std::atomic<uint64_t> remaining{parts - 1};
+		std::mutex mutex;
+		std::exception_ptr error;
+		auto record = [&](std::exception_ptr e) {
+			std::lock_guard lock{mutex};
+			if (!error) error = e;
+		};
+
+		auto range = [n, parts](uint64_t part) { return part * n / parts; };
+		auto& settings = intra_op();
+		for (uint64_t part = 1; part < parts; ++part) {
+			pool.submit([&, part] {
+				intra_op_scope scope{settings};
+				try {
+					fn(range(part), range(part + 1));
+				} catch (...) {
+					record(std::current_exception());
+				}
+				remaining.fetch_sub(1, std::memory_order_acq_rel);
+			});
+		}
+		try {
+			fn(range(0), range(1));
+		} catch (...) {
+			record(std::current_exception());
+		}
+
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			if (!pool.run_one()) std::this_thread::yield();
+		}
+		if (error) std::rethrow_exception(error);
+	}
+
+	/**
+	 * parallel_for on the intra-op pool if `work` reaches its threshold, inline otherwise.
+	 */
+	template<typename Fn>
+	void parallel_for(uint64_t n, uint64_t work, Fn&& fn) {
+		auto& settings = intra_op();
+		if (!settings.pool_ || work < settings.threshold_) {
+			fn(uint64_t{0}, n);
+			return;
+		}
+		parallel_for(*settings.pool_, n, fn);
+	}
+
+}
@@ -0,0 +1,420 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace plearn::backend::cpu::simd {
+
+	/**
+	 * Instruction sets the elementwise kernels are implemented for.
+	 */
+	enum class isa {
+		scalar,
+		avx2,
+		avx512,
+	};
+
+	inline bool supported(isa set) {
+		switch (set) {
+			case isa::scalar:
+				return true;
+			case isa::avx2:
+				return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+			case isa::avx512:
+				return __builtin_cpu_supports("avx512f");
+		}
+		return false;
+	}
+
+	inline isa best_isa() {
+		if (supported(isa::avx512)) return isa::avx512;
+		if (supported(isa::avx2)) return isa::avx2;
+		return isa::scalar;
+	}
+
+
+	//scalar reference
+
+	inline void add_scalar(const float* A, const float* B, float* C, uint64_t len) {
+		for (uint64_t i = 0; i < len; i++) C[i] = A[i] + B[i];
+	}
+
+	inline void sub_scalar(const float* A, const float* B, float* C, uint64_t len) {
+		for (uint64_t i = 0; i < len; i++) C[i] = A[i] - B[i];
+	}
+
+	inline void mult_scalar(const float* A, const float* B, float* C, uint64_t len) {
+		for (uint64_t i = 0; i < len; i++) C[i] = A[i] * B[i];
+	}
+
+	inline void square_scalar(const float* A, float* B, uint64_t len) {
+		for (uint64_t i = 0; i < len; i++) B[i] = A[i] * A[i];
+	}
+
+	inline float dot_scalar(const float* A, const float* B, uint64_t len) {
+		//independent accumulators, so the additions do not wait on each other
+		float acc[4]{};
+		uint64_t i = 0;
+		for (; i + 4 <= len; i += 4) {
+			acc[0] += A[i] * B[i];
+			acc[1] += A[i+1] * B[i+1];
+			acc[2] += A[i+2] * B[i+2];
+			acc[3] += A[i+3] * B[i+3];
+		}
+		for (; i < len; i++) acc[0] += A[i] * B[i];
+		return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+	}
+
+	inline float sum_scalar(const float* A, uint64_t len) {
+		float acc[4]{};
+		uint64_t i = 0;
+		for (; i + 4 <= len; i += 4) {
+			acc[0] += A[i];
+			acc[1] += A[i+1];
+			acc[2] += A[i+2];
+			acc[3] += A[i+3];
+		}
+		for (; i < len; i++) acc[0] += A[i];
+		return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+	}
+
+	/**
+	 * Coefficients of an SGD update, with momentum if V is set:
+	 * g += decay*P, V = momentum*V + g, P -= lr*V.
+	 */
+	struct sgd_coeffs {
+		float lr_;
+		float momentum_;
+		float decay_;
+	};
+
+	/**
+	 * Coefficients of an Adam update with bias corrections c1 = 1/(1 - beta1^t) and
+	 * c2 = 1/(1 - beta2^t): g += decay*P, M = beta1*M + (1-beta1)*g, V = beta2*V + (1-beta2)*g*g,
+	 * P -= lr*(c1*M / (sqrt(c2*V) + eps) + decoupled_decay*P).
+	 */
+	struct adam_coeffs {
+		float lr_;
+		float beta1_;
+		float beta2_;
+		float eps_;
+		float decay_;
+		float decoupled_decay_;
+		float c1_;
+		float c2_;
+	};
+
+	inline void sgd_scalar(float* P, const float* G, float* V, uint64_t len, const sgd_coeffs& k) {
+		for (uint64_t i = 0; i < len; i++) {
+			auto g = G[i] + k.decay_ * P[i];
+			if (V) g = V[i] = k.momentum_ * V[i] + g;
+			P[i] -= k.lr_ * g;
+		}
+	}
+
+	inline void adam_scalar(float* P, const float* G, float* M, float* V, uint64_t len,
+			const adam_coeffs& k) {
+		for (uint64_t i = 0; i < len; i++) {
+			auto g = G[i] + k.decay_ * P[i];
+			M[i] = k.beta1_ * M[i] + (1 - k.beta1_) * g;
+			V[i] = k.beta2_ * V[i] + (1 - k.beta2_) * g * g;
+			P[i] -= k.lr_ * (k.c1_ * M[i] / (std::sqrt(k.c2_ * V[i]) + k.eps_) + k.decoupled_decay_ * P[i]);
+		}
+	}
+
+
+	//AVX2, 8 floats per vector. Loads are unaligned since views start at any offset.
+
+	__attribute__((target("avx2,fma")))
+	inline float hsum_avx2(__m256 acc) {
+		auto sum4 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+		auto sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+		auto sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+		return _mm_cvtss_f32(sum1);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void add_avx2(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8)
+			_mm256_storeu_ps(C + i, _mm256_add_ps(_mm256_loadu_ps(A + i), _mm256_loadu_ps(B + i)));
+		add_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void sub_avx2(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8)
+			_mm256_storeu_ps(C + i, _mm256_sub_ps(_mm256_loadu_ps(A + i), _mm256_loadu_ps(B + i)));
+		sub_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void mult_avx2(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8)
+			_mm256_storeu_ps(C + i, _mm256_mul_ps(_mm256_loadu_ps(A + i), _mm256_loadu_ps(B + i)));
+		mult_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void square_avx2(const float* A, float* B, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8) {
+			auto a = _mm256_loadu_ps(A + i);
+			_mm256_storeu_ps(B + i, _mm256_mul_ps(a, a));
+		}
+		square_scalar(A + i, B + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline float dot_avx2(const float* A, const float* B, uint64_t len) {
+		auto acc0 = _mm256_setzero_ps();
+		auto acc1 = _mm256_setzero_ps();
+		auto acc2 = _mm256_setzero_ps();
+		auto acc3 = _mm256_setzero_ps();
+		uint64_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(A + i), _mm256_loadu_ps(B + i), acc0);
+			acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(A + i + 8), _mm256_loadu_ps(B + i + 8), acc1);
+			acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(A + i + 16), _mm256_loadu_ps(B + i + 16), acc2);
+			acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(A + i + 24), _mm256_loadu_ps(B + i + 24), acc3);
+		}
+		for (; i + 8 <= len; i += 8)
+			acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(A + i), _mm256_loadu_ps(B + i), acc0);
+		auto acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+		return hsum_avx2(acc) + dot_scalar(A + i, B + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline float sum_avx2(const float* A, uint64_t len) {
+		auto acc0 = _mm256_setzero_ps();
+		auto acc1 = _mm256_setzero_ps();
+		auto acc2 = _mm256_setzero_ps();
+		auto acc3 = _mm256_setzero_ps();
+		uint64_t i = 0;
+		for (; i + 32 <= len; i += 32) {
+			acc0 = _mm256_add_ps(_mm256_loadu_ps(A + i), acc0);
+			acc1 = _mm256_add_ps(_mm256_loadu_ps(A + i + 8), acc1);
+			acc2 = _mm256_add_ps(_mm256_loadu_ps(A + i + 16), acc2);
+			acc3 = _mm256_add_ps(_mm256_loadu_ps(A + i + 24), acc3);
+		}
+		for (; i + 8 <= len; i += 8)
+			acc0 = _mm256_add_ps(_mm256_loadu_ps(A + i), acc0);
+		auto acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+		return hsum_avx2(acc) + sum_scalar(A + i, len - i);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void sgd_avx2(float* P, const float* G, float* V, uint64_t len, const sgd_coeffs& k) {
+		auto lr = _mm256_set1_ps(k.lr_), momentum = _mm256_set1_ps(k.momentum_);
+		auto decay = _mm256_set1_ps(k.decay_);
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8) {
+			auto p = _mm256_loadu_ps(P + i);
+			auto g = _mm256_fmadd_ps(decay, p, _mm256_loadu_ps(G + i));
+			if (V) {
+				g = _mm256_fmadd_ps(momentum, _mm256_loadu_ps(V + i), g);
+				_mm256_storeu_ps(V + i, g);
+			}
+			_mm256_storeu_ps(P + i, _mm256_fnmadd_ps(lr, g, p));
+		}
+		sgd_scalar(P + i, G + i, V ? V + i : nullptr, len - i, k);
+	}
+
+	__attribute__((target("avx2,fma")))
+	inline void adam_avx2(float* P, const float* G, float* M, float* V, uint64_t len,
+			const adam_coeffs& k) {
+		auto beta1 = _mm256_set1_ps(k.beta1_), beta2 = _mm256_set1_ps(k.beta2_);
+		auto rest1 = _mm256_set1_ps(1 - k.beta1_), rest2 = _mm256_set1_ps(1 - k.beta2_);
+		auto lr = _mm256_set1_ps(k.lr_), eps = _mm256_set1_ps(k.eps_);
+		auto decay = _mm256_set1_ps(k.decay_), decoupled = _mm256_set1_ps(k.decoupled_decay_);
+		auto c1 = _mm256_set1_ps(k.c1_), c2 = _mm256_set1_ps(k.c2_);
+		uint64_t i = 0;
+		for (; i + 8 <= len; i += 8) {
+			auto p = _mm256_loadu_ps(P + i);
+			auto g = _mm256_fmadd_ps(decay, p, _mm256_loadu_ps(G + i));
+			auto m = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(M + i), _mm256_mul_ps(rest1, g));
+			auto v = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(V + i), _mm256_mul_ps(rest2, _mm256_mul_ps(g, g)));
+			_mm256_storeu_ps(M + i, m);
+			_mm256_storeu_ps(V + i, v);
+			auto denom = _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(c2, v)), eps);
+			auto step = _mm256_fmadd_ps(decoupled, p, _mm256_div_ps(_mm256_mul_ps(c1, m), denom));
+			_mm256_storeu_ps(P + i, _mm256_fnmadd_ps(lr, step, p));
+		}
+		adam_scalar(P + i, G + i, M + i, V + i, len - i, k);
+	}
+
+
+	//AVX-512, 16 floats per vector
+
+	/**
+	 * Sum of the lanes. The halves are taken by zero masked extracts: the unmasked ones,
+	 * and _mm512_reduce_add_ps built on them, pass an undefined vector through, which
+	 * GCC 12 reports as uninitialized.
+	 */
+	__attribute__((target("avx512f")))
+	inline float hsum_avx512(__m512 acc) {
+		auto halves = _mm512_castps_pd(acc);
+		auto sum8 = _mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, halves, 0)),
+				_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, halves, 1)));
+		auto sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+		auto sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+		auto sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 1));
+		return _mm_cvtss_f32(sum1);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void add_avx512(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16)
+			_mm512_storeu_ps(C + i, _mm512_add_ps(_mm512_loadu_ps(A + i), _mm512_loadu_ps(B + i)));
+		add_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void sub_avx512(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16)
+			_mm512_storeu_ps(C + i, _mm512_sub_ps(_mm512_loadu_ps(A + i), _mm512_loadu_ps(B + i)));
+		sub_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void mult_avx512(const float* A, const float* B, float* C, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16)
+			_mm512_storeu_ps(C + i, _mm512_mul_ps(_mm512_loadu_ps(A + i), _mm512_loadu_ps(B + i)));
+		mult_scalar(A + i, B + i, C + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void square_avx512(const float* A, float* B, uint64_t len) {
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			auto a = _mm512_loadu_ps(A + i);
+			_mm512_storeu_ps(B + i, _mm512_mul_ps(a, a));
+		}
+		square_scalar(A + i, B + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline float dot_avx512(const float* A, const float* B, uint64_t len) {
+		auto acc0 = _mm512_setzero_ps();
+		auto acc1 = _mm512_setzero_ps();
+		auto acc2 = _mm512_setzero_ps();
+		auto acc3 = _mm512_setzero_ps();
+		uint64_t i = 0;
+		for (; i + 64 <= len; i += 64) {
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(A + i), _mm512_loadu_ps(B + i), acc0);
+			acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(A + i + 16), _mm512_loadu_ps(B + i + 16), acc1);
+			acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(A + i + 32), _mm512_loadu_ps(B + i + 32), acc2);
+			acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(A + i + 48), _mm512_loadu_ps(B + i + 48), acc3);
+		}
+		for (; i + 16 <= len; i += 16)
+			acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(A + i), _mm512_loadu_ps(B + i), acc0);
+		auto acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+		return hsum_avx512(acc) + dot_scalar(A + i, B + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline float sum_avx512(const float* A, uint64_t len) {
+		auto acc0 = _mm512_setzero_ps();
+		auto acc1 = _mm512_setzero_ps();
+		auto acc2 = _mm512_setzero_ps();
+		auto acc3 = _mm512_setzero_ps();
+		uint64_t i = 0;
+		for (; i + 64 <= len; i += 64) {
+			acc0 = _mm512_add_ps(_mm512_loadu_ps(A + i), acc0);
+			acc1 = _mm512_add_ps(_mm512_loadu_ps(A + i + 16), acc1);
+			acc2 = _mm512_add_ps(_mm512_loadu_ps(A + i + 32), acc2);
+			acc3 = _mm512_add_ps(_mm512_loadu_ps(A + i + 48), acc3);
+		}
+		for (; i + 16 <= len; i += 16)
+			acc0 = _mm512_add_ps(_mm512_loadu_ps(A + i), acc0);
+		auto acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+		return hsum_avx512(acc) + sum_scalar(A + i, len - i);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void sgd_avx512(float* P, const float* G, float* V, uint64_t len, const sgd_coeffs& k) {
+		auto lr = _mm512_set1_ps(k.lr_), momentum = _mm512_set1_ps(k.momentum_);
+		auto decay = _mm512_set1_ps(k.decay_);
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			auto p = _mm512_loadu_ps(P + i);
+			auto g = _mm512_fmadd_ps(decay, p, _mm512_loadu_ps(G + i));
+			if (V) {
+				g = _mm512_fmadd_ps(momentum, _mm512_loadu_ps(V + i), g);
+				_mm512_storeu_ps(V + i, g);
+			}
+			_mm512_storeu_ps(P + i, _mm512_fnmadd_ps(lr, g, p));
+		}
+		sgd_scalar(P + i, G + i, V ? V + i : nullptr, len - i, k);
+	}
+
+	__attribute__((target("avx512f")))
+	inline void adam_avx512(float* P, const float* G, float* M, float* V, uint64_t len,
+			const adam_coeffs& k) {
+		auto beta1 = _mm512_set1_ps(k.beta1_), beta2 = _mm512_set1_ps(k.beta2_);
+		auto rest1 = _mm512_set1_ps(1 - k.beta1_), rest2 = _mm512_set1_ps(1 - k.beta2_);
+		auto lr = _mm512_set1_ps(k.lr_), eps = _mm512_set1_ps(k.eps_);
+		auto decay = _mm512_set1_ps(k.decay_), decoupled = _mm512_set1_ps(k.decoupled_decay_);
+		auto c1 = _mm512_set1_ps(k.c1_), c2 = _mm512_set1_ps(k.c2_);
+		uint64_t i = 0;
+		for (; i + 16 <= len; i += 16) {
+			auto p = _mm512_loadu_ps(P + i);
+			auto g = _mm512_fmadd_ps(decay, p, _mm512_loadu_ps(G + i));
+			auto m = _mm512_fmadd_ps(beta1, _mm512_loadu_ps(M + i), _mm512_mul_ps(rest1, g));
+			auto v = _mm512_fmadd_ps(beta2, _mm512_loadu_ps(V + i), _mm512_mul_ps(rest2, _mm512_mul_ps(g, g)));
+			_mm512_storeu_ps(M + i, m);
+			_mm512_storeu_ps(V + i, v);
+			//zero masked, see hsum_avx512
+			auto denom = _mm512_add_ps(_mm512_maskz_sqrt_ps(0xFFFF, _mm512_mul_ps(c2, v)), eps);
+			auto step = _mm512_fmadd_ps(decoupled, p, _mm512_div_ps(_mm512_mul_ps(c1, m), denom));
+			_mm512_storeu_ps(P + i, _mm512_fnmadd_ps(lr, step, p));
+		}
+		adam_scalar(P + i, G + i, M + i, V + i, len - i, k);
+	}
+
+
+	/**
+	 * The elementwise and reduction kernels of one instruction set.
+	 * Outputs may alias inputs. The optimizer updates read and write their parameters and
+	 * moments in place, in a single pass.
+	 */
+	struct kernels {
+		void (*add)(const float*, const float*, float*, uint64_t);
+		void (*sub)(const float*, const float*, float*, uint64_t);
+		void (*mult)(const float*, const float*, float*, uint64_t);
+		void (*square)(const float*, float*, uint64_t);
+		float (*dot)(const float*, const float*, uint64_t);
+		float (*sum)(const float*, uint64_t);
+		void (*sgd)(float*, const float*, float*, uint64_t, const sgd_coeffs&);
+		void (*adam)(float*, const float*, float*, float*, uint64_t, const adam_coeffs&);
+	};
+
+	inline const kernels& kernels_for(isa set) {
+		static const kernels scalar{add_scalar, sub_scalar, mult_scalar, square_scalar, dot_scalar,
+			sum_scalar, sgd_scalar, adam_scalar};
+		static const kernels avx2{add_avx2, sub_avx2, mult_avx2, square_avx2, dot_avx2,
+			sum_avx2, sgd_avx2, adam_avx2};
+		static const kernels avx512{add_avx512, sub_avx512, mult_avx512, square_avx512, dot_avx512,
+			sum_avx512, sgd_avx512, adam_avx512};
+		switch (set) {
+			case isa::avx2: return avx2;
+			case isa::avx512: return avx512;
+			default: return scalar;
+		}
+	}
+
+	/**
+	 * Kernels of the best instruction set of the running cpu, selected once.
+	 */
+	inline const kernels& active() {
+		static const kernels& selected = kernels_for(best_isa());
+		return selected;
+	}
+
+}
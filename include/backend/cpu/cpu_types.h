@@ -6,6 +6,7 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <unordered_set>
 #include <ranges>
 #include <queue>
@@ -13,6 +14,7 @@
 
 #include <rep/call_graph.h>
 #include <environ/env_types.h>
+#include <backend/cpu/cpu_allocator.h>
 
 namespace plearn::backend::cpu {
 
@@ -30,11 +32,31 @@ namespace plearn::backend::cpu {
 		float* buf;
 		uint64_t size;
 
-		tensor_buf(uint64_t size) : size(size),
-			buf{new (std::align_val_t(32)) float[size]{}} { }
-		tensor_buf(uint64_t size, float* data) : size(size), buf{data} {}
-
-		~tensor_buf() { delete [] buf; }
+		/**
+		 * A buffer of the global pool, returned to it on destruction. Its content is undefined.
+		 */
+		tensor_buf(uint64_t size) : buf{buffer_pool::global().acquire(size)}, size(size),
+			pooled_{true} { }
+		/**
+		 * A buffer on external memory, freed by deleter unless it is empty.
+		 */
+		tensor_buf(uint64_t size, float* data, buffer_deleter deleter) : buf{data}, size(size),
+			deleter_{std::move(deleter)} {}
+		tensor_buf(const shared_ptr<tensor_buf>& base, uint64_t offset, uint64_t size) :
+			buf{base->buf + offset}, size(size), base_{base} {}
+
+		tensor_buf(const tensor_buf&) = delete;
+		tensor_buf& operator=(const tensor_buf&) = delete;
+
+		~tensor_buf() {
+			if (pooled_) buffer_pool::global().release(buf, size);
+			else if (deleter_) deleter_(buf);
+		}
+
+		//owner of the memory of a view
+		shared_ptr<tensor_buf> base_{};
+		bool pooled_{false};
+		buffer_deleter deleter_{};
 	};
 
 
@@ -66,8 +88,14 @@ namespace plearn::backend::cpu {
 				auto buf = std::make_shared<tensor_buf>(shape.size());
 				return new cpu_tensor(shape, buf);
 			}
-			cpu_tensor* create(const shape_t& shape, float* data) {
-				auto buf = std::make_shared<tensor_buf>(shape.size(), data);
+			cpu_tensor* create(const shape_t& shape, float* data, buffer_deleter deleter) {
+				auto buf = std::make_shared<tensor_buf>(shape.size(), data, std::move(deleter));
+				return new cpu_tensor(shape, buf);
+			}
+			cpu_tensor* view(const cpu_tensor& base, uint64_t offset, const shape_t& shape) {
+				if (offset + shape.size() > base.content_->size)
+					throw std::runtime_error("View out of bounds");
+				auto buf = std::make_shared<tensor_buf>(base.content_, offset, shape.size());
 				return new cpu_tensor(shape, buf);
 			}
 	};
@@ -5,16 +5,21 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <ranges>
 #include <unordered_map>
 #include <vector>
 
 #include <rep/rep_types.h>
 #include <rep/call_graph.h>
+#include <rep/compiled_graph.h>
 #include <rep/diff_info.h>
 #include <environ/env_types.h>
 #include <environ/exec_env.h>
 #include <environ/env_page.h>
+#include <environ/checkpointing.h>
+#include <environ/thread_pool.h>
 
 namespace plearn::env {
 
@@ -23,85 +28,200 @@ namespace plearn::env {
 			bw_op_diff_env(
 					unique_ptr<bw_op_diff_backend_t>&& diff_backend,
 					read_ptr<grad_map> out_grad_map,
-					vector<borrowed_ptr<grad_map>>&& in_grad_maps
+					vector<borrowed_ptr<grad_map>>&& in_grad_maps,
+					vector<borrowed_ptr<std::mutex>>&& in_grad_locks = {}
 					) :
 				diff_backend_(std::move(diff_backend)),
-				out_grad_map_(out_grad_map),
-				in_grad_maps_(std::move(in_grad_maps)) {}
+				updates_(in_grad_maps.size()),
+				in_grad_locks_(std::move(in_grad_locks)) {
+				//the gradient maps are complete, pair their entries once
+				for (unsigned in_idx = 0; in_idx < in_grad_maps.size(); ++in_idx) {
+					for (auto& [outn_id, in_outn_grad] : *in_grad_maps[in_idx]) {
+						if (!out_grad_map->contains(outn_id)) continue;
+						updates_[in_idx].emplace_back(&out_grad_map->at(outn_id), &in_outn_grad);
+					}
+				}
+			}
 
 			void execute(
 					const vector<tensor_p>& inputs,
 					const tensor_p& output
 					) {
 				diff_backend_->reset(inputs, output);
-				for (unsigned in_idx = 0; in_idx < in_grad_maps_.size(); ++in_idx) {
-					auto in_grad_map = in_grad_maps_[in_idx];
-					for (auto& [outn_id, in_outn_grad] : *in_grad_map) {
-						if (!out_grad_map_->contains(outn_id)) continue;
-						auto& out_outn_grad = out_grad_map_->at(outn_id);
-						diff_backend_->update_grad(in_idx, out_outn_grad.grad_, in_outn_grad.grad_);
+				for (unsigned in_idx = 0; in_idx < updates_.size(); ++in_idx) {
+					//consumers of the same input may run concurrently
+					std::unique_lock<std::mutex> lock;
+					if (!in_grad_locks_.empty()) lock = std::unique_lock{*in_grad_locks_[in_idx]};
+					for (auto [out_outn_grad, in_outn_grad] : updates_[in_idx]) {
+						diff_backend_->update_grad(in_idx, out_outn_grad->grad_, in_outn_grad->grad_,
+								in_outn_grad->written_);
+						in_outn_grad->written_ = true;
 					}
 				}
 			}
 		private:
 			unique_ptr<bw_op_diff_backend_t> diff_backend_;
 
-			read_ptr<grad_map> out_grad_map_;
-			vector<borrowed_ptr<grad_map>> in_grad_maps_;
+			//per input, the gradients of the output paired with the ones of the input, by output node
+			vector<vector<std::pair<read_ptr<node_grad>, borrowed_ptr<node_grad>>>> updates_;
+			vector<borrowed_ptr<std::mutex>> in_grad_locks_;
 	};
 
 
 	class bw_diff_page : public diff_page {
 		public:
+			/**
+			 * op_diff_envs are indexed by the ops of graph, null for ops no gradient
+			 * flows through.
+			 */
 			bw_diff_page(
 					const call_graph& cg,
+					const compiled_graph& graph,
 					borrowed_ptr<diff_info> diff_info,
-					unordered_map<op_node_id, unique_ptr<bw_op_diff_env>>&& op_diff_envs,
-					grad_system&& grad_system
+					vector<unique_ptr<bw_op_diff_env>>&& op_diff_envs,
+					grad_system&& grad_system,
+					unordered_map<node_id, unique_ptr<std::mutex>>&& grad_locks,
+					diff_mode mode = diff_mode::jacobian,
+					unique_ptr<segment_recomputer>&& recomputer = nullptr
 					) :
-				cg_(cg), diff_info_(diff_info),
-				op_diff_envs_(std::move(op_diff_envs)), grad_system_(std::move(grad_system)) {}
+				cg_(cg), graph_(graph), diff_info_(diff_info),
+				op_diff_envs_(std::move(op_diff_envs)), grad_system_(std::move(grad_system)),
+				grad_locks_(std::move(grad_locks)), mode_(mode), recomputer_(std::move(recomputer)) {
+				//the reached ops in reverse schedule order, every op after its consumers
+				vector<int> bw_pos(graph_.op_count(), -1);
+				for (unsigned idx = graph_.op_count(); idx-- > 0;) {
+					if (!graph_.reached(idx) || !op_diff_envs_[idx]) continue;
+					bw_pos[idx] = bw_ops_.size();
+					bw_ops_.push_back(idx);
+					bw_inputs_.emplace_back(graph_.inputs(idx).size());
+				}
+				//backward dependencies for parallel runs
+				vector<int> consumers(bw_ops_.size(), 0);
+				vector<vector<unsigned>> producers(bw_ops_.size());
+				for (unsigned pos = 0; pos < bw_ops_.size(); ++pos) {
+					for (auto in_id: graph_.inputs(bw_ops_[pos])) {
+						auto producer = graph_.producer(in_id);
+						if (producer < 0 || bw_pos[producer] < 0) continue;
+						consumers[bw_pos[producer]]++;
+						producers[pos].push_back(bw_pos[producer]);
+					}
+				}
+				bw_deps_ = task_graph{std::move(consumers), std::move(producers)};
 
-			void reset() override {
 				for (auto& [nid, grad_map] : grad_system_) {
-					//dont reset outnodes
-					if (std::ranges::count(cg_.out_nodes_, nid)) continue;
-					for (auto& [_, grad] : grad_map)
-						if (grad.grad_.back_)
-							grad.grad_.back_->zero();
+					bool seeded = std::ranges::count(cg_.out_nodes_, nid);
+					for (auto& [_, grad] : grad_map) {
+						grads_.push_back(&grad);
+						if (!seeded && grad.grad_.back_) computed_.push_back(&grad);
+					}
+				}
+				for (auto outn_id: cg_.out_nodes_) {
+					seeds_.emplace_back(outn_id, &grad_system_[outn_id][outn_id].grad_);
 				}
 			}
 
-			void calc_diffs(exec_page_tensors& tensors) override {
+			/**
+			 * Start a pass: the first update of every gradient overwrites it.
+			 */
+			void reset() override {
+				for (auto grad: grads_) grad->written_ = false;
+			}
+
+			/**
+			 * In vjp mode copy the cotangents into the gradients of the output nodes,
+			 * outputs without a provided cotangent are seeded with ones.
+			 * Jacobians are seeded with the identity at allocation time.
+			 */
+			void seed(const exec_params& params) override {
+				if (mode_ != diff_mode::vjp) return;
+				auto& cotangents = params.cotangents_;
+				for (auto [outn_id, grad_p]: seeds_) {
+					auto& grad = *grad_p;
+					auto size = grad.in_shape.size() * grad.batch_size;
+					if (cotangents.contains(outn_id)) {
+						auto& cotangent = cotangents.at(outn_id);
+						if (cotangent->shape().size() != size)
+							throw std::runtime_error("Cotangent shape mismatch");
+						std::copy_n(cotangent->data(), size, grad.data());
+					} else {
+						std::fill_n(grad.data(), size, 1.f);
+					}
+				}
+			}
+
+			/**
+			 * With a thread pool, ops are dispatched as soon as all the consumers of their
+			 * output finished, gradient updates of a node are serialized by its lock.
+			 * With checkpoints, the ops run in order, every segment recomputed before its
+			 * first op runs.
+			 */
+			void calc_diffs(exec_page_tensors& tensors, borrowed_ptr<thread_pool> pool) override {
 				reset();
-				call_graph_backward_runner runner{cg_};
-				runner.run([this, &tensors] (auto& opn) {
-					vector<tensor_p> inputs(opn.inputs_.size());
-					std::transform(opn.inputs_.begin(), opn.inputs_.end(), inputs.begin(),
-							[this, &tensors](auto in_id) { return tensors[in_id]; });
-					auto& output = tensors[opn.out_];
-					calc_diff(opn, inputs, output);
-				});
+				if (recomputer_) {
+					int segment = -1;
+					for (unsigned pos = 0; pos < bw_ops_.size(); ++pos) {
+						int op_segment = recomputer_->segment_of(bw_ops_[pos]);
+						if (op_segment != segment) recomputer_->recompute(op_segment, tensors);
+						segment = op_segment;
+						calc_diff(pos, tensors);
+					}
+				} else if (pool && bw_ops_.size() > 1) {
+					bw_deps_.run(*pool, [this, &tensors] (unsigned pos) { calc_diff(pos, tensors); });
+				} else {
+					for (unsigned pos = 0; pos < bw_ops_.size(); ++pos) calc_diff(pos, tensors);
+				}
+				clear_unwritten();
 			}
 
 			borrowed_ptr<grad_system> get_grad_system() override { return &grad_system_; }
 
 		private:
-			void calc_diff(const op_node& opn, 
-					const vector<tensor_p>& inputs, const tensor_p& output) {
-				op_diff_envs_[opn.id_]->execute(inputs, output);
+			//gradients no op reached in this pass are zero
+			void clear_unwritten() {
+				for (auto grad: computed_) {
+					if (!grad->written_) grad->grad_.back_->zero();
+				}
+			}
+
+			//the op at position pos of the backward order
+			void calc_diff(unsigned pos, exec_page_tensors& tensors) {
+				auto idx = bw_ops_[pos];
+				auto& inputs = bw_inputs_[pos];
+				auto in_ids = graph_.inputs(idx);
+				auto value = [&](node_id id) -> const tensor_p& {
+					return recomputer_ ? recomputer_->value(id, tensors) : tensors[id];
+				};
+				for (unsigned in_idx = 0; in_idx < in_ids.size(); ++in_idx)
+					inputs[in_idx] = value(in_ids[in_idx]);
+				op_diff_envs_[idx]->execute(inputs, value(graph_.output(idx)));
 			}
 
 
 			//representations
 			const call_graph& cg_;
+			compiled_graph graph_;
 			borrowed_ptr<diff_info> diff_info_;
 
-			//calculating components
-			unordered_map<op_node_id, unique_ptr<bw_op_diff_env>> op_diff_envs_;
+			//calculating components, by op of graph_
+			vector<unique_ptr<bw_op_diff_env>> op_diff_envs_;
 
 			//held resources
 			grad_system grad_system_;
+			unordered_map<node_id, unique_ptr<std::mutex>> grad_locks_;
+
+			diff_mode mode_;
+			//recomputes the tensors the forward pass did not store, if checkpointed
+			unique_ptr<segment_recomputer> recomputer_;
+
+			//ops of graph_ in backward order, and their input arguments
+			vector<unsigned> bw_ops_;
+			vector<vector<tensor_p>> bw_inputs_;
+			//ops wait for the ops consuming their output
+			task_graph bw_deps_;
+			//every gradient, the ones calculated by the pass, and the seeds of the outputs
+			vector<borrowed_ptr<node_grad>> grads_;
+			vector<borrowed_ptr<node_grad>> computed_;
+			vector<std::pair<node_id, borrowed_ptr<gradient>>> seeds_;
 	};
 
 
@@ -120,11 +240,34 @@ namespace plearn::env {
 				return *this;
 			}
 
+			bw_diff_page_builder& mode(diff_mode mode) {
+				mode_ = mode;
+				return *this;
+			}
+
+			/**
+			 * The compiled form of the graph, compiled by the builder if not set.
+			 */
+			bw_diff_page_builder& graph(const compiled_graph& graph) {
+				graph_ = graph;
+				return *this;
+			}
+
+			/**
+			 * Recompute the tensors the forward pass does not store, see checkpointing.
+			 */
+			bw_diff_page_builder& recompute(unique_ptr<segment_recomputer>&& recomputer) {
+				recomputer_ = std::move(recomputer);
+				return *this;
+			}
+
 			unique_ptr<bw_diff_page> build() {
+				if (!graph_) graph_ = compiled_graph{cg_};
 				allocate_grad_tensors();
 				return std::make_unique<bw_diff_page>(
-						cg_, diff_info_,
-						std::move(op_diff_envs_), std::move(grad_system_));
+						cg_, *graph_, diff_info_,
+						std::move(op_diff_envs_), std::move(grad_system_),
+						std::move(grad_locks_), mode_, std::move(recomputer_));
 			}
 
 		private:
@@ -132,14 +275,26 @@ namespace plearn::env {
 				return batch_size_ == 1 ? shape : shape_t{batch_size_} * shape;
 			}
 
+			/**
+			 * Shape of the gradient tensor of node wrt outn.
+			 * A full Jacobian in jacobian mode, a cotangent of the node in vjp mode.
+			 */
+			shape_t grad_shape(const shape_t& node_shape, const shape_t& outn_shape) const {
+				if (mode_ == diff_mode::vjp) return batch_shape(node_shape);
+				return batch_shape(node_shape * outn_shape);
+			}
+
 			bw_diff_page_builder& allocate_grad_tensors() {
 				//insert output nodes as identity
 				for (auto& outn_id: cg_.out_nodes_) {
 					auto& outn = cg_.flow_nodes_.at(outn_id);
-					auto grad_tens_shape = batch_shape(outn.shape_ * outn.shape_);
-					auto back_tens = backend_->create_tensor(grad_tens_shape, tensor_init::identity).release();
+					auto grad_tens_shape = grad_shape(outn.shape_, outn.shape_);
+					//vjp seeds are set before each run
+					auto init = mode_ == diff_mode::vjp ? tensor_init::no_init : tensor_init::identity;
+					auto back_tens = backend_->create_tensor(grad_tens_shape, init).release();
 					grad_system_[outn_id][outn_id] = {outn_id, outn_id, 
-						{outn.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_}, true};
+						{outn.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_, mode_},
+						mode_ == diff_mode::jacobian};
 				}
 				//insert flow and data nodes
 				//flow nodes
@@ -152,10 +307,10 @@ namespace plearn::env {
 						//only if outn depends on flown
 						if (!deps.output_dependant(outn_id)) continue;
 						auto& outn = cg_.flow_nodes_.at(outn_id);
-						auto grad_tens_shape = batch_shape(flown.shape_ * outn.shape_);
+						auto grad_tens_shape = grad_shape(flown.shape_, outn.shape_);
 						auto back_tens = backend_->create_tensor(grad_tens_shape).release();
 						grad_system_[flown_id][outn_id] = {flown_id, outn_id, 
-							{flown.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_}, false};
+							{flown.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_, mode_}, false};
 					}
 				}
 				//data nodes
@@ -167,35 +322,59 @@ namespace plearn::env {
 						//only if outn depends on flown
 						if (!deps.output_dependant(outn_id)) continue;
 						auto& outn = cg_.flow_nodes_.at(outn_id);
-						auto grad_tens_shape = batch_shape(datan.shape_ * outn.shape_);
+						auto grad_tens_shape = grad_shape(datan.shape_, outn.shape_);
 						auto back_tens = backend_->create_tensor(grad_tens_shape).release();
 						grad_system_[datan_id][outn_id] = {datan_id, outn_id, 
-							{datan.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_}, false};
+							{datan.shape_, outn.shape_, shared_ptr<tensor_back_t>(back_tens), batch_size_, mode_}, false};
 					}
 				}
-				//populate op_diff_envs_
-				for (auto& [opn_id, opn]: cg_.op_nodes_) {
+				//populate op_diff_envs_, ops without an input that needs a gradient get none
+				op_diff_envs_.resize(graph_->op_count());
+				for (unsigned idx = 0; idx < graph_->op_count(); ++idx) {
+					auto& opn = graph_->op(idx);
 					auto& op = opn.op_;
+					if (!grad_system_.contains(opn.out_)) continue;
 					auto& out_grad_map = grad_system_.at(opn.out_);
+					bool needed = std::ranges::any_of(opn.inputs_, [&](auto in_id) {
+						if (!grad_system_.contains(in_id)) return false;
+						return std::ranges::any_of(grad_system_.at(in_id),
+								[&](auto& entry) { return out_grad_map.contains(entry.first); });
+					});
+					if (!needed) continue;
 					vector<borrowed_ptr<grad_map>> in_grad_maps(opn.inputs_.size());
 					std::transform(opn.inputs_.begin(), opn.inputs_.end(), in_grad_maps.begin(),
 							[this](auto in_id) { return &grad_system_[in_id]; });
+					vector<borrowed_ptr<std::mutex>> in_grad_locks(opn.inputs_.size());
+					std::transform(opn.inputs_.begin(), opn.inputs_.end(), in_grad_locks.begin(),
+							[this](auto in_id) { return grad_lock(in_id); });
 					auto op_diff_backend = backend_->create_op_bw_diff_backend(op);
-					op_diff_envs_[opn_id] = std::make_unique<bw_op_diff_env>(
-							std::move(op_diff_backend), &out_grad_map, std::move(in_grad_maps));
+					op_diff_envs_[idx] = std::make_unique<bw_op_diff_env>(
+							std::move(op_diff_backend), &out_grad_map,
+							std::move(in_grad_maps), std::move(in_grad_locks));
 				}
 				return *this;
 			}
 
 
+			borrowed_ptr<std::mutex> grad_lock(node_id id) {
+				auto& lock = grad_locks_[id];
+				if (!lock) lock = std::make_unique<std::mutex>();
+				return lock.get();
+			}
+
+
 			const call_graph& cg_;
 			borrowed_ptr<diff_info> diff_info_;
 			borrowed_ptr<backend_t> backend_;
 
-			unordered_map<op_node_id, unique_ptr<bw_op_diff_env>> op_diff_envs_;
+			std::optional<compiled_graph> graph_;
+			unique_ptr<segment_recomputer> recomputer_;
+			vector<unique_ptr<bw_op_diff_env>> op_diff_envs_;
 			grad_system grad_system_;
+			unordered_map<node_id, unique_ptr<std::mutex>> grad_locks_;
 
 			int batch_size_ = 1;
+			diff_mode mode_ = diff_mode::jacobian;
 	};
 
 }
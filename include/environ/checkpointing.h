@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+#include <rep/compiled_graph.h>
+#include <rep/views.h>
+#include <environ/env_types.h>
+#include <environ/exec_env.h>
+
+namespace plearn::env {
+
+	/**
+	 * Internal tensors stored for the backward pass so that the stored tensors and the
+	 * largest recomputed segment fit in budget_bytes.
+	 * Segments are runs of the schedule between checkpoints, plans with longer runs store
+	 * less and recompute more. Of the plans that fit, the one recomputing least is taken,
+	 * if none fits the one needing the least memory.
+	 */
+	inline unordered_set<node_id> select_checkpoints(const call_graph& cg,
+			const compiled_graph& graph, uint64_t budget_bytes) {
+		vector<bool> internal(graph.node_count(), false);
+		for (auto id: cg.internal_nodes_) internal[id] = true;
+		vector<uint64_t> sizes;
+		vector<node_id> ids;
+		uint64_t total = 0;
+		for (unsigned idx = 0; idx < graph.op_count(); ++idx) {
+			auto id = graph.output(idx);
+			if (!internal[id]) continue;
+			ids.push_back(id);
+			sizes.push_back(graph.shape(id).size());
+			total += sizes.back();
+		}
+		unordered_set<node_id> all{ids.begin(), ids.end()};
+		if (total * sizeof(float) <= budget_bytes) return all;
+
+		//store a tensor when its segment would exceed limit elements
+		struct plan { uint64_t limit_, stored_, bytes_; };
+		auto plan_for = [&](uint64_t limit) {
+			uint64_t segment = 0, stored = 0, peak = 0;
+			for (auto size: sizes) {
+				if (segment + size > limit) {
+					stored += size;
+					segment = 0;
+				} else {
+					segment += size;
+				}
+				peak = std::max(peak, segment);
+			}
+			return plan{limit, stored, (stored + peak) * sizeof(float)};
+		};
+		std::optional<plan> best, smallest;
+		for (uint64_t k = 1; k <= ids.size(); ++k) {
+			auto p = plan_for(total / k);
+			if (!smallest || p.bytes_ < smallest->bytes_) smallest = p;
+			if (p.bytes_ <= budget_bytes && (!best || p.stored_ > best->stored_)) best = p;
+		}
+		auto limit = (best ? best : smallest)->limit_;
+
+		unordered_set<node_id> checkpoints;
+		uint64_t segment = 0;
+		for (unsigned i = 0; i < ids.size(); ++i) {
+			if (segment + sizes[i] > limit) {
+				checkpoints.insert(ids[i]);
+				segment = 0;
+			} else {
+				segment += sizes[i];
+			}
+		}
+		return checkpoints;
+	}
+
+
+	/**
+	 * Recomputes the internal tensors that were not stored by the forward pass, segment by
+	 * segment, for a backward pass walking the schedule backwards.
+	 * A segment ends with an op whose output is a checkpoint. Recomputing a segment runs the
+	 * ops producing the tensors its ops read, and the ops those need, into buffers shared by
+	 * all segments. Graph inputs, outputs and data tensors are always stored.
+	 */
+	class segment_recomputer {
+		public:
+			segment_recomputer(const call_graph& cg, const compiled_graph& graph,
+					const unordered_set<node_id>& checkpoints, borrowed_ptr<exec_env> env) :
+				graph_(graph), env_(env), values_(graph.node_count()) {
+				auto plan = plan_segments(cg, graph, checkpoints);
+				segment_of_ = std::move(plan.segment_of_);
+				segments_.resize(plan.ops_.size());
+				for (unsigned s = 0; s < segments_.size(); ++s) segments_[s].ops_ = std::move(plan.ops_[s]);
+
+				if (plan.arena_size_ == 0) return;
+				arena_ = env_->create_tensor(shape_t{plan.arena_size_});
+				for (unsigned s = 0; s < segments_.size(); ++s) {
+					for (auto [id, offset]: plan.offsets_[s])
+						segments_[s].buffers_.emplace_back(id, env_->create_view(arena_, offset, graph.shape(id)));
+				}
+			}
+
+			/**
+			 * Bytes of the buffers a recomputer of these checkpoints allocates.
+			 */
+			static uint64_t buffer_bytes(const call_graph& cg, const compiled_graph& graph,
+					const unordered_set<node_id>& checkpoints) {
+				return plan_segments(cg, graph, checkpoints).arena_size_ * sizeof(float);
+			}
+
+			unsigned segment_of(unsigned op_idx) const { return segment_of_[op_idx]; }
+
+			/**
+			 * Rerun the ops of a segment on the tensors of the execution.
+			 */
+			void recompute(unsigned segment, const exec_page_tensors& tensors) {
+				auto backend = env_->backend();
+				auto& seg = segments_[segment];
+				for (auto& [id, buffer]: seg.buffers_) values_[id] = buffer;
+				for (auto idx: seg.ops_) {
+					auto in_ids = graph_.inputs(idx);
+					inputs_.resize(in_ids.size());
+					for (unsigned in_idx = 0; in_idx < in_ids.size(); ++in_idx)
+						inputs_[in_idx] = env_->materialize(value(in_ids[in_idx], tensors));
+					auto& op = graph_.op(idx).op_;
+					auto& output = values_[graph_.output(idx)];
+					if (is_view(op.type_))
+						backend->materialize(env_->view(op, inputs_[0], output->shape()), output);
+					else
+						backend->exec_op(op, inputs_, output);
+				}
+			}
+
+			/**
+			 * The tensor of a node, recomputed if it was not stored.
+			 * Only valid for the nodes the ops of the last recomputed segment read.
+			 */
+			const tensor_p& value(node_id id, const exec_page_tensors& tensors) const {
+				return values_[id] ? values_[id] : tensors[id];
+			}
+
+			/**
+			 * Bytes of the buffers of the recomputed tensors.
+			 */
+			uint64_t buffer_bytes() const {
+				return arena_ ? arena_->shape().size() * sizeof(float) : 0;
+			}
+
+		private:
+			struct segment_plan {
+				vector<unsigned> segment_of_;
+				//by segment, the ops to rerun and the offsets of their outputs
+				vector<vector<unsigned>> ops_;
+				vector<vector<std::pair<node_id, uint64_t>>> offsets_;
+				uint64_t arena_size_{0};
+			};
+
+			static segment_plan plan_segments(const call_graph& cg, const compiled_graph& graph,
+					const unordered_set<node_id>& checkpoints) {
+				vector<bool> dropped(graph.node_count(), false);
+				for (auto id: cg.internal_nodes_) dropped[id] = !checkpoints.contains(id);
+
+				segment_plan plan;
+				plan.segment_of_.resize(graph.op_count());
+				unsigned segment = 0;
+				for (unsigned idx = 0; idx < graph.op_count(); ++idx) {
+					plan.segment_of_[idx] = segment;
+					if (checkpoints.contains(graph.output(idx))) segment++;
+				}
+				plan.ops_.resize(segment + 1);
+				plan.offsets_.resize(segment + 1);
+
+				for (unsigned s = 0; s < plan.ops_.size(); ++s) {
+					vector<bool> needed(graph.node_count(), false);
+					vector<node_id> stack;
+					for (unsigned idx = 0; idx < graph.op_count(); ++idx) {
+						if (plan.segment_of_[idx] != s || !graph.reached(idx)) continue;
+						for (auto in_id: graph.inputs(idx)) stack.push_back(in_id);
+						stack.push_back(graph.output(idx));
+					}
+					auto& ops = plan.ops_[s];
+					while (!stack.empty()) {
+						auto id = stack.back();
+						stack.pop_back();
+						if (!dropped[id] || needed[id]) continue;
+						needed[id] = true;
+						auto producer = graph.producer(id);
+						ops.push_back(producer);
+						for (auto in_id: graph.inputs(producer)) stack.push_back(in_id);
+					}
+					std::ranges::sort(ops);
+					uint64_t offset = 0;
+					for (auto idx: ops) {
+						auto id = graph.output(idx);
+						plan.offsets_[s].emplace_back(id, offset);
+						//offsets are aligned to 32 bytes
+						offset += (graph.shape(id).size() + 7) / 8 * 8;
+					}
+					plan.arena_size_ = std::max(plan.arena_size_, offset);
+				}
+				return plan;
+			}
+
+			struct segment {
+				//in schedule order
+				vector<unsigned> ops_;
+				vector<std::pair<node_id, tensor_p>> buffers_;
+			};
+
+			const compiled_graph& graph_;
+			borrowed_ptr<exec_env> env_;
+
+			vector<unsigned> segment_of_;
+			vector<segment> segments_;
+			tensor_p arena_{};
+			//recomputed tensors by node id, null for stored ones
+			vector<tensor_p> values_;
+			vector<tensor_p> inputs_;
+	};
+
+}
@@ -1,7 +1,11 @@
 #pragma once
 
 #include "rep/call_graph_runner.h"
+#include <rep/compiled_graph.h>
 #include <environ/env_types.h>
+#include <environ/exec_env.h>
+#include <environ/memory_planner.h>
+#include <environ/thread_pool.h>
 #include <unordered_map>
 
 namespace plearn::env {
@@ -13,64 +17,355 @@ namespace plearn::env {
 	 */
 	struct exec_page_resources {
 		unordered_map<node_id, tensor_p> internal_tensors_;
+		//internal tensors are views into the arena, placed by the plan
+		tensor_p arena_{};
+		memory_plan memory_plan_{};
 	};
 
 	class diff_page {
 		public:
-			virtual void calc_diffs(exec_page_tensors&) = 0;
+			/**
+			 * Calculate the diffs of an execution, concurrently if a thread pool is given.
+			 */
+			virtual void calc_diffs(exec_page_tensors&, borrowed_ptr<thread_pool> pool) = 0;
 			virtual void reset() = 0;
+			/**
+			 * Set the seeds of the pass from the params before calculating diffs.
+			 */
+			virtual void seed(const exec_params&) {}
 			virtual borrowed_ptr<grad_system> get_grad_system() = 0;
+			//tangents of the outputs, for forward mode pages
+			virtual borrowed_ptr<tangent_map> get_tangents() { return nullptr; }
 			virtual ~diff_page() = default;
 	};
 
+	/**
+	 * A strided input copied to a contiguous tensor before its op runs.
+	 */
+	struct strided_copy {
+		unsigned arg_;
+		tensor_p src_;
+		tensor_p dst_;
+	};
+
+	/**
+	 * One op of the schedule with its arguments resolved.
+	 */
+	struct exec_step {
+		read_ptr<op_node> opn_;
+		vector<tensor_p> inputs_;
+		tensor_p output_{};
+		//inputs carrying the batch dimension
+		vector<bool> batched_{};
+		//the op bound to the buffers of its arguments, empty if it goes through exec_op
+		bound_kernel kernel_{};
+		vector<strided_copy> copies_{};
+
+		//view ops: the view of the input, which is the output itself unless it is copied there
+		bool view_op_{false};
+		bool alias_{false};
+		tensor_p view_{};
+		read_ptr<tensor_t> viewed_{nullptr};
+	};
+
 	class exec_page {
 		public:
-            exec_page(borrowed_ptr<backend_t> backend, const call_graph& cg, 
-                      exec_page_resources&& resources):
-                cg_{cg}, resources_{std::move(resources)}, backend_{backend} {}
-
-			exec_result execute(exec_page_tensors& tensors) {
-				reset();
-				call_graph_forward_runner runner{cg_};
-                runner.run([&](const op_node& opn) {
-				
-					auto& op = opn.op_;
-					//collect inputs and outputs
-					vector<tensor_p> inputs(opn.inputs_.size());
-					std::transform(opn.inputs_.begin(), opn.inputs_.end(), 
-							inputs.begin(), 
-                            [this, &tensors](auto id) { return tensors[id]; });
-					tensor_p output = tensors[opn.out_];
-					//execute operation
-					backend_->exec_op(op, inputs, output);
-				});
-
-				vector<tensor_p> outputs(cg_.out_nodes_.size());
-				std::transform(cg_.out_nodes_.begin(), cg_.out_nodes_.end(), 
-						outputs.begin(), 
-                        [this, &tensors](auto id) { return tensors[id]; });
-				
+            exec_page(borrowed_ptr<exec_env> env, const compiled_graph& graph,
+                      exec_page_resources&& resources, int batch_size = 1):
+                graph_{graph}, resources_{std::move(resources)}, env_{env}, backend_{env->backend()},
+				batch_size_{batch_size}, tensors_{graph.node_count()} {
+				for (auto& [id, tens]: resources_.internal_tensors_) tensors_[id] = tens;
+				resolve_steps();
+			}
+
+			/**
+			 * Bind the tensors provided for one execution.
+			 * Only graph inputs, outputs and data tensors are rebound, internal tensors
+			 * are resolved once when the page is created.
+			 */
+			exec_page_tensors& bind(const unordered_map<node_id, tensor_p>& data_tensors,
+					const exec_params& params) {
+				for (auto& [id, tens]: data_tensors) tensors_[id] = tens;
+				for (auto& [id, tens]: params.inputs_) tensors_[id] = tens;
+				for (auto& [id, tens]: params.outputs_) tensors_[id] = tens;
+				rebind();
+				return tensors_;
+			}
+
+			/**
+			 * The slot of a tensor provided by other components, stable for the life of the page.
+			 * Tensors set through slots are picked up by rebind.
+			 */
+			tensor_p& slot(node_id id) { return tensors_[id]; }
+
+			/**
+			 * Pass the tensors in the slots to the steps reading them, in schedule order,
+			 * so views are laid over the tensors of this execution before they are read.
+			 * Kernels are bound once every argument is known, later only their buffers
+			 * are swapped.
+			 */
+			void rebind() {
+				auto binding = bindings_.begin();
+				for (unsigned idx = 0; idx < steps_.size(); ++idx) {
+					auto& step = steps_[idx];
+					for (; binding != bindings_.end() && binding->step_ == idx; ++binding)
+						set_arg(step, binding->arg_, *binding->tens_);
+					if (step.view_op_) update_view(idx);
+				}
+				if (!kernels_bound_) bind_kernels();
+			}
+
+			/**
+			 * Execute the schedule on the bound tensors.
+			 * With a thread pool, every step is dispatched as soon as its producers finished.
+			 */
+			exec_result execute(borrowed_ptr<thread_pool> pool = nullptr) {
+				if (pool && steps_.size() > 1) {
+					execute_parallel(*pool);
+				} else {
+					for (auto& step: steps_) execute_step(step);
+				}
 
 				exec_result result{.success_=true};
 				return result;
 			}
 
-            void reset() {
-              for (auto &[id, tens] : resources_.internal_tensors_) {
-                tens->back()->zero();
-              }
-            }
+			/**
+			 * The tensors of the execution as the diff pages read them: contiguous.
+			 * Strided tensors bound by the caller, fx. a transposed input, are copied to
+			 * tensors of the page, the others are the ones of the execution.
+			 */
+			exec_page_tensors& diff_tensors() {
+				bool strided = std::ranges::any_of(tensors_.tensors_,
+						[](auto& t) { return t && !t->contiguous(); });
+				if (!strided) return tensors_;
+				diff_tensors_.tensors_.resize(tensors_.tensors_.size());
+				dense_.resize(tensors_.tensors_.size());
+				for (std::size_t id = 0; id < tensors_.tensors_.size(); ++id) {
+					auto& tens = tensors_.tensors_[id];
+					if (!tens || tens->contiguous()) {
+						diff_tensors_.tensors_[id] = tens;
+						continue;
+					}
+					auto& dense = dense_[id];
+					if (!dense || dense->shape() != tens->shape())
+						dense = env_->create_tensor(tens->shape());
+					backend_->materialize(tens, dense);
+					diff_tensors_.tensors_[id] = dense;
+				}
+				return diff_tensors_;
+			}
 
             exec_page_resources& resources() { return resources_; }
+
+			int batch_size() const { return batch_size_; }
 		private:
+			void execute_step(exec_step& step) {
+				for (auto& copy: step.copies_) backend_->materialize(copy.src_, copy.dst_);
+				if (step.kernel_)
+					step.kernel_();
+				else if (step.view_op_) {
+					if (!step.alias_) backend_->materialize(step.view_, step.output_);
+				}
+				else if (batch_size_ == 1)
+					backend_->exec_op(step.opn_->op_, step.inputs_, step.output_);
+				else
+					backend_->exec_batch_op(step.opn_->op_, step.inputs_, step.output_,
+							batch_size_, step.batched_);
+			}
+
+			void execute_parallel(thread_pool& pool) {
+				deps_.run(pool, [this](unsigned idx) { execute_step(steps_[idx]); });
+			}
+
+			/**
+			 * Set an argument of a step, -1 for its output.
+			 * Strided inputs are copied to a tensor of the step, unless its kernel reads them
+			 * through their strides. A kernel whose inputs change between strided and
+			 * contiguous is bound again.
+			 */
+			void set_arg(exec_step& step, int arg, const tensor_p& tens) {
+				if (arg < 0) {
+					step.output_ = tens;
+					if (step.kernel_) step.kernel_.out_ = tens ? tens->data() : nullptr;
+					return;
+				}
+				if (step.view_op_) {
+					step.inputs_[arg] = tens;
+					return;
+				}
+				auto copy = std::ranges::find(step.copies_, unsigned(arg), &strided_copy::arg_);
+				auto& previous = copy != step.copies_.end() ? copy->src_ : step.inputs_[arg];
+				bool was_strided = previous && !previous->contiguous();
+				bool strided = tens && !tens->contiguous();
+				if (strided && !(batch_size_ == 1 && backend_->reads_strided(step.opn_->op_, arg, tens))) {
+					if (copy == step.copies_.end()) {
+						step.copies_.push_back({unsigned(arg), tens, nullptr});
+						copy = step.copies_.end() - 1;
+					}
+					copy->src_ = tens;
+					if (!copy->dst_ || copy->dst_->shape() != tens->shape())
+						copy->dst_ = env_->create_tensor(tens->shape());
+					step.inputs_[arg] = copy->dst_;
+				} else {
+					if (copy != step.copies_.end()) step.copies_.erase(copy);
+					step.inputs_[arg] = tens;
+				}
+				if (!step.kernel_) return;
+				if (strided != was_strided) kernels_bound_ = false;
+				step.kernel_.in_[arg] = step.inputs_[arg] ? step.inputs_[arg]->data() : nullptr;
+			}
+
+			/**
+			 * Lay the view of a view op over its input, when the input changed.
+			 * In a batched page the view is laid over every sample, an input shared by the
+			 * batch is repeated over it.
+			 */
+			void update_view(unsigned idx) {
+				auto& step = steps_[idx];
+				auto& src = step.inputs_[0];
+				if (!src || src.get() == step.viewed_) return;
+				step.viewed_ = src.get();
+
+				auto& op = step.opn_->op_;
+				auto in_id = graph_.inputs(idx)[0];
+				auto& in_shape = graph_.shape(in_id);
+				auto& out_shape = graph_.shape(graph_.output(idx));
+				bool batched = batch_size_ > 1 && graph_.is_flow(in_id);
+				auto sample_strides = [&](const tensor_p& t) {
+					auto strides = t->strides();
+					if (batched) strides.erase(strides.begin());
+					return strides;
+				};
+
+				step.copies_.clear();
+				auto base = src;
+				auto layout = view_of(op, in_shape, sample_strides(base), out_shape);
+				if (!layout) {
+					//a reshape of a strided input reads a contiguous copy
+					base = env_->create_tensor(src->shape());
+					step.copies_.push_back({0, src, base});
+					layout = view_of(op, in_shape, sample_strides(base), out_shape);
+				}
+				auto shape = out_shape;
+				auto strides = layout->strides_;
+				if (batch_size_ > 1) {
+					shape = shape_t{batch_size_} * out_shape;
+					strides.insert(strides.begin(), batched ? base->strides()[0] : 0);
+				}
+				step.view_ = env_->create_view(base, layout->offset_, shape, strides);
+				if (step.alias_) tensors_[graph_.output(idx)] = step.view_;
+			}
+
+			/**
+			 * Bind the steps to their buffers, batched pages keep dispatching through
+			 * exec_batch_op.
+			 */
+			void bind_kernels() {
+				if (batch_size_ != 1) return;
+				for (auto& binding: bindings_) {
+					if (!*binding.tens_) return;
+				}
+				for (auto& step: steps_) {
+					if (step.view_op_) continue;
+					step.kernel_ = backend_->bind_op(step.opn_->op_, step.inputs_, step.output_);
+				}
+				kernels_bound_ = true;
+			}
+
+			void resolve_steps() {
+				auto& views = resources_.memory_plan_.views_;
+				steps_.reserve(graph_.op_count());
+				for (unsigned idx = 0; idx < graph_.op_count(); ++idx) {
+					auto inputs = graph_.inputs(idx);
+					auto& step = steps_.emplace_back(exec_step{&graph_.op(idx), vector<tensor_p>(inputs.size())});
+					step.view_op_ = is_view(step.opn_->op_.type_);
+					step.alias_ = views.contains(graph_.output(idx));
+					for (unsigned in_idx = 0; in_idx < inputs.size(); ++in_idx) {
+						resolve(idx, in_idx, inputs[in_idx]);
+						//flow tensors carry the batch dimension, data tensors are shared
+						step.batched_.push_back(graph_.is_flow(inputs[in_idx]));
+					}
+					if (!step.alias_) resolve(idx, -1, graph_.output(idx));
+				}
+
+				//dependencies between the steps, for parallel execution
+				vector<int> deps(steps_.size(), 0);
+				vector<vector<unsigned>> consumers(steps_.size());
+				for (unsigned idx = 0; idx < steps_.size(); ++idx) {
+					auto next = graph_.consumers(idx);
+					consumers[idx].assign(next.begin(), next.end());
+					for (auto consumer: next) deps[consumer]++;
+				}
+				//a tensor reusing memory is produced after the users of the previous tensor,
+				//including the users of views laid over it
+				auto& blocks = resources_.memory_plan_.blocks_;
+				for (auto& [id, block]: blocks) {
+					auto producer = graph_.producer(id);
+					if (producer < 0) continue;
+					for (auto& [other_id, other_block]: blocks) {
+						auto other = graph_.producer(other_id);
+						if (other_id == id || !block.overlaps(other_block) || other < 0 || other >= producer)
+							continue;
+						auto add_dep = [&](unsigned user) {
+							if (user == unsigned(producer)) return;
+							deps[producer]++;
+							consumers[user].push_back(producer);
+						};
+						add_dep(other);
+						vector<unsigned> readers{unsigned(other)};
+						while (!readers.empty()) {
+							auto reader = readers.back();
+							readers.pop_back();
+							for (auto user: graph_.consumers(reader)) {
+								add_dep(user);
+								if (steps_[user].alias_) readers.push_back(user);
+							}
+						}
+					}
+				}
+				deps_ = task_graph{std::move(deps), std::move(consumers)};
+			}
+
+			//argument arg of a step, -1 for its output
+			void resolve(unsigned step_idx, int arg, node_id id) {
+				auto& step = steps_[step_idx];
+				if (resources_.internal_tensors_.contains(id))
+					(arg < 0 ? step.output_ : step.inputs_[arg]) = tensors_[id];
+				else
+					bindings_.push_back({step_idx, arg, &tensors_[id]});
+			}
+
             //representation
-			const call_graph& cg_;
+			const compiled_graph& graph_;
 
 			//resources held by this page
 			exec_page_resources resources_;
 
 			//calculation and resource mgmt components
+			borrowed_ptr<exec_env> env_;
 			borrowed_ptr<backend_t> backend_;
+
+			int batch_size_;
+
+			//tensors of all nodes of the graph by node id, for the current execution
+			exec_page_tensors tensors_;
+			//the tensors read by the diff pages, with contiguous copies of the strided ones
+			exec_page_tensors diff_tensors_;
+			vector<tensor_p> dense_;
+			vector<exec_step> steps_;
+			//step arguments that are rebound on every execution, by step
+			struct binding {
+				unsigned step_;
+				//index of the input, -1 for the output
+				int arg_;
+				read_ptr<tensor_p> tens_;
+			};
+			vector<binding> bindings_;
+			bool kernels_bound_{false};
+
+			//steps wait for the steps producing their inputs
+			task_graph deps_;
 	};
 
     /**
@@ -86,34 +381,25 @@ namespace plearn::env {
 				exec_page_{std::move(exec_page)}, data_tensors_{data_tensors} {}
 
             exec_result execute(exec_params& params) {
-				exec_page_tensors exec_tensors{
-                    exec_page_->resources().internal_tensors_,
-                    data_tensors_, 
-					params.inputs_, params.outputs_};
+				exec_page_->bind(data_tensors_, params);
 
-
-                auto result = exec_page_->execute(exec_tensors);
+                auto result = exec_page_->execute(params.thread_pool_);
 
 				if (params.calc_diffs) {
-                    diff_page_->calc_diffs(exec_tensors);
+                    diff_page_->seed(params);
+                    diff_page_->calc_diffs(exec_page_->diff_tensors(), params.thread_pool_);
 					result.grad_system_ = diff_page_->get_grad_system();
+					result.tangents_ = diff_page_->get_tangents();
 				}
                 return result;
             }
 			
+			/**
+			 * Execute the page on a batch of inputs, without differentiation.
+			 */
 			exec_result batch_execute(exec_params& params) {
-				exec_page_tensors exec_tensors{
-					exec_page_->resources().internal_tensors_,
-					data_tensors_, 
-					params.inputs_, params.outputs_};
-
-				auto result = exec_page_->execute(exec_tensors);
-
-				if (params.calc_diffs) {
-					diff_page_->calc_diffs(exec_tensors);
-					result.grad_system_ = diff_page_->get_grad_system();
-				}
-				return result;
+				exec_page_->bind(data_tensors_, params);
+				return exec_page_->execute(params.thread_pool_);
 			}
 
 			void set_diff_page(unique_ptr<diff_page>&& diff_page) {
@@ -4,20 +4,24 @@
 #include <cassert>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <ranges>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <rep/rep_types.h>
 #include <rep/call_graph.h>
 #include <rep/call_graph_runner.h>
+#include <rep/compiled_graph.h>
 #include <algorithm>
 #include <rep/diff_info.h>
 #include <environ/env_types.h>
 #include <environ/exec_env.h>
 #include <environ/env_page.h>
-#include <environ/fp_diff_env.h>
 #include "environ/bw_diff_page.h"
+#include "environ/fw_diff_page.h"
+#include "environ/checkpointing.h"
 
 namespace plearn::env {
 
@@ -31,22 +35,36 @@ namespace plearn::env {
 			env_section(
 					const call_graph& cg, unique_ptr<diff_info>&& diff_info,
 				    borrowed_ptr<exec_env> env, borrowed_ptr<backend_t> backend,
-					const unordered_map<node_id, tensor_p>& data_tensors
+					const unordered_map<node_id, tensor_p>& data_tensors,
+					diff_mode mode = diff_mode::jacobian,
+					uint64_t directions = 1,
+					bool forward_jacobians = false,
+					std::optional<unordered_set<node_id>> checkpoints = std::nullopt
 					):
 				cg_{cg}, diff_info_{std::move(diff_info)},
-				env_{env}, backend_{backend},
-				data_tensors_{data_tensors} 
+				schedule_{call_graph_schedule::forward(cg)},
+				graph_{cg, schedule_},
+				data_tensors_{data_tensors},
+				env_{env}, backend_{backend}, diff_mode_{mode}, directions_{directions},
+				forward_jacobians_{forward_jacobians},
+				checkpoints_{std::move(checkpoints)}
 			{}
 
 			exec_result execute(exec_params& params) {
+				if (params.batch_size > 1) return batch_execute(params);
 				ensure_resources(params);
 				return batch_pages_[1]->execute(params);
 			}
 
+			/**
+			 * Execute params.batch_size samples at once. Input and output tensors
+			 * have a leading batch dimension, data tensors are shared by the batch.
+			 */
 			exec_result batch_execute(exec_params& params) {
-				//TODO
-				/* ensure_resources(params); */
-				/* return env_page_->batch_execute(params); */
+				if (params.calc_diffs)
+					throw std::runtime_error("Batched differentiation not supported");
+				ensure_resources(params);
+				return batch_pages_[params.batch_size]->batch_execute(params);
 			}
 
 			tensor_p& get_data_tensor(node_id id) {
@@ -56,12 +74,17 @@ namespace plearn::env {
 				throw std::runtime_error("tensor not found");
 			}
 
+			bool has_data_tensor(node_id id) const {
+				return data_tensors_.contains(id) && data_tensors_.at(id);
+			}
+
 			void set_data_tensor(node_id id, tensor_p tens) {
 				data_tensors_[id] = tens;
 			}
 
 			void create_env_page(int batch_size = 1, bool make_diff_page = false) {
-				unique_ptr<exec_page> exec_page = create_exec_page(batch_size);
+				//the diff page reads the forward tensors, so they cannot share memory
+				unique_ptr<exec_page> exec_page = create_exec_page(batch_size, make_diff_page);
 				auto env_p = std::make_unique<env_page>(
 					std::move(exec_page), data_tensors_);
 
@@ -72,7 +95,49 @@ namespace plearn::env {
 				batch_pages_[batch_size] = std::move(env_p);
 			}
 
-			
+			/**
+			 * A page of its own for batch_size, not shared with the executions of the section.
+			 * Its data tensors are bound through data_slot.
+			 */
+			unique_ptr<exec_page> create_detached_page(int batch_size = 1) {
+				return create_exec_page(batch_size, false);
+			}
+
+			/**
+			 * The entry of a data tensor, it stays valid when the tensor is replaced.
+			 */
+			const tensor_p& data_slot(node_id id) { return data_tensors_[id]; }
+
+			/**
+			 * Whether the Jacobians are accumulated forward, see diff_mode::automatic.
+			 */
+			bool forward_jacobians() const { return forward_jacobians_; }
+
+			/**
+			 * Whether the backward pass recomputes the tensors that are not checkpoints.
+			 * Forward mode pages read every tensor of the forward pass, they are never checkpointed.
+			 */
+			bool checkpointed() const {
+				return checkpoints_ && !forward_jacobians_ && diff_mode_ != diff_mode::jvp;
+			}
+
+			/**
+			 * Placement of the internal tensors of a page, see memory_planner.
+			 */
+			memory_plan plan_memory(int batch_size = 1, bool keep_alive = false) const {
+				memory_planner planner{cg_, schedule_};
+				planner.batch_size(batch_size).keep_alive(keep_alive);
+				if (keep_alive && checkpointed()) planner.checkpoints(*checkpoints_);
+				return planner.build();
+			}
+
+			/**
+			 * Bytes of the buffers the backward pass recomputes tensors into, see
+			 * segment_recomputer. Not part of plan_memory, they are held by the diff page.
+			 */
+			uint64_t recompute_bytes() const {
+				return checkpointed() ? segment_recomputer::buffer_bytes(cg_, graph_, *checkpoints_) : 0;
+			}
 
 		private:
 			void ensure_resources(exec_params& params) {
@@ -82,32 +147,52 @@ namespace plearn::env {
 				}
 				auto& env_p = batch_pages_.at(params.batch_size);
 				if (params.calc_diffs && !env_p->has_diff_page()) {
-					env_p->set_diff_page(create_diff_page(params.batch_size));
+					//replanned without memory reuse
+					create_env_page(params.batch_size, true);
 				}
 			}
 
 			//create exec page and allocate memory
-			unique_ptr<exec_page> create_exec_page(int batch_size) {
+			unique_ptr<exec_page> create_exec_page(int batch_size, bool keep_alive) {
 				exec_page_resources resources;
+				resources.memory_plan_ = plan_memory(batch_size, keep_alive);
+				auto& plan = resources.memory_plan_;
+				if (plan.arena_size_ > 0)
+					resources.arena_ = env_->create_tensor(shape_t{plan.arena_size_}, tensor_init::zero);
 				for (auto intn_id: cg_.internal_nodes_) {
+					if (plan.views_.contains(intn_id)) continue;
 					auto& node = cg_.flow_nodes_.at(intn_id);
 					auto shape = batch_size == 1 ? node.shape_ :
 						shape_t{batch_size} * node.shape_;
-					resources.internal_tensors_[intn_id] = env_->create_tensor(shape);
+					resources.internal_tensors_[intn_id] = env_->create_view(
+							resources.arena_, plan.blocks_.at(intn_id).offset_, shape);
 				}
-				return std::make_unique<exec_page>(backend_, cg_, std::move(resources));
+				return std::make_unique<exec_page>(env_, graph_, std::move(resources), batch_size);
 			}
 
 			//create diff page and allocate memory
 			unique_ptr<diff_page> create_diff_page(int batch_size) {
+				if (forward_jacobians_) {
+					fw_diff_page_builder builder{cg_, env_};
+					return builder.graph(graph_).jacobians(diff_info_.get()).build();
+				}
+				if (diff_mode_ == diff_mode::jvp) {
+					fw_diff_page_builder builder{cg_, env_};
+					return builder.graph(graph_).directions(directions_).build();
+				}
 				bw_diff_page_builder builder{cg_, diff_info_.get(), backend_};
-				return builder.batch_size(batch_size).build();
+				if (checkpointed())
+					builder.recompute(std::make_unique<segment_recomputer>(cg_, graph_, *checkpoints_, env_));
+				return builder.graph(graph_).batch_size(batch_size).mode(diff_mode_).build();
 			}
 
 
 			//representations
 			const call_graph& cg_;
 			unique_ptr<diff_info> diff_info_;
+			//order of the ops, shared by the pages of every batch size
+			call_graph_schedule schedule_;
+			compiled_graph graph_;
 
 			//resources managed by this section
 			unordered_map<node_id, tensor_p> data_tensors_;
@@ -120,6 +205,13 @@ namespace plearn::env {
 			borrowed_ptr<exec_env> env_;
 			borrowed_ptr<backend_t> backend_;
 
+			diff_mode diff_mode_;
+			//tangents propagated at once in jvp mode
+			uint64_t directions_;
+			bool forward_jacobians_;
+			//internal tensors stored for the backward pass, all of them if not set
+			std::optional<unordered_set<node_id>> checkpoints_;
+
 			friend class EnvSection_Execute_Test;
 	};
 
@@ -134,26 +226,76 @@ namespace plearn::env {
 				return *this;
 			}
 
-			// env_section_builder& create_fp_diff() {
-			// 	diff_env_ = std::make_unique<fp_diff_env>(cg_, diff_info_.get(), backend_);
-			// 	((fp_diff_env*)diff_env_.get())->init();
-			// 	return *this;
-			// }
+			env_section_builder& set_diff_mode(diff_mode mode) {
+				diff_mode_ = mode;
+				return *this;
+			}
+
+			/**
+			 * Tangents propagated by a forward pass in jvp mode.
+			 */
+			env_section_builder& set_directions(uint64_t directions) {
+				directions_ = directions;
+				return *this;
+			}
 
+			/**
+			 * Internal tensors stored for the backward pass, the others are recomputed.
+			 */
+			env_section_builder& set_checkpoints(const vector<node_id>& checkpoints) {
+				checkpoints_ = unordered_set<node_id>(checkpoints.begin(), checkpoints.end());
+				return *this;
+			}
 
+			/**
+			 * Bytes of internal tensors stored for the backward pass, checkpoints are
+			 * selected to fit them if set, see select_checkpoints.
+			 */
+			env_section_builder& set_checkpoint_budget(uint64_t bytes) {
+				checkpoint_budget_ = bytes;
+				return *this;
+			}
+
+			/**
+			 * Data nodes gradients are calculated for, all of them if not set.
+			 * The other data nodes are constants.
+			 */
+			env_section_builder& set_variable_nodes(vector<node_id> variable_nodes) {
+				variable_nodes_ = std::move(variable_nodes);
+				return *this;
+			}
+
+
+			/**
+			 * In automatic mode the Jacobians are accumulated in the direction
+			 * estimate_diff_costs finds cheaper.
+			 */
 			[[nodiscard]]
 			unique_ptr<env_section> build() {
 				create_diff_info();
+				auto mode = diff_mode_;
+				bool forward = false;
+				if (mode == diff_mode::automatic) {
+					forward = estimate_diff_costs(cg_, *diff_info_).prefer_forward();
+					mode = diff_mode::jacobian;
+				}
+				if (!checkpoints_ && checkpoint_budget_)
+					checkpoints_ = select_checkpoints(cg_, compiled_graph{cg_}, *checkpoint_budget_);
+				//storing every tensor saves nothing, and the backward pass keeps its parallel order
+				if (checkpoints_ && std::ranges::all_of(cg_.internal_nodes_,
+							[this](auto id) { return checkpoints_->contains(id); }))
+					checkpoints_.reset();
 				return std::make_unique<env_section>(
 						cg_, std::move(diff_info_),
 						env_, backend_, 
-						data_tensors_);
+						data_tensors_, mode, directions_, forward, std::move(checkpoints_));
 			}
 		private:
 			void create_diff_info() {
 				diff_info_builder builder{cg_};
+				if (variable_nodes_) builder.variable_nodes(*variable_nodes_);
+				else builder.all_data_nodes();
 				diff_info_ = builder
-					.all_data_nodes()
 					.find_dependencies()
 					.build();
 			}
@@ -162,8 +304,13 @@ namespace plearn::env {
 			borrowed_ptr<exec_env> env_;
 			borrowed_ptr<backend_t> backend_;
 			unordered_map<node_id, tensor_p> data_tensors_;
+			std::optional<vector<node_id>> variable_nodes_;
+			std::optional<unordered_set<node_id>> checkpoints_;
+			std::optional<uint64_t> checkpoint_budget_;
 			unique_ptr<diff_info> diff_info_;
 			unique_ptr<diff_page> diff_env_;
+			diff_mode diff_mode_ = diff_mode::jacobian;
+			uint64_t directions_ = 1;
 
 			exec_page_resources resources_;
 
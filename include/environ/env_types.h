@@ -4,12 +4,14 @@
 
 #include <cstdlib>
 #include <exception>
+#include <functional>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
 #include <vector>
 
 #include <rep/rep_types.h>
+#include <rep/views.h>
 #include "rep/call_graph.h"
 
 namespace plearn::env {
@@ -34,18 +36,27 @@ namespace plearn::env {
 	};
 
 
+	/**
+	 * A tensor, or a strided view into the memory of another one.
+	 * The back of a view starts at its first element, strides are in elements.
+	 */
 	class tensor_t {
 		public:
 			const shape_t& shape() const { return shape_; }
+			const shape_dims& strides() const { return strides_; }
+			bool contiguous() const { return contiguous_; }
 			tensor_id id() const { return id_; }
 			borrowed_ptr<tensor_back_t> back() { return back_.get(); }
 			borrowed_ptr<float> data() { return back_->data(); }
 		private:
-			tensor_t(const shape_t& s, tensor_id id, 
+			tensor_t(const shape_t& s, const shape_dims& strides, tensor_id id,
 					unique_ptr<tensor_back_t>&& ten_b) : 
-				shape_{s}, id_{id}, back_{std::move(ten_b)} {}
+				shape_{s}, strides_{strides}, contiguous_{is_contiguous(s, strides)},
+				id_{id}, back_{std::move(ten_b)} {}
 
 			shape_t shape_;
+			shape_dims strides_;
+			bool contiguous_;
 			tensor_id id_;
 			unique_ptr<tensor_back_t> back_;
 			borrowed_ptr<exec_env> env_;
@@ -57,7 +68,11 @@ namespace plearn::env {
 	class tensor_factory {
 		public:
 			tensor_p create(const shape_t& s, unique_ptr<tensor_back_t>&& back) {
-				return tensor_p(new tensor_t{s, next_id(), std::move(back)});
+				return create(s, s.strides(), std::move(back));
+			}
+			tensor_p create(const shape_t& s, const shape_dims& strides,
+					unique_ptr<tensor_back_t>&& back) {
+				return tensor_p(new tensor_t{s, strides, next_id(), std::move(back)});
 			}
 		private:
 			tensor_id next_id() { return id++; }
@@ -82,6 +97,25 @@ namespace plearn::env {
 	/*	} */
 	/*}; */
 
+	/**
+	 * How reverse mode derivatives are represented.
+	 *
+	 * jacobian: for every (node, output) pair a full Jacobian of shape
+	 * node.shape * output.shape is materialized, seeded with the identity.
+	 * vjp: every (node, output) pair holds a cotangent of the node's shape,
+	 * i.e. a vector-Jacobian product seeded with a cotangent of the output's shape.
+	 * jvp: forward mode, every node holds tangents of its shape, i.e. Jacobian-vector
+	 * products seeded with tangents of the data and input nodes.
+	 * automatic: the Jacobians of the data nodes like jacobian mode, accumulated forward
+	 * or reverse, whichever is estimated cheaper, see estimate_diff_costs.
+	 */
+	enum class diff_mode {
+		jacobian,
+		vjp,
+		jvp,
+		automatic,
+	};
+
 	class gradient {
 		public:
 			shape_t in_shape;
@@ -91,8 +125,17 @@ namespace plearn::env {
 
 			shared_ptr<tensor_back_t> back_{};
 			int batch_size{1};
+			diff_mode mode{diff_mode::jacobian};
 
 			borrowed_ptr<float> data() {return back_->data();}
+
+			/**
+			 * Number of columns per input element in the gradient buffer.
+			 * The whole output for a Jacobian, a single one for a VJP.
+			 */
+			uint64_t cols() const {
+				return mode == diff_mode::vjp ? 1 : out_shape.size();
+			}
 	};
 
 	struct node_grad {
@@ -100,8 +143,16 @@ namespace plearn::env {
 		node_id out_id_;
 		gradient grad_;
 		bool identity_{false};
+		//updated in the current pass
+		bool written_{false};
 	};
 	
+	/**
+	 * Tangents of nodes in jvp mode, by node. A tensor holds the tangents of all
+	 * directions one after the other, each of the shape of the node.
+	 */
+	using tangent_map = unordered_map<node_id, tensor_p>;
+
 	using grad_map = unordered_map<node_id, node_grad>;
 	const grad_map empty_grad_map{};
 
@@ -116,26 +167,101 @@ namespace plearn::env {
 	};
 
 
+	class thread_pool;
+
 	struct exec_params {
 		bool calc_diffs{false};
 		int batch_size{1};
+		//independent ops are dispatched to the pool if set, run in schedule order otherwise
+		borrowed_ptr<thread_pool> thread_pool_{nullptr};
 
 		unordered_map<node_id, tensor_p> inputs_{};
 		unordered_map<node_id, tensor_p> outputs_{};
+		//seeds of the output nodes in vjp mode, defaults to ones if missing
+		unordered_map<node_id, tensor_p> cotangents_{};
+		//seeds of the data and input nodes in jvp mode, zero if missing
+		tangent_map tangents_{};
 	};
 
 	struct exec_result {
 		bool success_{true};
 		borrowed_ptr<grad_system> grad_system_{nullptr};
+		//tangents of the output nodes in jvp mode
+		borrowed_ptr<tangent_map> tangents_{nullptr};
 	};
 
 
 
+	/**
+	 * An op bound to the buffers of its arguments, with the dims its kernel needs
+	 * extracted up front. Calling it is one indirect call into the kernel.
+	 * The buffers can be swapped between calls for tensors of the same shapes.
+	 */
+	struct bound_kernel {
+		static constexpr unsigned max_args = 8;
+		using thunk = void (*)(const bound_kernel&);
+
+		thunk fn_{nullptr};
+		float* in_[max_args]{};
+		unsigned args_{0};
+		float* out_{nullptr};
+		uint64_t dims_[3]{};
+		float scale_{1.f};
+		//kernel specific, fx. which inputs are read transposed
+		unsigned flags_{0};
+		read_ptr<operation> op_{nullptr};
+		//for backends wrapping the kernel in fn_, fx. to run it in a context of theirs
+		thunk inner_{nullptr};
+		read_ptr<void> ctx_{nullptr};
+
+		explicit operator bool() const { return fn_ != nullptr; }
+		void operator()() const { fn_(*this); }
+	};
+
 	class op_exec_backend_t {
 		public:
 			virtual void exec_op(const operation& op, 
 					const vector<tensor_p>& inputs, tensor_p& output) = 0;
 
+			/**
+			 * Bind an op to the current buffers of its arguments.
+			 * An empty kernel means the op has to go through exec_op.
+			 */
+			virtual bound_kernel bind_op(const operation& op,
+					const vector<tensor_p>& inputs, const tensor_p& output) {
+				(void)op; (void)inputs; (void)output;
+				return {};
+			}
+
+			/**
+			 * Execute an operation on a batch of samples at once.
+			 * The output and the inputs flagged in `batched` have a leading dimension
+			 * of batch_size, the other inputs are shared by all samples of the batch.
+			 */
+			virtual void exec_batch_op(const operation& op, 
+					const vector<tensor_p>& inputs, tensor_p& output,
+					uint64_t batch_size, const vector<bool>& batched) {
+				(void)op; (void)inputs; (void)output; (void)batch_size; (void)batched;
+				throw std::runtime_error("Batched execution not supported");
+			}
+
+			/**
+			 * Copy a strided tensor into a contiguous one of the same shape.
+			 */
+			virtual void materialize(const tensor_p& view, const tensor_p& dst) {
+				(void)view; (void)dst;
+				throw std::runtime_error("Strided tensors not supported");
+			}
+
+			/**
+			 * Whether the kernel of a single sample op reads input idx through its strides,
+			 * other strided inputs are materialized before the op runs.
+			 */
+			virtual bool reads_strided(const operation& op, unsigned idx, const tensor_p& input) {
+				(void)op; (void)idx; (void)input;
+				return false;
+			}
+
 			virtual ~op_exec_backend_t() = default;
 	};
 
@@ -146,14 +272,15 @@ namespace plearn::env {
 				this->inputs_ = &inputs;
 				this->output_ = &output;
 			}
-			virtual void update_grad_with_identity(unsigned input_idx, 
-					gradient& var_out_grad) { 
-				(void)input_idx;
-				(void)var_out_grad;
-				throw std::runtime_error("unimplemented"); 
-			}
-			virtual void update_grad(unsigned input_idx, 
-					const gradient& var_in_grad, gradient& var_out_grad) = 0;
+			/**
+			 * Propagate tangents through the op, like evaluating it on dual numbers: the
+			 * tangents of the output from the values and the tangents of the inputs.
+			 * Tangents hold `directions` tangents of their node one after the other,
+			 * a null input tangent is zero. The output tangent is overwritten.
+			 */
+			virtual void update_tangent(const vector<tensor_p>& in_tangents,
+					const tensor_p& out_tangent, uint64_t directions) = 0;
+			virtual ~fw_op_diff_backend_t() = default;
 		
 		protected:
 			read_ptr<vector<tensor_p>> inputs_;
@@ -172,8 +299,12 @@ namespace plearn::env {
 			/* 	(void)var_out_grad; */
 			/* 	throw std::runtime_error("unimplemented"); */ 
 			/* } */
+			/**
+			 * Propagate the gradient of the output to an input.
+			 * The first update of in_outn_grad in a pass overwrites it, later ones accumulate.
+			 */
 			virtual void update_grad(unsigned input_idx, 
-					const gradient& out_outn_grad, gradient& in_outn_grad) = 0;
+					const gradient& out_outn_grad, gradient& in_outn_grad, bool accumulate = true) = 0;
 			virtual ~bw_op_diff_backend_t() = default;
 		
 		protected:
@@ -197,43 +328,134 @@ namespace plearn::env {
 			virtual ~fp_diff_backend_t() = default;
 	};
 
+	/**
+	 * Update rule of an optimizer.
+	 * sgd: gradient descent, with momentum if set.
+	 * adam: Adam, the weight decay is added to the gradient.
+	 * adamw: Adam with the weight decay applied to the parameters directly.
+	 */
+	enum class optimizer_type {
+		sgd,
+		adam,
+		adamw,
+	};
+
+	struct optimizer_params {
+		optimizer_type type_{optimizer_type::sgd};
+		float lr_{1e-3f};
+		float momentum_{0.f};
+		float beta1_{0.9f};
+		float beta2_{0.999f};
+		float eps_{1e-8f};
+		float weight_decay_{0.f};
+
+		/**
+		 * Moment buffers kept per parameter.
+		 */
+		unsigned state_count() const {
+			if (type_ == optimizer_type::sgd) return momentum_ != 0.f ? 1 : 0;
+			return 2;
+		}
+	};
+
+	class param_update_backend_t {
+		public:
+			/**
+			 * Update a parameter in place from its gradient, the gradient of a scalar loss.
+			 * state holds the moment buffers of the parameter, step counts the updates from 1.
+			 */
+			virtual void update(const tensor_p& param, gradient& grad,
+					const vector<tensor_p>& state, uint64_t step) = 0;
+			virtual ~param_update_backend_t() = default;
+	};
+
+	class optim_backend_t {
+		public:
+			[[nodiscard]]
+			virtual unique_ptr<param_update_backend_t> create_param_update_backend(
+					const optimizer_params& params) {
+				(void)params;
+				throw std::runtime_error("Optimizers not supported");
+			}
+
+			virtual ~optim_backend_t() = default;
+	};
+
 	enum class tensor_init {
 		no_init,
 		zero,
 		identity
 	};
 
-	class backend_t : public op_exec_backend_t, public fp_diff_backend_t, public bp_diff_backend_t {
+	/**
+	 * Who frees external memory a tensor is created on.
+	 * owned: the tensor deletes it with delete[], it must come from new float[].
+	 * borrowed: the caller keeps it alive as long as any tensor on it and frees it.
+	 */
+	enum class ownership {
+		owned,
+		borrowed
+	};
+
+	//frees external tensor memory once the last tensor on it is gone, empty if borrowed
+	using buffer_deleter = std::function<void(float*)>;
+
+	inline buffer_deleter deleter_of(ownership own) {
+		if (own == ownership::borrowed) return {};
+		return [](float* data) { delete [] data; };
+	}
+
+	class backend_t : public op_exec_backend_t, public fp_diff_backend_t, public bp_diff_backend_t,
+			public optim_backend_t {
 		public:
 			[[nodiscard]]
 			virtual unique_ptr<tensor_back_t> create_tensor(const shape_t& s,
 					tensor_init init=tensor_init::no_init) = 0;
 
+			/**
+			 * A tensor on external memory, owned by the tensor.
+			 */
 			[[nodiscard]]
 			virtual unique_ptr<tensor_back_t> create_tensor(const shape_t& s, float* data) = 0;
 
+			/**
+			 * A tensor on external memory without a copy, deleter frees it once the
+			 * last tensor on it is gone. An empty deleter borrows the memory.
+			 */
+			[[nodiscard]]
+			virtual unique_ptr<tensor_back_t> create_tensor(const shape_t& s, float* data,
+					buffer_deleter deleter) {
+				(void)s; (void)data; (void)deleter;
+				throw std::runtime_error("External tensor memory not supported");
+			}
+
+			/**
+			 * A tensor on the memory of base, starting at element offset.
+			 * The view keeps the memory of base alive.
+			 */
+			[[nodiscard]]
+			virtual unique_ptr<tensor_back_t> create_view(tensor_back_t& base, uint64_t offset,
+					const shape_t& s) {
+				(void)base; (void)offset; (void)s;
+				throw std::runtime_error("Tensor views not supported");
+			}
+
 			virtual ~backend_t() = default;
 	};
 
 
 
 	/**
-	 * Container for all the tensors that are required for call graph executions.
+	 * Container for all the tensors that are required for call graph executions,
+	 * indexed by node id. Its size is fixed, so references to the slots stay valid.
 	 */
 	struct exec_page_tensors {
-		template<typename... Args>
-		exec_page_tensors(
-				const unordered_map<node_id, tensor_p>& tensors,
-				Args&&... other_tens
-
-				) :
-			tensors_{tensors} {
-				(tensors_.insert(other_tens.begin(), other_tens.end()), ...);
+		explicit exec_page_tensors(std::size_t nodes = 0) : tensors_(nodes) {}
 
-			}
-		unordered_map<node_id, tensor_p> tensors_;
+		vector<tensor_p> tensors_;
 
 		tensor_p& operator[](node_id id) { return tensors_[id]; }
+		const tensor_p& operator[](node_id id) const { return tensors_[id]; }
 	};
 
 
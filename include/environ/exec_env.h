@@ -10,6 +10,7 @@
 #include <rep/rep_types.h>
 #include <rep/call_graph.h>
 #include <rep/diff_info.h>
+#include <rep/views.h>
 #include <environ/env_types.h>
 
 namespace plearn::env {
@@ -38,6 +39,78 @@ namespace plearn::env {
 				auto ten_b = backend_->create_tensor(s, data);
 				return tens_fac_.create(s, std::move(ten_b));
 			}
+
+			[[nodiscard]]
+			virtual tensor_p create_tensor(const shape_t& s, float* data, buffer_deleter deleter) {
+				auto ten_b = backend_->create_tensor(s, data, std::move(deleter));
+				return tens_fac_.create(s, std::move(ten_b));
+			}
+
+			[[nodiscard]]
+			virtual tensor_p create_view(const tensor_p& base, uint64_t offset, const shape_t& s) {
+				auto ten_b = backend_->create_view(*base->back(), offset, s);
+				return tens_fac_.create(s, std::move(ten_b));
+			}
+
+			/**
+			 * A strided view into the memory of base, starting `offset` elements after
+			 * the first element of base.
+			 */
+			[[nodiscard]]
+			virtual tensor_p create_view(const tensor_p& base, uint64_t offset, const shape_t& s,
+					const shape_dims& strides) {
+				//the back of a strided view covers the elements from its first to its last one
+				auto back_shape = is_contiguous(s, strides) ? s : shape_t{view_extent(s, strides)};
+				auto ten_b = backend_->create_view(*base->back(), offset, back_shape);
+				return tens_fac_.create(s, strides, std::move(ten_b));
+			}
+
+			/**
+			 * The output of view op `op` on base, sharing its memory. Inputs a view cannot
+			 * be laid over, like a reshape of a transpose, are copied first.
+			 */
+			[[nodiscard]]
+			tensor_p view(const operation& op, const tensor_p& base, const shape_t& s) {
+				auto layout = view_of(op, base->shape(), base->strides(), s);
+				if (layout) return create_view(base, layout->offset_, s, layout->strides_);
+				auto dense = materialize(base);
+				layout = view_of(op, dense->shape(), dense->strides(), s);
+				return create_view(dense, layout->offset_, s, layout->strides_);
+			}
+
+			[[nodiscard]]
+			tensor_p reshape(const tensor_p& base, const shape_t& s) {
+				if (s.size() != base->shape().size()) throw std::runtime_error("Shape mismatch");
+				return view(rep::reshape{}, base, s);
+			}
+
+			[[nodiscard]]
+			tensor_p transpose(const tensor_p& base, const vector<unsigned>& perm) {
+				return view(rep::transpose{perm}, base, transposed_shape(base->shape(), perm));
+			}
+
+			[[nodiscard]]
+			tensor_p slice(const tensor_p& base, int axis, uint64_t begin, uint64_t end) {
+				return view(rep::slice{axis, static_cast<int>(begin)}, base,
+						sliced_shape(base->shape(), axis, begin, end));
+			}
+
+			[[nodiscard]]
+			tensor_p broadcast(const tensor_p& base, const shape_t& s) {
+				if (!broadcastable(base->shape(), s)) throw std::runtime_error("Shape mismatch");
+				return view(rep::broadcast{}, base, s);
+			}
+
+			/**
+			 * A contiguous copy of a strided tensor, contiguous tensors are returned as they are.
+			 */
+			[[nodiscard]]
+			tensor_p materialize(const tensor_p& t) {
+				if (t->contiguous()) return t;
+				auto dense = create_tensor(t->shape());
+				backend_->materialize(t, dense);
+				return dense;
+			}
 		protected:
 
 			tensor_factory tens_fac_{};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+#include <rep/compiled_graph.h>
+#include <rep/diff_info.h>
+#include <environ/env_types.h>
+#include <environ/exec_env.h>
+#include <environ/env_page.h>
+#include <environ/thread_pool.h>
+
+namespace plearn::env {
+
+	/**
+	 * Forward mode differentiation: tangents of the data and input nodes are pushed through
+	 * the ops in schedule order, every op computing the tangent of its output from the values
+	 * and tangents of its inputs. A pass propagates `directions` tangents at once.
+	 * Nodes not reached by a seeded tangent have a zero tangent and their ops are skipped.
+	 *
+	 * With fixed seeds, the page accumulates Jacobians forward: the seeds are identities
+	 * over a direction per variable element, and the Jacobians of grad_system are views
+	 * into the output tangents.
+	 */
+	class fw_diff_page : public diff_page {
+		public:
+			/**
+			 * op_diff_backends are indexed by the ops of graph, tangents by node id and
+			 * allocated for the outputs of the ops.
+			 */
+			fw_diff_page(
+					const call_graph& cg,
+					const compiled_graph& graph,
+					vector<unique_ptr<fw_op_diff_backend_t>>&& op_diff_backends,
+					vector<tensor_p>&& tangents,
+					uint64_t directions,
+					tangent_map&& fixed_seeds = {},
+					grad_system&& grad_system = {}
+					) :
+				cg_(cg), graph_(graph), op_diff_backends_(std::move(op_diff_backends)),
+				tangents_(std::move(tangents)), current_(graph_.node_count()),
+				fixed_seeds_(std::move(fixed_seeds)), grad_system_(std::move(grad_system)),
+				directions_(directions) {
+				for (unsigned idx = 0; idx < graph_.op_count(); ++idx)
+					op_inputs_.emplace_back(graph_.inputs(idx).size());
+				//an op waits for the ops producing its inputs, like in the forward pass
+				vector<int> deps(graph_.op_count(), 0);
+				vector<vector<unsigned>> consumers(graph_.op_count());
+				for (unsigned idx = 0; idx < graph_.op_count(); ++idx) {
+					auto next = graph_.consumers(idx);
+					consumers[idx].assign(next.begin(), next.end());
+					for (auto consumer: next) deps[consumer]++;
+				}
+				fw_deps_ = task_graph{std::move(deps), std::move(consumers)};
+				for (auto& [id, _]: cg_.data_nodes_) seeded_.push_back(id);
+				for (auto id: cg_.in_nodes_) seeded_.push_back(id);
+			}
+
+			/**
+			 * Start a pass: every tangent is zero.
+			 */
+			void reset() override {
+				std::fill(current_.begin(), current_.end(), nullptr);
+			}
+
+			/**
+			 * Take the tangents of the data and input nodes from the params,
+			 * unless the seeds are fixed.
+			 */
+			void seed(const exec_params& params) override {
+				reset();
+				auto& seeds = fixed_seeds_.empty() ? params.tangents_ : fixed_seeds_;
+				for (auto id: seeded_) {
+					if (!seeds.contains(id)) continue;
+					auto& tangent = seeds.at(id);
+					if (tangent->shape().size() != graph_.shape(id).size() * directions_)
+						throw std::runtime_error("Tangent shape mismatch");
+					current_[id] = tangent;
+				}
+			}
+
+			/**
+			 * With a thread pool, an op is dispatched as soon as the ops producing its
+			 * inputs finished.
+			 */
+			void calc_diffs(exec_page_tensors& tensors, borrowed_ptr<thread_pool> pool) override {
+				if (pool && graph_.op_count() > 1) {
+					fw_deps_.run(*pool, [this, &tensors] (unsigned idx) { calc_diff(idx, tensors); });
+				} else {
+					for (unsigned idx = 0; idx < graph_.op_count(); ++idx) calc_diff(idx, tensors);
+				}
+				outputs_.clear();
+				for (auto outn_id: cg_.out_nodes_) {
+					auto& tangent = tangents_[outn_id];
+					if (!current_[outn_id]) tangent->back()->zero();
+					outputs_[outn_id] = tangent;
+				}
+			}
+
+			borrowed_ptr<grad_system> get_grad_system() override {
+				return fixed_seeds_.empty() ? nullptr : &grad_system_;
+			}
+
+			borrowed_ptr<tangent_map> get_tangents() override { return &outputs_; }
+
+		private:
+			//the tangent of the output of op idx, skipped if no input has one
+			void calc_diff(unsigned idx, exec_page_tensors& tensors) {
+				auto in_ids = graph_.inputs(idx);
+				auto& inputs = op_inputs_[idx].values_;
+				auto& in_tangents = op_inputs_[idx].tangents_;
+				bool reached = false;
+				for (unsigned in_idx = 0; in_idx < in_ids.size(); ++in_idx) {
+					inputs[in_idx] = tensors[in_ids[in_idx]];
+					in_tangents[in_idx] = current_[in_ids[in_idx]];
+					reached |= in_tangents[in_idx] != nullptr;
+				}
+				if (!reached) return;
+				auto out_id = graph_.output(idx);
+				auto& backend = op_diff_backends_[idx];
+				backend->reset(inputs, tensors[out_id]);
+				backend->update_tangent(in_tangents, tangents_[out_id], directions_);
+				current_[out_id] = tangents_[out_id];
+			}
+
+			struct op_args {
+				explicit op_args(std::size_t count) : values_(count), tangents_(count) {}
+
+				vector<tensor_p> values_;
+				vector<tensor_p> tangents_;
+			};
+
+			//representations
+			const call_graph& cg_;
+			compiled_graph graph_;
+
+			//calculating components, by op of graph_
+			vector<unique_ptr<fw_op_diff_backend_t>> op_diff_backends_;
+			vector<op_args> op_inputs_;
+			//ops wait for the ops producing their inputs
+			task_graph fw_deps_;
+
+			//held resources, by node id
+			vector<tensor_p> tangents_;
+			//tangents of the current pass, null where zero
+			vector<tensor_p> current_;
+			tangent_map outputs_;
+			vector<node_id> seeded_;
+			tangent_map fixed_seeds_;
+			grad_system grad_system_;
+
+			uint64_t directions_;
+	};
+
+
+	class fw_diff_page_builder {
+		public:
+			fw_diff_page_builder(const call_graph& cg, borrowed_ptr<exec_env> env) :
+				cg_(cg), env_(env) {}
+
+			/**
+			 * Tangents propagated by a pass.
+			 */
+			fw_diff_page_builder& directions(uint64_t directions) {
+				if (directions == 0) throw std::runtime_error("Invalid direction count");
+				directions_ = directions;
+				return *this;
+			}
+
+			/**
+			 * Accumulate the Jacobians of the outputs wrt the variables of info forward,
+			 * the directions are the elements of the variables some output depends on.
+			 */
+			fw_diff_page_builder& jacobians(read_ptr<diff_info> info) {
+				info_ = info;
+				return *this;
+			}
+
+			/**
+			 * The compiled form of the graph, compiled by the builder if not set.
+			 */
+			fw_diff_page_builder& graph(const compiled_graph& graph) {
+				graph_ = graph;
+				return *this;
+			}
+
+			unique_ptr<fw_diff_page> build() {
+				if (!graph_) graph_ = compiled_graph{cg_};
+				//first direction of every variable
+				vector<std::pair<node_id, uint64_t>> offsets;
+				if (info_) {
+					uint64_t directions = 0;
+					for (auto varn_id: info_->variable_nodes()) {
+						if (!info_->dependencies().at(varn_id).any_output_dependant()) continue;
+						offsets.emplace_back(varn_id, directions);
+						directions += graph_->shape(varn_id).size();
+					}
+					directions_ = std::max<uint64_t>(directions, 1);
+				}
+				auto backend = env_->backend();
+				vector<unique_ptr<fw_op_diff_backend_t>> op_diff_backends;
+				vector<tensor_p> tangents(graph_->node_count());
+				for (unsigned idx = 0; idx < graph_->op_count(); ++idx) {
+					op_diff_backends.push_back(backend->create_op_fw_diff_backend(graph_->op(idx).op_));
+					auto out_id = graph_->output(idx);
+					tangents[out_id] = env_->create_tensor(
+							shape_t{directions_} * graph_->shape(out_id));
+				}
+
+				tangent_map seeds;
+				grad_system grads;
+				for (auto [varn_id, offset]: offsets) {
+					auto& var_shape = graph_->shape(varn_id);
+					auto size = var_shape.size();
+					auto& seed = seeds[varn_id] = env_->create_tensor(
+							shape_t{directions_} * var_shape, tensor_init::zero);
+					for (uint64_t i = 0; i < size; ++i) seed->data()[(offset + i)*size + i] = 1.f;
+					//the rows of the variable in the Jacobians of the outputs
+					for (auto outn_id: cg_.out_nodes_) {
+						if (!info_->dependencies().at(varn_id).output_dependant(outn_id)) continue;
+						auto& out_shape = graph_->shape(outn_id);
+						auto back = backend->create_view(*tangents[outn_id]->back(),
+								offset*out_shape.size(), shape_t{size*out_shape.size()});
+						grads[varn_id][outn_id] = {varn_id, outn_id,
+							{var_shape, out_shape, shared_ptr<tensor_back_t>(back.release())}, false};
+					}
+				}
+				return std::make_unique<fw_diff_page>(cg_, *graph_,
+						std::move(op_diff_backends), std::move(tangents), directions_,
+						std::move(seeds), std::move(grads));
+			}
+
+		private:
+			const call_graph& cg_;
+			borrowed_ptr<exec_env> env_;
+
+			std::optional<compiled_graph> graph_;
+			read_ptr<diff_info> info_{nullptr};
+			uint64_t directions_ = 1;
+	};
+
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <rep/call_graph.h>
+#include <rep/call_graph_runner.h>
+#include <rep/ops.h>
+#include <environ/env_types.h>
+
+namespace plearn::env {
+
+	/**
+	 * Placement of the internal tensors of a call graph in one arena.
+	 * Offsets and sizes are in elements.
+	 */
+	struct memory_plan {
+		struct block {
+			uint64_t offset_;
+			uint64_t size_;
+
+			bool overlaps(const block& other) const {
+				return offset_ < other.offset_ + other.size_ && other.offset_ < offset_ + size_;
+			}
+		};
+
+		unordered_map<node_id, block> blocks_;
+		uint64_t arena_size_{0};
+		//internal tensors laid over the memory of the input of their view op, they have no block
+		unordered_set<node_id> views_;
+
+		uint64_t peak_bytes() const { return arena_size_ * sizeof(float); }
+
+		/**
+		 * Bytes needed without reuse, i.e. one buffer per tensor.
+		 */
+		uint64_t unplanned_bytes() const {
+			uint64_t size = 0;
+			for (auto& [_, b]: blocks_) size += b.size_;
+			return size * sizeof(float);
+		}
+	};
+
+
+	/**
+	 * Plans the memory of the internal tensors of a call graph from their lifetimes
+	 * in a schedule. Tensors that are not alive at the same time share memory, the output of
+	 * an elementwise op takes over the buffer of an input it is the last consumer of.
+	 * Outputs of view ops get no memory, the tensor they view lives as long as they are used.
+	 * Tensors kept alive are all planned, since backward kernels read them contiguously.
+	 * With checkpoints, only those are kept alive, the other tensors are recomputed by the
+	 * backward pass and share memory like in a forward pass.
+	 */
+	class memory_planner {
+		public:
+			memory_planner(const call_graph& cg, const call_graph_schedule& schedule) :
+				cg_{cg}, schedule_{schedule} {}
+
+			memory_planner& batch_size(int batch_size) {
+				batch_size_ = batch_size;
+				return *this;
+			}
+
+			/**
+			 * Keep every tensor alive for the whole execution, fx. for a backward pass.
+			 */
+			memory_planner& keep_alive(bool keep_alive) {
+				keep_alive_ = keep_alive;
+				return *this;
+			}
+
+			/**
+			 * Keep only these tensors alive for the whole execution.
+			 */
+			memory_planner& checkpoints(const unordered_set<node_id>& checkpoints) {
+				keep_alive_ = true;
+				checkpoints_ = &checkpoints;
+				return *this;
+			}
+
+			memory_plan build() {
+				find_lifetimes();
+				if (!keep_alive_ || checkpoints_) share_inplace();
+				return place();
+			}
+
+		private:
+			//offsets are aligned to 32 bytes
+			static constexpr uint64_t alignment = 8;
+
+			struct lifetime {
+				unsigned first_;
+				unsigned last_;
+				uint64_t size_;
+				//tensor whose buffer is taken over
+				node_id group_;
+			};
+
+			void find_lifetimes() {
+				auto& ops = schedule_.ops();
+				for (auto intn_id: cg_.internal_nodes_) {
+					auto size = cg_.flow_nodes_.at(intn_id).shape_.size() * batch_size_;
+					lifetimes_[intn_id] = {0, static_cast<unsigned>(ops.size()), size, intn_id};
+				}
+				if (keep_alive_ && !checkpoints_) return;
+				//with checkpoints, views are planned as well, the backward pass reads them contiguously
+				for (auto opn: ops) {
+					if (keep_alive_ || !is_view(opn->op_.type_) || !lifetimes_.contains(opn->out_)) continue;
+					lifetimes_.erase(opn->out_);
+					viewed_[opn->out_] = opn->inputs_[0];
+				}
+				for (unsigned idx = 0; idx < ops.size(); ++idx) {
+					if (lifetimes_.contains(ops[idx]->out_)) {
+						auto& l = lifetimes_.at(ops[idx]->out_);
+						l.first_ = l.last_ = idx;
+					}
+				}
+				for (unsigned idx = 0; idx < ops.size(); ++idx) {
+					for (auto in_id: ops[idx]->inputs_) {
+						auto root = root_of(in_id);
+						if (lifetimes_.contains(root))
+							lifetimes_.at(root).last_ = std::max(lifetimes_.at(root).last_, idx);
+					}
+				}
+				if (!checkpoints_) return;
+				for (auto id: *checkpoints_) {
+					if (lifetimes_.contains(id)) lifetimes_.at(id).last_ = ops.size();
+				}
+			}
+
+			//the tensor whose memory a view is laid over
+			node_id root_of(node_id id) const {
+				while (viewed_.contains(id)) id = viewed_.at(id);
+				return id;
+			}
+
+			node_id group_of(node_id id) {
+				while (lifetimes_.at(id).group_ != id) id = lifetimes_.at(id).group_;
+				return id;
+			}
+
+			void share_inplace() {
+				auto& ops = schedule_.ops();
+				for (unsigned idx = 0; idx < ops.size(); ++idx) {
+					auto& opn = *ops[idx];
+					if (!is_elementwise(opn.op_.type_) || !lifetimes_.contains(opn.out_)) continue;
+					auto& out = lifetimes_.at(opn.out_);
+					for (auto in_id: opn.inputs_) {
+						if (!lifetimes_.contains(in_id)) continue;
+						auto& in = lifetimes_.at(in_id);
+						//the same tensor may be both inputs
+						bool single_use = std::ranges::count(opn.inputs_, in_id) == 1;
+						if (in.last_ != idx || in.size_ != out.size_ || !single_use) continue;
+						//the input was not taken over by another tensor yet
+						auto group = group_of(in_id);
+						if (lifetimes_.at(group).last_ != idx) continue;
+						out.group_ = group;
+						lifetimes_.at(group).last_ = out.last_;
+						break;
+					}
+				}
+			}
+
+			memory_plan place() {
+				//groups, largest first
+				vector<node_id> groups;
+				for (auto& [id, l]: lifetimes_) {
+					if (l.group_ == id) groups.push_back(id);
+				}
+				std::ranges::sort(groups, [this](node_id a, node_id b) {
+					auto& la = lifetimes_.at(a);
+					auto& lb = lifetimes_.at(b);
+					if (la.size_ != lb.size_) return la.size_ > lb.size_;
+					return a < b;
+				});
+
+				memory_plan plan;
+				for (auto& [id, _]: viewed_) plan.views_.insert(id);
+				unordered_map<node_id, memory_plan::block> group_blocks;
+				vector<node_id> placed;
+				for (auto group: groups) {
+					auto& l = lifetimes_.at(group);
+					//blocks of placed groups alive at the same time, by offset
+					vector<memory_plan::block> alive;
+					for (auto other: placed) {
+						auto& o = lifetimes_.at(other);
+						if (o.first_ <= l.last_ && l.first_ <= o.last_)
+							alive.push_back(group_blocks.at(other));
+					}
+					std::ranges::sort(alive, {}, &memory_plan::block::offset_);
+					//first gap that fits
+					uint64_t offset = 0;
+					for (auto& b: alive) {
+						if (b.offset_ >= offset + l.size_) break;
+						offset = std::max(offset, align(b.offset_ + b.size_));
+					}
+					group_blocks[group] = {offset, l.size_};
+					placed.push_back(group);
+					plan.arena_size_ = std::max(plan.arena_size_, offset + l.size_);
+				}
+				for (auto& [id, l]: lifetimes_) {
+					plan.blocks_[id] = {group_blocks.at(group_of(id)).offset_, l.size_};
+				}
+				return plan;
+			}
+
+			static uint64_t align(uint64_t offset) {
+				return (offset + alignment - 1) / alignment * alignment;
+			}
+
+			const call_graph& cg_;
+			const call_graph_schedule& schedule_;
+			int batch_size_ = 1;
+			bool keep_alive_ = false;
+			read_ptr<unordered_set<node_id>> checkpoints_{nullptr};
+
+			unordered_map<node_id, lifetime> lifetimes_;
+			//view outputs and the tensor they view
+			unordered_map<node_id, node_id> viewed_;
+	};
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <environ/env_types.h>
+#include <environ/exec_env.h>
+#include <environ/env_section.h>
+
+namespace plearn::env {
+
+	/**
+	 * Updates the data tensors of a section from the gradients of a loss, in place.
+	 * The moment buffers of a data tensor are created, zeroed, on its first update.
+	 * Data tensors without a gradient of the loss, fx. frozen ones, are left as they are.
+	 */
+	class optimizer {
+		public:
+			optimizer(borrowed_ptr<exec_env> env, const optimizer_params& params) :
+				env_(env), params_(params),
+				backend_(env->backend()->create_param_update_backend(params)) {}
+
+			/**
+			 * One update of every data tensor with a gradient wrt loss_id.
+			 */
+			void step(env_section& section, grad_system& grads, node_id loss_id) {
+				step_++;
+				for (auto& [datan_id, grad_map]: grads) {
+					if (!grad_map.contains(loss_id) || !section.has_data_tensor(datan_id)) continue;
+					auto& grad = grad_map.at(loss_id).grad_;
+					if (!grad.back_) continue;
+					auto& param = section.get_data_tensor(datan_id);
+					auto& state = state_[datan_id];
+					if (state.size() != params_.state_count()) {
+						state.clear();
+						for (unsigned i = 0; i < params_.state_count(); ++i)
+							state.push_back(env_->create_tensor(param->shape(), tensor_init::zero));
+					}
+					backend_->update(param, grad, state, step_);
+				}
+			}
+
+			//learning rate of the next updates, fx. for a schedule
+			void set_lr(float lr) {
+				params_.lr_ = lr;
+				backend_ = env_->backend()->create_param_update_backend(params_);
+			}
+
+			const optimizer_params& params() const { return params_; }
+			uint64_t steps() const { return step_; }
+
+		private:
+			borrowed_ptr<exec_env> env_;
+			optimizer_params params_;
+			unique_ptr<param_update_backend_t> backend_;
+
+			uint64_t step_{0};
+			//moment buffers by data node
+			unordered_map<node_id, vector<tensor_p>> state_;
+	};
+
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace plearn::env {
+
+	using std::vector;
+	using std::unique_ptr;
+
+	/**
+	 * A pool of worker threads with one task queue per worker.
+	 * Workers take their own tasks LIFO and steal the oldest tasks of other workers
+	 * when their queue is empty.
+	 * Tasks submitted from a worker go to the queue of that worker.
+	 */
+	class thread_pool {
+		public:
+			using task = std::function<void()>;
+
+			explicit thread_pool(unsigned threads = std::thread::hardware_concurrency()) {
+				if (threads == 0) threads = 1;
+				for (unsigned idx = 0; idx < threads; ++idx) {
+					queues_.push_back(std::make_unique<task_queue>());
+				}
+				for (unsigned idx = 0; idx < threads; ++idx) {
+					threads_.emplace_back([this, idx] { work(idx); });
+				}
+			}
+
+			thread_pool(const thread_pool&) = delete;
+			thread_pool& operator=(const thread_pool&) = delete;
+
+			~thread_pool() {
+				{
+					std::lock_guard lock{mutex_};
+					stop_ = true;
+				}
+				wake_.notify_all();
+				for (auto& thread: threads_) thread.join();
+			}
+
+			void submit(task t) {
+				auto idx = current_pool_ == this ? current_idx_ :
+					next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+				{
+					auto& queue = *queues_[idx];
+					std::lock_guard lock{queue.mutex_};
+					queue.tasks_.push_back(std::move(t));
+					//counted before the queue is released, a take of the task cannot precede it.
+					//Taken so that a worker cannot miss the wake up between its check and its wait
+					std::lock_guard pending_lock{mutex_};
+					pending_++;
+				}
+				wake_.notify_one();
+			}
+
+			unsigned size() const { return threads_.size(); }
+
+			/**
+			 * Whether the calling thread is a worker of this pool.
+			 */
+			bool in_worker() const { return current_pool_ == this; }
+
+			/**
+			 * Whether the calling thread is a worker of any pool.
+			 */
+			static bool on_worker_thread() { return current_pool_ != nullptr; }
+
+			/**
+			 * Run one queued task on the calling thread, so that a thread waiting on tasks
+			 * of the pool can help with them. Returns false if there was none.
+			 */
+			bool run_one() {
+				task t;
+				if (!pop(current_pool_ == this ? current_idx_ : 0, t)) return false;
+				t();
+				return true;
+			}
+
+		private:
+			struct task_queue {
+				std::mutex mutex_;
+				std::deque<task> tasks_;
+			};
+
+			void work(unsigned idx) {
+				current_pool_ = this;
+				current_idx_ = idx;
+				while (true) {
+					{
+						std::unique_lock lock{mutex_};
+						wake_.wait(lock, [this] { return stop_ || pending_ > 0; });
+						if (pending_ == 0) return; //stopped
+					}
+					task t;
+					if (pop(idx, t)) {
+						t();
+					}
+				}
+			}
+
+			bool pop(unsigned idx, task& t) {
+				//own queue first, newest task
+				if (take(*queues_[idx], t, true)) return true;
+				//steal the oldest task of the other workers
+				for (unsigned off = 1; off < queues_.size(); ++off) {
+					if (take(*queues_[(idx + off) % queues_.size()], t, false)) return true;
+				}
+				return false;
+			}
+
+			bool take(task_queue& queue, task& t, bool back) {
+				std::lock_guard lock{queue.mutex_};
+				if (queue.tasks_.empty()) return false;
+				if (back) {
+					t = std::move(queue.tasks_.back());
+					queue.tasks_.pop_back();
+				} else {
+					t = std::move(queue.tasks_.front());
+					queue.tasks_.pop_front();
+				}
+				std::lock_guard pending_lock{mutex_};
+				pending_--;
+				return true;
+			}
+
+			vector<unique_ptr<task_queue>> queues_;
+			vector<std::thread> threads_;
+
+			std::mutex mutex_;
+			std::condition_variable wake_;
+			//tasks in the queues
+			std::size_t pending_{0};
+			bool stop_{false};
+
+			std::atomic<unsigned> next_{0};
+
+			//worker identity of the calling thread
+			static inline thread_local const thread_pool* current_pool_{nullptr};
+			static inline thread_local unsigned current_idx_{0};
+	};
+
+
+	/**
+	 * Tasks indexed 0..n-1 with dependencies between them.
+	 * A run dispatches every task to a pool as soon as the tasks it depends on finished,
+	 * and waits until all tasks finished.
+	 */
+	class task_graph {
+		public:
+			task_graph() = default;
+
+			/**
+			 * deps: number of tasks each task waits for (one per edge),
+			 * next: tasks released by each task.
+			 */
+			task_graph(vector<int>&& deps, vector<vector<unsigned>>&& next) :
+				deps_{std::move(deps)}, next_{std::move(next)}, pending_(deps_.size()) {}
+
+			std::size_t size() const { return deps_.size(); }
+
+			/**
+			 * Run the tasks on the pool. The first exception thrown by a task is rethrown,
+			 * the tasks released after it are skipped.
+			 */
+			template<typename Callable>
+				void run(thread_pool& pool, Callable&& task)
+				requires std::invocable<Callable, unsigned>
+				{
+					if (deps_.empty()) return;
+					run_state<Callable> run{task, deps_.size()};
+					for (unsigned idx = 0; idx < deps_.size(); ++idx) {
+						pending_[idx].store(deps_[idx], std::memory_order_relaxed);
+					}
+					for (unsigned idx = 0; idx < deps_.size(); ++idx) {
+						if (deps_[idx] == 0) dispatch(pool, run, idx);
+					}
+
+					std::unique_lock lock{run.mutex_};
+					run.done_.wait(lock, [&run] { return run.finished_; });
+					if (run.error_) std::rethrow_exception(run.error_);
+				}
+
+		private:
+			template<typename Callable>
+			struct run_state {
+				Callable& task_;
+				std::atomic<std::size_t> remaining_;
+				std::mutex mutex_{};
+				std::condition_variable done_{};
+				bool finished_{false};
+				std::exception_ptr error_{};
+				std::atomic<bool> failed_{false};
+			};
+
+			template<typename Callable>
+			void dispatch(thread_pool& pool, run_state<Callable>& run, unsigned idx) {
+				pool.submit([this, &pool, &run, idx] {
+					if (!run.failed_.load(std::memory_order_acquire)) {
+						try {
+							run.task_(idx);
+						} catch (...) {
+							std::lock_guard lock{run.mutex_};
+							if (!run.error_) run.error_ = std::current_exception();
+							run.failed_.store(true, std::memory_order_release);
+						}
+					}
+					for (auto next: next_[idx]) {
+						if (pending_[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+							dispatch(pool, run, next);
+					}
+					if (run.remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+						std::lock_guard lock{run.mutex_};
+						run.finished_ = true;
+						run.done_.notify_all();
+					}
+				});
+			}
+
+			vector<int> deps_;
+			vector<vector<unsigned>> next_;
+			vector<std::atomic<int>> pending_;
+	};
+
+}
@@ -10,7 +10,7 @@ namespace plearn::model {
 	class ExecEnvProvider {
 		public:
 			static borrowed_ptr<exec_env> get_exec_env() {
-				static backend::cpu::cpu_backend backend_ = backend::cpu::cpu_backend();
+				static backend::cpu::cpu_backend backend_{};
 				static exec_env exec_env_ = exec_env(&backend_);
 				return &exec_env_;
 			}
@@ -29,10 +29,52 @@ namespace plearn::model {
 				return tensors_.exec_env_->create_tensor(shape);
 			}
 
+			/**
+			 * A tensor on data without a copy. Owned data must come from new float[],
+			 * borrowed data must outlive every tensor on it, fx. the results of executions.
+			 */
 			[[nodiscard]]
-			static tensor_p create(shape_t shape, float* data) {
+			static tensor_p create(shape_t shape, float* data, ownership own = ownership::owned) {
 				static Tensors tensors_;
-				return tensors_.exec_env_->create_tensor(shape, data);
+				return tensors_.exec_env_->create_tensor(shape, data, deleter_of(own));
+			}
+
+			/**
+			 * A tensor on data without a copy, deleter frees it when the last tensor on it is gone.
+			 */
+			[[nodiscard]]
+			static tensor_p create(shape_t shape, float* data, buffer_deleter deleter) {
+				static Tensors tensors_;
+				return tensors_.exec_env_->create_tensor(shape, data, std::move(deleter));
+			}
+
+			/**
+			 * Views sharing the memory of t, see exec_env::view. Kernels read strided
+			 * views through a contiguous copy, unless they take their strides.
+			 */
+			[[nodiscard]]
+			static tensor_p reshape(const tensor_p& t, const shape_t& shape) {
+				return ExecEnvProvider::get_exec_env()->reshape(t, shape);
+			}
+
+			[[nodiscard]]
+			static tensor_p transpose(const tensor_p& t, const vector<unsigned>& perm) {
+				return ExecEnvProvider::get_exec_env()->transpose(t, perm);
+			}
+
+			[[nodiscard]]
+			static tensor_p slice(const tensor_p& t, int axis, uint64_t begin, uint64_t end) {
+				return ExecEnvProvider::get_exec_env()->slice(t, axis, begin, end);
+			}
+
+			[[nodiscard]]
+			static tensor_p broadcast(const tensor_p& t, const shape_t& shape) {
+				return ExecEnvProvider::get_exec_env()->broadcast(t, shape);
+			}
+
+			[[nodiscard]]
+			static tensor_p materialize(const tensor_p& t) {
+				return ExecEnvProvider::get_exec_env()->materialize(t);
 			}
 		private:
 			borrowed_ptr<exec_env> exec_env_;
@@ -7,6 +7,7 @@ namespace plearn::model {
 
 	struct DenseLayerArgs {
 		bool use_bias{true};
+		activation act{activation::none};
 	};
 
 
@@ -17,19 +18,18 @@ namespace plearn::model {
 				: model_(input->model()), input_(input), output_size_(output_size) {
 					model_.unset_output(input);
 					A_ = model_.add_variable({input->shape()[0], output_size});
-					flow1_ = input_.vecmatmul(A_);
 					if (args.use_bias) {
 						b_ = model_.add_variable({output_size});
-						flow2_ = flow1_ + b_;
+						flow_ = input_.dense(A_, b_, args.act);
 					} else {
-						flow2_ = flow1_;
+						flow_ = input_.dense(A_, args.act);
 					}
-					model_.set_output(flow2_);
+					model_.set_output(flow_);
 					model_.commit();
 				}
 
 			[[nodiscard]]
-			Model::ModelTensor output() const { return flow2_; }
+			Model::ModelTensor output() const { return flow_; }
 
 			void set_tensors(tensor_p A, tensor_p b) {
 				A_.set_tensor(A);
@@ -49,7 +49,7 @@ namespace plearn::model {
 			Model::ModelTensor A_;
 			Model::ModelTensor b_;
 
-			Model::ModelTensor flow1_, flow2_;
+			Model::ModelTensor flow_;
 
 			int output_size_;
 	};
@@ -2,11 +2,16 @@
 
 #include "environ/exec_env.h"
 #include "rep/call_graph.h"
+#include "rep/fusion.h"
 #include "rep/ops.h"
 #include "rep/rep_types.h"
+#include "rep/views.h"
+#include <algorithm>
 #include <cstdint>
 #include <environ/env_types.h>
 #include <environ/env_section.h>
+#include <environ/optimizer.h>
+#include <environ/thread_pool.h>
 #include <memory>
 #include <model/exec_env_provider.h>
 #include <stdexcept>
@@ -26,6 +31,7 @@ namespace plearn::model {
 				node_id id() const { return id_; }
 				Model& model() const { return model_; }
 				const shape_t& shape() const { return shape_; }
+				bool requires_grad() const { return requires_grad_; }
 
 			private:
 				ModelTensorT(const shape_t& shape, Model& model, node_id id) 
@@ -37,6 +43,10 @@ namespace plearn::model {
 
 				//is data node or flow node
 				bool internal_ = false;
+				//variables only, frozen ones get no gradient
+				bool requires_grad_ = true;
+				//stored for the backward pass when checkpointing
+				bool checkpoint_ = false;
 
 				friend class Model;
 				friend class ModelTensor;
@@ -109,6 +119,22 @@ namespace plearn::model {
 						return get()->model_.add_operation(rep::vecmatmul{}, out_shape, *this, other);
 					}
 
+				/**
+				 * act(this A + b) as a single op, see rep::dense.
+				 */
+				[[nodiscard]]
+					ModelTensor dense(const ModelTensor& A, const ModelTensor& b,
+							activation act = activation::none) const {
+						auto out_shape = dense_shape(A);
+						if (b->shape_ != out_shape) throw std::runtime_error("Shape mismatch");
+						return get()->model_.add_operation(rep::dense{act}, out_shape, *this, A, b);
+					}
+
+				[[nodiscard]]
+					ModelTensor dense(const ModelTensor& A, activation act = activation::none) const {
+						return get()->model_.add_operation(rep::dense{act}, dense_shape(A), *this, A);
+					}
+
 				[[nodiscard]]
 					ModelTensor square() const {
 						return get()->model_.add_operation(rep::square{}, get()->shape_, *this);
@@ -116,34 +142,109 @@ namespace plearn::model {
 
 				[[nodiscard]]
 					ModelTensor reduce_sum(int axis) const {
-						if (axis < 0 || axis >= get()->shape_.rank)
-							throw std::runtime_error("Invalid axis");
-						vector<uint64_t> dims;
-						for (int i = 0; i < get()->shape_.rank; ++i) {
-							if (i != axis) dims.push_back(get()->shape_.dims[i]);
-						}
-						shape_t out_shape{dims};
-						return get()->model_.add_operation(rep::reduce_sum(axis), out_shape, *this);
+						return reduce_sum(vector<int>{axis});
+					}
+
+				[[nodiscard]]
+					ModelTensor reduce_sum(const vector<int>& axes) const {
+						return get()->model_.add_operation(rep::reduce_sum(axes), reduced_shape(axes), *this);
 					}
 
 				[[nodiscard]]
 					ModelTensor reduce_mean(int axis) const {
-						if (axis < 0 || axis >= get()->shape_.rank)
-							throw std::runtime_error("Invalid axis");
-						vector<uint64_t> dims;
-						for (int i = 0; i < get()->shape_.rank; ++i) {
-							if (i != axis) dims.push_back(get()->shape_.dims[i]);
-						}
-						shape_t out_shape{dims};
-						return get()->model_.add_operation(rep::reduce_mean(axis), out_shape, *this);
+						return reduce_mean(vector<int>{axis});
+					}
+
+				[[nodiscard]]
+					ModelTensor reduce_mean(const vector<int>& axes) const {
+						return get()->model_.add_operation(rep::reduce_mean(axes), reduced_shape(axes), *this);
+					}
+
+				/**
+				 * The same elements in another shape. Like the other views, it is laid over
+				 * the memory of this tensor where the execution allows it.
+				 */
+				[[nodiscard]]
+					ModelTensor reshape(const shape_t& shape) const {
+						if (shape.size() != get()->shape_.size()) throw std::runtime_error("Shape mismatch");
+						return get()->model_.add_operation(rep::reshape{}, shape, *this);
+					}
+
+				/**
+				 * Axis i of the result is axis perm[i] of this tensor.
+				 */
+				[[nodiscard]]
+					ModelTensor transpose(const vector<unsigned>& perm) const {
+						auto shape = transposed_shape(get()->shape_, perm);
+						return get()->model_.add_operation(rep::transpose{perm}, shape, *this);
+					}
+
+				[[nodiscard]]
+					ModelTensor transpose() const {
+						if (get()->shape_.rank != 2) throw std::runtime_error("Not a matrix");
+						return transpose({1, 0});
+					}
+
+				/**
+				 * Indices [begin, end) of an axis.
+				 */
+				[[nodiscard]]
+					ModelTensor slice(int axis, uint64_t begin, uint64_t end) const {
+						auto shape = sliced_shape(get()->shape_, axis, begin, end);
+						return get()->model_.add_operation(rep::slice{axis, static_cast<int>(begin)},
+								shape, *this);
 					}
 
+				/**
+				 * This tensor repeated to shape, see rep::broadcast.
+				 */
+				[[nodiscard]]
+					ModelTensor broadcast(const shape_t& shape) const {
+						if (!broadcastable(get()->shape_, shape)) throw std::runtime_error("Shape mismatch");
+						return get()->model_.add_operation(rep::broadcast{}, shape, *this);
+					}
 
 				void set_tensor(tensor_p t) { 
 					get()->model_.set_variable_tensor(*this, t); }
 
+				/**
+				 * Whether gradients are calculated for this variable, before compiling.
+				 */
+				void set_requires_grad(bool requires_grad) {
+					get()->model_.set_requires_grad(*this, requires_grad); }
+
+				void freeze() { set_requires_grad(false); }
+
+				/**
+				 * Store this tensor for the backward pass, before compiling.
+				 * Once a tensor is checkpointed, the intermediate tensors that are not
+				 * are recomputed by the backward pass.
+				 */
+				void checkpoint() { get()->model_.set_checkpoint(*this); }
+
 			private:
 				ModelTensor(ModelTensorT* t) : shared_ptr<ModelTensorT>(t) {}
+
+				shape_t dense_shape(const ModelTensor& A) const {
+					auto& shape = get()->shape_;
+					if (shape.rank != 1 || A->shape_.rank != 2 || shape.dims[0] != A->shape_.dims[0])
+						throw std::runtime_error("Shape mismatch");
+					return shape_t{A->shape_.dims[1]};
+				}
+
+				shape_t reduced_shape(const vector<int>& axes) const {
+					auto& shape = get()->shape_;
+					if (axes.empty()) throw std::runtime_error("Invalid axis");
+					for (auto axis: axes) {
+						if (axis < 0 || axis >= shape.rank || std::ranges::count(axes, axis) > 1)
+							throw std::runtime_error("Invalid axis");
+					}
+					shape_dims dims;
+					for (int i = 0; i < shape.rank; ++i) {
+						if (std::ranges::find(axes, i) == axes.end()) dims.push_back(shape.dims[i]);
+					}
+					return shape_t{dims};
+				}
 		};
 
 		class Layer {
@@ -215,12 +316,10 @@ namespace plearn::model {
 			void unset_output(ModelTensor& tensor) {
 				auto it = outputs_.begin();
 				for (; it != outputs_.end(); ++it) {
-					if (it->get() == tensor.get()) { //NOTE nasty..
-						outputs_.erase(it);
-						break;
-					}
+					if (it->get() == tensor.get()) break; //NOTE nasty..
 				}
 				if (it == outputs_.end()) return; //wasnt output
+				outputs_.erase(it);
 				cg_builder_.unset_output(tensor->id_);
 			}
 
@@ -228,16 +327,70 @@ namespace plearn::model {
 				uncommited_ = false;
 			}
 
-			void compile() {
+			void compile(const CompileOptions& options = {}) {
 				if (!uncompiled_) throw std::runtime_error("Model already compiled.");
 				if (uncommited_) commit();
-				cg_ = cg_builder_.build();
+				cg_ = options.fuse ? fuse_elementwise(cg_builder_.build()) : cg_builder_.build();
 				env_section_builder section_builder(exec_env_, exec_env_->backend(), cg_);
-				env_section_ = section_builder.build();
+				vector<node_id> variable_ids;
+				for (auto& var: variables_) {
+					if (var->requires_grad_) variable_ids.push_back(var->id_);
+				}
+				//tensors fused away have no node to store
+				vector<node_id> checkpoint_ids;
+				for (auto& tensor: flow_tensors_) {
+					if (tensor->checkpoint_ && cg_.flow_nodes_.contains(tensor->id_))
+						checkpoint_ids.push_back(tensor->id_);
+				}
+				if (!checkpoint_ids.empty()) section_builder.set_checkpoints(checkpoint_ids);
+				else if (options.checkpoint_budget > 0) section_builder.set_checkpoint_budget(options.checkpoint_budget);
+				env_section_ = section_builder
+					.set_diff_mode(options.mode)
+					.set_directions(options.directions)
+					.set_variable_nodes(std::move(variable_ids))
+					.build();
+				mode_ = options.mode;
+				if (options.inter_op_threads > 0)
+					thread_pool_ = std::make_unique<thread_pool>(options.inter_op_threads);
 				uncompiled_ = false;
 			}
 
 
+			/**
+			 * Whether the Jacobians are accumulated forward, see diff_mode::automatic.
+			 */
+			bool forward_jacobians() const {
+				if (uncompiled_) throw std::runtime_error("Model not compiled.");
+				return env_section_->forward_jacobians();
+			}
+
+			/**
+			 * Bytes planned for the intermediate tensors of one execution, with diffs
+			 * including the buffers of the tensors the backward pass recomputes.
+			 */
+			uint64_t planned_memory_bytes(int batch_size = 1, bool calc_diffs = false) const {
+				if (uncompiled_) throw std::runtime_error("Model not compiled.");
+				auto bytes = env_section_->plan_memory(batch_size, calc_diffs).peak_bytes();
+				return calc_diffs ? bytes + env_section_->recompute_bytes() : bytes;
+			}
+
+
+			/**
+			 * Frozen variables are constants of the compiled model: no gradient is
+			 * allocated for them and backward ops reaching only them are skipped.
+			 */
+			void set_requires_grad(ModelTensor& m_tensor, bool requires_grad) {
+				if (!uncompiled_) throw std::runtime_error("Model already compiled.");
+				if (std::ranges::find(variables_, m_tensor.get(), &ModelTensor::get) == variables_.end())
+					throw std::runtime_error("Tensor is not a variable.");
+				m_tensor->requires_grad_ = requires_grad;
+			}
+
+			void set_checkpoint(ModelTensor& m_tensor) {
+				if (!uncompiled_) throw std::runtime_error("Model already compiled.");
+				m_tensor->checkpoint_ = true;
+			}
+
 			void set_variable_tensor(ModelTensor& m_tensor, tensor_p t) {
 				if (uncompiled_) throw std::runtime_error("Model not compiled.");
 				env_section_->set_data_tensor(m_tensor->id_, t);
@@ -247,6 +400,7 @@ namespace plearn::model {
 			struct ExecResult {
 				unordered_map<node_id, tensor_p> tensors{};
 				borrowed_ptr<grad_system> grads{};
+				borrowed_ptr<tangent_map> tangents{};
 
 				[[nodiscard]]
 				tensor_p tensor_of(ModelTensor m_tensor) {
@@ -260,34 +414,224 @@ namespace plearn::model {
 				gradient& grad_of(ModelTensor m_tensor, ModelTensor output) {
 					if (!grads) throw std::runtime_error("Gradients not set.");
 					auto& grad_map = (*grads)[m_tensor->id_];
+					//frozen variables and tensors the output does not depend on
+					if (!grad_map.contains(output->id_)) throw std::runtime_error("Tensor has no gradient.");
 					return grad_map[output->id_].grad_;
 				}
+
+				/**
+				 * Tangents of an output in jvp mode, the directions one after the other.
+				 */
+				[[nodiscard]]
+				tensor_p tangent_of(ModelTensor output) {
+					if (!tangents) throw std::runtime_error("Tangents not set.");
+					if (!tangents->contains(output->id_))
+						throw std::runtime_error("Tensor not set as output.");
+					return tangents->at(output->id_);
+				}
 				
 			};
 
 
-			ExecResult execute(const vector<tensor_p>& inputs, bool calc_diffs=false) {
+			/**
+			 * Preallocated bindings for repeated executions on one batch size.
+			 * Input and output tensors are created once and can be replaced by caller
+			 * tensors, fx. on borrowed buffers. Executions reuse the bindings, so they
+			 * allocate nothing and look nothing up.
+			 * The context has intermediate tensors of its own and must not outlive the model.
+			 */
+			class ExecContext {
+				public:
+					ExecContext(ExecContext&&) = default;
+					ExecContext& operator=(ExecContext&&) = default;
+
+					//tensor the idx-th input is read from, its data can be written in place
+					[[nodiscard]]
+					const tensor_p& input(unsigned idx) const { return *inputs_.at(idx); }
+					[[nodiscard]]
+					const tensor_p& output(unsigned idx) const { return *outputs_.at(idx); }
+
+					[[nodiscard]]
+					const tensor_p& tensor_of(const ModelTensor& m_tensor) const {
+						for (unsigned idx = 0; idx < output_ids_.size(); ++idx) {
+							if (output_ids_[idx] == m_tensor->id_) return *outputs_[idx];
+						}
+						throw std::runtime_error("Tensor not set as output.");
+					}
+
+					void bind_input(unsigned idx, tensor_p t) {
+						check_shape(*inputs_.at(idx), t);
+						*inputs_[idx] = std::move(t);
+					}
+
+					void bind_output(unsigned idx, tensor_p t) {
+						check_shape(*outputs_.at(idx), t);
+						*outputs_[idx] = std::move(t);
+					}
+
+					void execute() {
+						for (auto [slot, data]: data_) {
+							if (!*data) throw std::runtime_error("Variable tensor not set.");
+							*slot = *data;
+						}
+						page_->rebind();
+						page_->execute(pool_);
+					}
+
+				private:
+					ExecContext(Model& model, int batch_size) :
+						page_{model.env_section_->create_detached_page(batch_size)},
+						pool_{model.thread_pool_.get()} {
+						auto create = [&](const ModelTensor& t) {
+							auto shape = batch_size == 1 ? t->shape_ : shape_t{batch_size} * t->shape_;
+							auto& slot = page_->slot(t->id_);
+							slot = model.exec_env_->create_tensor(shape);
+							return &slot;
+						};
+						for (auto& t: model.inputs_) inputs_.push_back(create(t));
+						for (auto& t: model.outputs_) {
+							outputs_.push_back(create(t));
+							output_ids_.push_back(t->id_);
+						}
+						for (auto& [id, _]: model.cg_.data_nodes_) {
+							data_.emplace_back(&page_->slot(id), &model.env_section_->data_slot(id));
+						}
+					}
+
+					static void check_shape(const tensor_p& bound, const tensor_p& t) {
+						if (!t || t->shape() != bound->shape())
+							throw std::runtime_error("Tensor shape mismatch");
+					}
+
+					unique_ptr<exec_page> page_;
+					borrowed_ptr<thread_pool> pool_;
+					vector<borrowed_ptr<tensor_p>> inputs_;
+					vector<borrowed_ptr<tensor_p>> outputs_;
+					vector<node_id> output_ids_;
+					//slots of the page and the variable tensors of the model they are read from
+					vector<std::pair<borrowed_ptr<tensor_p>, read_ptr<tensor_p>>> data_;
+
+				friend class Model;
+			};
+
+			/**
+			 * A context for repeated executions on inputs of batch_size samples, see ExecContext.
+			 */
+			[[nodiscard]]
+			ExecContext create_context(int batch_size = 1) {
+				if (uncommited_ || uncompiled_) throw std::runtime_error("Model not compiled.");
+				if (batch_size < 1) throw std::runtime_error("Invalid batch size");
+				return ExecContext{*this, batch_size};
+			}
+
+			/**
+			 * Execute the model on the given inputs.
+			 * Inputs may carry a leading batch dimension, in which case the whole batch is
+			 * executed at once and the outputs are batched as well.
+			 * In vjp mode, cotangents (in the order of the outputs) seed the backward pass,
+			 * outputs without a cotangent are seeded with ones.
+			 */
+			ExecResult execute(const vector<tensor_p>& inputs, bool calc_diffs=false,
+					const vector<tensor_p>& cotangents={}) {
+				if (cotangents.size() > outputs_.size()) throw std::runtime_error("More cotangents than outputs.");
+				unordered_map<node_id, tensor_p> cotangent_tensors;
+				for (unsigned idx = 0; idx < cotangents.size(); idx++) {
+					cotangent_tensors[outputs_[idx]->id_] = cotangents[idx];
+				}
+				return run(inputs, {.calc_diffs=calc_diffs, .cotangents_=cotangent_tensors});
+			}
+
+			/**
+			 * An optimizer for the variables of the model, see train_step.
+			 */
+			optimizer create_optimizer(const optimizer_params& params) {
+				return optimizer{exec_env_, params};
+			}
+
+			/**
+			 * Execute the model, calculate the gradients of its output, the loss, and let opt
+			 * update the variables in place. The gradients are read where the backward pass
+			 * left them. Needs a model with a single output not compiled in jvp mode,
+			 * in vjp mode the loss is the sum of the output.
+			 */
+			ExecResult train_step(const vector<tensor_p>& inputs, optimizer& opt) {
+				if (outputs_.size() != 1) throw std::runtime_error("Model needs a single loss output.");
+				if (mode_ == diff_mode::jvp) throw std::runtime_error("Model compiled in jvp mode.");
+				auto result = run(inputs, {.calc_diffs = true});
+				opt.step(*env_section_, *result.grads, outputs_[0]->id_);
+				return result;
+			}
+
+			/**
+			 * Execute the model and push tangents of variables and inputs forward along,
+			 * see ExecResult::tangent_of. Needs a model compiled in jvp mode.
+			 * A tangent holds CompileOptions::directions tangents of its tensor one after
+			 * the other, tensors without a tangent are constant.
+			 */
+			ExecResult jvp(const vector<tensor_p>& inputs,
+					const vector<std::pair<ModelTensor, tensor_p>>& tangents) {
+				if (mode_ != diff_mode::jvp) throw std::runtime_error("Model not compiled in jvp mode.");
+				tangent_map tangent_tensors;
+				for (auto& [m_tensor, tangent]: tangents) tangent_tensors[m_tensor->id_] = tangent;
+				return run(inputs, {.calc_diffs=true, .tangents_=tangent_tensors});
+			}
+
+		private:
+			ExecResult run(const vector<tensor_p>& inputs, exec_params params) {
 				if (uncommited_ || uncompiled_) throw std::runtime_error("Model not compiled.");
+				int batch_size = input_batch_size(inputs);
 				unordered_map<node_id, tensor_p> input_tensors;
 				for (unsigned idx = 0; idx < inputs_.size(); idx++) {
 					auto& t = inputs_[idx];
 					input_tensors[t->id_] = inputs[idx]; 
 				}
 				unordered_map<node_id, tensor_p> output_tensors;
-				for (auto& t : outputs_)
-					output_tensors[t->id_] = exec_env_->create_tensor(t->shape_, tensor_init::zero);
+				for (auto& t : outputs_) {
+					auto shape = batch_size == 1 ? t->shape_ : shape_t{batch_size} * t->shape_;
+					output_tensors[t->id_] = exec_env_->create_tensor(shape);
+				}
 
-				exec_params params{.calc_diffs=calc_diffs,
-					.inputs_=input_tensors, .outputs_=output_tensors};
+				params.batch_size = batch_size;
+				params.thread_pool_ = thread_pool_.get();
+				params.inputs_ = std::move(input_tensors);
+				params.outputs_ = std::move(output_tensors);
 				auto exec_result = env_section_->execute(params);
 
 				ExecResult result{params.outputs_};
-				if (calc_diffs)
+				if (params.calc_diffs) {
 					result.grads = exec_result.grad_system_;
+					result.tangents = exec_result.tangents_;
+				}
 				return result;
 			}
 
-		private:
+			/**
+			 * 1 if the inputs have the shape of the model inputs,
+			 * the size of the leading dimension if they are batched.
+			 */
+			int input_batch_size(const vector<tensor_p>& inputs) const {
+				if (inputs.size() != inputs_.size())
+					throw std::runtime_error("Input count mismatch");
+				int batch_size = 0;
+				for (unsigned idx = 0; idx < inputs_.size(); idx++) {
+					auto& model_shape = inputs_[idx]->shape_;
+					auto& shape = inputs[idx]->shape();
+					int size;
+					if (shape == model_shape) {
+						size = 1;
+					} else if (shape.rank == model_shape.rank + 1 && 
+							std::equal(model_shape.dims.begin(), model_shape.dims.end(), shape.dims.begin() + 1)) {
+						size = shape.dims[0];
+					} else {
+						throw std::runtime_error("Input shape mismatch");
+					}
+					if (batch_size != 0 && size != batch_size)
+						throw std::runtime_error("Batch size mismatch");
+					batch_size = size;
+				}
+				return batch_size == 0 ? 1 : batch_size;
+			}
+
 			Layer& set_uncommited() {
 				uncompiled_ = true;
 				if (uncommited_) return layers_.back();
@@ -306,11 +650,13 @@ namespace plearn::model {
 
 			borrowed_ptr<exec_env> exec_env_;
 			unique_ptr<env_section> env_section_;
+			unique_ptr<thread_pool> thread_pool_;
 
 			call_graph cg_;
 			call_graph_builder cg_builder_;
 			bool uncommited_{false};
 			bool uncompiled_{true};
+			diff_mode mode_{diff_mode::jacobian};
 
 
 	};
@@ -44,7 +44,7 @@ namespace plearn::model {
 		shape_t to_shape() const {
 			if (!is_const())
 				throw std::runtime_error("Shape is not const");
-			vector<uint64_t> dims_shape;
+			shape_dims dims_shape;
 			for (auto& dim : dims) {
 				dims_shape.push_back(dim.value_);
 			}
@@ -56,6 +56,25 @@ namespace plearn::model {
 	};
 
 
+	/**
+	 * Options for Model::compile.
+	 */
+	struct CompileOptions {
+		//representation of the gradients, see diff_mode
+		diff_mode mode{diff_mode::jacobian};
+		//tangents propagated at once in jvp mode, see Model::jvp
+		uint64_t directions{1};
+		//threads executing independent ops concurrently, 0 runs the ops in order.
+		//Ops run by these threads are not split over the intra-op pool of the backend.
+		unsigned inter_op_threads{0};
+		//run chains of elementwise ops as single fused ops, see rep::fusion_pass
+		bool fuse{true};
+		//bytes of intermediate tensors stored for the backward pass, 0 stores all of them.
+		//The others are recomputed, see env::select_checkpoints and ModelTensor::checkpoint.
+		uint64_t checkpoint_budget{0};
+	};
+
+
 
 }
 
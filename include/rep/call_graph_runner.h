@@ -61,6 +61,10 @@ namespace plearn::rep {
 				}
 				//clear ready ops and find initial ready ops
 				ready_ops_ = unordered_set<op_node_id>{};
+				for (auto& [id, info]: op_info_) {
+					//ops that only depend on data nodes
+					if (info.deps_ == 0) ready_ops_.insert(id);
+				}
 				for (auto inn_id: cg_.in_nodes_) {
 					for (auto op_id: cg_.flow_nodes_.at(inn_id).outputs_) {
 						decrement_deps(op_info_.at(op_id));
@@ -111,9 +115,76 @@ namespace plearn::rep {
 	};
 
 
+	/**
+	 * A topological order of the op nodes of a call graph, computed once.
+	 * Iterating the flat order replaces the bookkeeping of a runner on every execution.
+	 */
+	class call_graph_schedule {
+		public:
+			/**
+			 * Order in which call_graph_forward_runner reaches the ops.
+			 */
+			static call_graph_schedule forward(const call_graph& cg) {
+				call_graph_schedule schedule;
+				call_graph_forward_runner runner{cg};
+				runner.reset();
+				while (runner.state() == run_state::IN_PROGRESS && !runner.ready_ops().empty()) {
+					auto opn_id = *runner.ready_ops().begin();
+					schedule.ops_.push_back(&cg.op_nodes_.at(opn_id));
+					runner.op_finished(opn_id);
+				}
+				return schedule;
+			}
+
+			const vector<read_ptr<op_node>>& ops() const { return ops_; }
+			std::size_t size() const { return ops_.size(); }
+
+		private:
+			vector<read_ptr<op_node>> ops_;
+	};
+
+
+	/**
+	 *  Runs over the operations of a call graph backwards, from the outputs to the inputs.
+	 *  An operation is reached once all the operations consuming its output were reached,
+	 *  so the gradient of its output is complete.
+	 *  Only operations that some output depends on are reached.
+	 */
 	class call_graph_backward_runner {
+		struct node_info {
+				op_node_id id_;
+				//edges to ops consuming the output
+				int consumers_ = 0;
+				int pending_consumers_ = 0;
+				//ops producing the inputs, one entry per edge
+				vector<op_node_id> producers_{};
+		};
 		public:
-			call_graph_backward_runner(const call_graph& cg) : cg_{cg} { }
+			call_graph_backward_runner(const call_graph& cg) : cg_{cg} {
+				//collect the ops the outputs depend on
+				vector<node_id> stack{cg_.out_nodes_.begin(), cg_.out_nodes_.end()};
+				while (!stack.empty()) {
+					auto flown_id = stack.back();
+					stack.pop_back();
+					auto input = cg_.flow_nodes_.at(flown_id).input_;
+					if (!input.has_value() || op_info_.contains(input.value())) continue;
+					auto& opn = cg_.op_nodes_.at(input.value());
+					op_info_[opn.id_] = {opn.id_};
+					for (auto inn_id: opn.inputs_) {
+						if (cg_.flow_nodes_.contains(inn_id)) stack.push_back(inn_id);
+					}
+				}
+				//count consumers
+				for (auto& [id, info]: op_info_) {
+					for (auto inn_id: cg_.op_nodes_.at(id).inputs_) {
+						if (!cg_.flow_nodes_.contains(inn_id)) continue;
+						auto input = cg_.flow_nodes_.at(inn_id).input_;
+						if (!input.has_value()) continue;
+						op_info_.at(input.value()).consumers_++;
+						info.producers_.push_back(input.value());
+					}
+				}
+			}
 
 			template<typename Callable>
 				void run(Callable&& op_action)
@@ -128,48 +199,66 @@ namespace plearn::rep {
 					}
 				}
 
+			/**
+			 * Start a run: reset consumer counters and available operations.
+			 */
 			void reset() {
 				assert(state_ == run_state::READY);
-				state_ = run_state::IN_PROGRESS;
-				unready_in_tens_ = cg_.in_nodes_.size();
-				//clear ready ops and find initial ready ops
+				unfinished_ops_ = op_info_.size();
+				state_ = unfinished_ops_ > 0 ? run_state::IN_PROGRESS : run_state::READY;
 				ready_ops_ = unordered_set<op_node_id>{};
-				for (auto outn_id: cg_.out_nodes_) {
-					auto input = cg_.flow_nodes_.at(outn_id).input_;
-					if (input.has_value()) 
-						ready_ops_.insert(input.value());
+				for (auto& [id, info]: op_info_) {
+					info.pending_consumers_ = info.consumers_;
+					if (info.consumers_ == 0) ready_ops_.insert(id);
 				}
 			}
 
+			/**
+			 * Call this function when an operation has finished executing.
+			 * Releases the producers of its inputs whose consumers all finished.
+			 */
 			void op_finished(op_node_id opn_id) {
 				assert(state_ == run_state::IN_PROGRESS);
-				//TODO concurrency
-				//remove op from ready ops
 				ready_ops_.erase(opn_id);
-				//add op inputs to ready ops
-				for (auto inn_id: cg_.op_nodes_.at(opn_id).inputs_) {
-					auto& inn = cg_.flow_nodes_.contains(inn_id) ?
-						cg_.flow_nodes_.at(inn_id) : cg_.data_nodes_.at(inn_id);
-					if (inn.input_.has_value()) {
-						ready_ops_.insert(inn.input_.value());
-					} else if (std::ranges::count(cg_.in_nodes_, inn_id) > 0) {
-						//input is a graph input
-						unready_in_tens_--;
-						if (unready_in_tens_ == 0) {
-							state_ = run_state::READY;
-						}
-					}
+				for (auto producer: op_info_.at(opn_id).producers_) {
+					auto& info = op_info_.at(producer);
+					info.pending_consumers_--;
+					if (info.pending_consumers_ == 0) ready_ops_.insert(producer);
 				}
+				unfinished_ops_--;
+				if (unfinished_ops_ == 0) state_ = run_state::READY;
 			}
 
 			run_state state() const { return state_; }
 
 			const unordered_set<op_node_id>& ready_ops() const { return ready_ops_; }
 
+			/**
+			 * Ops reached by a run, i.e. the ops some output depends on.
+			 */
+			vector<op_node_id> ops() const {
+				vector<op_node_id> ops;
+				for (auto& [id, _]: op_info_) ops.push_back(id);
+				return ops;
+			}
+
+			/**
+			 * Number of edges to ops consuming the output of opn_id.
+			 */
+			int consumers(op_node_id opn_id) const { return op_info_.at(opn_id).consumers_; }
+
+			/**
+			 * Ops producing the inputs of opn_id, one entry per edge.
+			 */
+			const vector<op_node_id>& producers(op_node_id opn_id) const {
+				return op_info_.at(opn_id).producers_;
+			}
+
 		private:
 			const call_graph& cg_;
 			run_state state_ = run_state::READY;
 			unordered_set<op_node_id> ready_ops_;
-			int unready_in_tens_;
+			unordered_map<op_node_id, node_info> op_info_;
+			std::size_t unfinished_ops_;
 	};
 }
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+#include <rep/call_graph_runner.h>
+
+namespace plearn::rep {
+
+	/**
+	 * A call graph compiled into flat arrays for the executing components.
+	 * Ops are numbered by their position in the forward schedule, tensor nodes are indexed
+	 * by their id, which the builder hands out densely. The inputs and the consumers of
+	 * the ops are stored in CSR form, so walking the graph needs no hash lookups.
+	 */
+	class compiled_graph {
+		public:
+			compiled_graph() = default;
+
+			compiled_graph(const call_graph& cg) :
+				compiled_graph(cg, call_graph_schedule::forward(cg)) {}
+
+			compiled_graph(const call_graph& cg, const call_graph_schedule& schedule) {
+				node_id max_id = -1;
+				for (auto& [id, _]: cg.flow_nodes_) max_id = std::max(max_id, id);
+				for (auto& [id, _]: cg.data_nodes_) max_id = std::max(max_id, id);
+				node_count_ = max_id + 1;
+				producers_.assign(node_count_, -1);
+				flow_.assign(node_count_, false);
+				shapes_.resize(node_count_);
+				for (auto& [id, node]: cg.flow_nodes_) {
+					flow_[id] = true;
+					shapes_[id] = node.shape_;
+				}
+				for (auto& [id, node]: cg.data_nodes_) shapes_[id] = node.shape_;
+
+				input_offsets_.push_back(0);
+				for (auto opn: schedule.ops()) {
+					producers_[opn->out_] = ops_.size();
+					ops_.push_back(opn);
+					outputs_.push_back(opn->out_);
+					inputs_.insert(inputs_.end(), opn->inputs_.begin(), opn->inputs_.end());
+					input_offsets_.push_back(inputs_.size());
+				}
+
+				//consumers, one entry per edge
+				vector<uint32_t> counts(ops_.size(), 0);
+				for (auto in_id: inputs_) {
+					if (producers_[in_id] >= 0) counts[producers_[in_id]]++;
+				}
+				consumer_offsets_.assign(ops_.size() + 1, 0);
+				for (unsigned idx = 0; idx < ops_.size(); ++idx)
+					consumer_offsets_[idx + 1] = consumer_offsets_[idx] + counts[idx];
+				consumers_.resize(consumer_offsets_.back());
+				std::fill(counts.begin(), counts.end(), 0);
+				for (unsigned idx = 0; idx < ops_.size(); ++idx) {
+					for (auto in_id: inputs(idx)) {
+						auto producer = producers_[in_id];
+						if (producer < 0) continue;
+						consumers_[consumer_offsets_[producer] + counts[producer]++] = idx;
+					}
+				}
+
+				//ops some output depends on, marked from the outputs backwards
+				reached_.assign(ops_.size(), false);
+				for (auto outn_id: cg.out_nodes_) {
+					if (producers_[outn_id] >= 0) reached_[producers_[outn_id]] = true;
+				}
+				for (unsigned idx = ops_.size(); idx-- > 0;) {
+					if (!reached_[idx]) continue;
+					for (auto in_id: inputs(idx)) {
+						if (producers_[in_id] >= 0) reached_[producers_[in_id]] = true;
+					}
+				}
+			}
+
+			std::size_t op_count() const { return ops_.size(); }
+			//bound of the node ids, tables indexed by node id have this size
+			std::size_t node_count() const { return node_count_; }
+
+			const op_node& op(unsigned idx) const { return *ops_[idx]; }
+			node_id output(unsigned idx) const { return outputs_[idx]; }
+
+			std::span<const node_id> inputs(unsigned idx) const {
+				return {inputs_.data() + input_offsets_[idx], inputs_.data() + input_offsets_[idx + 1]};
+			}
+
+			/**
+			 * Ops reading the output of op idx, one entry per edge.
+			 */
+			std::span<const unsigned> consumers(unsigned idx) const {
+				return {consumers_.data() + consumer_offsets_[idx],
+					consumers_.data() + consumer_offsets_[idx + 1]};
+			}
+
+			/**
+			 * Op producing a node, -1 for inputs and data nodes.
+			 */
+			int producer(node_id id) const { return producers_[id]; }
+
+			bool is_flow(node_id id) const { return flow_[id]; }
+
+			//shape of a node for a single sample
+			const shape_t& shape(node_id id) const { return shapes_[id]; }
+
+			/**
+			 * Whether some output depends on op idx, i.e. a backward pass reaches it.
+			 */
+			bool reached(unsigned idx) const { return reached_[idx]; }
+
+		private:
+			std::size_t node_count_{0};
+			vector<read_ptr<op_node>> ops_;
+			vector<node_id> outputs_;
+			vector<uint32_t> input_offsets_;
+			vector<node_id> inputs_;
+			vector<uint32_t> consumer_offsets_;
+			vector<unsigned> consumers_;
+			vector<int> producers_;
+			vector<bool> flow_;
+			vector<shape_t> shapes_;
+			vector<bool> reached_;
+	};
+
+}
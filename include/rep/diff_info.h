@@ -76,7 +76,7 @@ namespace plearn::rep {
 			return !output_deps_.at(outn_id).independent_;
 		}
 
-		bool any_output_dependant() {
+		bool any_output_dependant() const {
 			for (auto& [id, grad]: output_deps_) {
 				if (!grad.independent_)
 					return true;
@@ -121,6 +121,68 @@ namespace plearn::rep {
 	};
 	
 
+	/**
+	 * Multiply-adds of an op per direction it propagates: the size of the product for
+	 * products, an element of every input read otherwise.
+	 */
+	inline uint64_t op_diff_work(const call_graph& cg, const op_node& opn) {
+		auto shape_of = [&](node_id id) -> const shape_t& {
+			if (cg.flow_nodes_.contains(id)) return cg.flow_nodes_.at(id).shape_;
+			return cg.data_nodes_.at(id).shape_;
+		};
+		switch (opn.op_.type_) {
+			case op_type::matmul: {
+				auto& A = shape_of(opn.inputs_[0]);
+				return A.size() * shape_of(opn.inputs_[1]).dims.back();
+			}
+			case op_type::vecmatmul:
+			case op_type::dense:
+				return shape_of(opn.inputs_[1]).size();
+			case op_type::matvecmul:
+				return shape_of(opn.inputs_[0]).size();
+			case op_type::fused:
+				return shape_of(opn.inputs_[0]).size() * opn.op_.block_->instrs_.size();
+			default: {
+				uint64_t work = 0;
+				for (auto in_id: opn.inputs_) work += shape_of(in_id).size();
+				return work;
+			}
+		}
+	}
+
+	/**
+	 * Estimated work of the Jacobians of all outputs wrt all variables, in multiply-adds.
+	 * Forward accumulation pushes a direction per variable element through the ops,
+	 * reverse accumulation pulls a column per element of the outputs depending on them.
+	 * Only ops between a variable and an output count.
+	 */
+	struct diff_costs {
+		uint64_t forward_{0};
+		uint64_t reverse_{0};
+
+		bool prefer_forward() const { return forward_ < reverse_; }
+	};
+
+	inline diff_costs estimate_diff_costs(const call_graph& cg, const diff_info& info) {
+		auto& deps = info.dependencies();
+		uint64_t directions = 0;
+		for (auto varn_id: info.variable_nodes()) {
+			if (deps.at(varn_id).any_output_dependant())
+				directions += cg.data_nodes_.at(varn_id).shape_.size();
+		}
+		diff_costs costs;
+		for (auto& [_, opn]: cg.op_nodes_) {
+			auto& out_deps = deps.at(opn.out_);
+			if (!out_deps.depends_on_any() || !out_deps.any_output_dependant()) continue;
+			auto work = op_diff_work(cg, opn);
+			costs.forward_ += work * directions;
+			for (auto outn_id: out_deps.dependant_output_nodes())
+				costs.reverse_ += work * cg.flow_nodes_.at(outn_id).shape_.size();
+		}
+		return costs;
+	}
+
+
 	class diff_info_builder {
 
 		public:
@@ -133,6 +195,7 @@ namespace plearn::rep {
 			 */
 			diff_info_builder& variable_nodes(const vector<node_id>& data_nodes) {
 				variable_nodes_ = data_nodes;
+				variables_set_ = true;
 				return *this;
 			}
 
@@ -143,17 +206,24 @@ namespace plearn::rep {
 				for (auto& [id, node]: graph_.data_nodes_) {
 					variable_nodes_.push_back(id);
 				}
+				variables_set_ = true;
 				return *this;
 			}
 
 			/**
 			 * Find the nodes that are dependant on the requested data nodes.
+			 * Data nodes that are not variables are constants, nothing depending only on
+			 * them has a gradient.
 			 */
 			diff_info_builder& find_dependencies() {
-				if (variable_nodes_.empty()) {
+				if (!variables_set_) {
 					//set variables to be all data nodes
 					all_data_nodes();
 				}
+				//constant data tensors first, variables overwrite them
+				for (auto& [datan_id, _]: graph_.data_nodes_) {
+					dependencies_[datan_id] = node_diff_info::independent(datan_id, variable_nodes_);
+				}
 				//add identity derivatives for the data tensors
 				for (auto var_node_id: variable_nodes_) {
 					dependencies_[var_node_id] =
@@ -223,6 +293,8 @@ namespace plearn::rep {
 		private:
 			const call_graph& graph_;
 			vector<node_id> variable_nodes_;
+			//an empty set of variables is only the default when none were set
+			bool variables_set_ = false;
 			vector<node_id> output_nodes_;
 			unordered_map<node_id, node_diff_info> dependencies_;
 	};
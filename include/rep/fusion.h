@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+
+namespace plearn::rep {
+
+	/**
+	 * Reductions a fused block can end in, the ones over a run of contiguous axes.
+	 */
+	inline bool fusable_reduction(const operation& op) {
+		if (op.type_ != op_type::reduce_sum && op.type_ != op_type::reduce_mean) return false;
+		auto axes = reduced_axes(op);
+		for (unsigned i = 1; i < axes.size(); ++i) {
+			if (axes[i] != axes[i-1] + 1) return false;
+		}
+		return true;
+	}
+
+
+	/**
+	 * Rewrites chains of elementwise ops, optionally ending in a reduction, into fused ops.
+	 * Only internal tensors read by a single op are fused away, so outputs and
+	 * tensors shared by several ops stay in the graph.
+	 * The fused op keeps the id and the output of the last op of its chain.
+	 */
+	class fusion_pass {
+		public:
+			fusion_pass(const call_graph& cg) : cg_{cg} {}
+
+			call_graph run() {
+				find_groups();
+				call_graph fused = cg_;
+				for (auto& [root_id, members]: groups_) {
+					if (members.size() > 1) fuse(fused, root_id, members);
+				}
+				return fused;
+			}
+
+		private:
+			//the op opn can be fused into
+			std::optional<op_node_id> fused_consumer(const op_node& opn) const {
+				if (!is_elementwise(opn.op_.type_)) return std::nullopt;
+				if (!std::ranges::count(cg_.internal_nodes_, opn.out_)) return std::nullopt;
+				auto& consumers = cg_.flow_nodes_.at(opn.out_).outputs_;
+				if (consumers.size() != 1) return std::nullopt;
+				auto& consumer = cg_.op_nodes_.at(consumers[0]);
+				if (!is_elementwise(consumer.op_.type_) && !fusable_reduction(consumer.op_))
+					return std::nullopt;
+				return consumer.id_;
+			}
+
+			//ops by the last op of their chain
+			void find_groups() {
+				for (auto& [opn_id, opn]: cg_.op_nodes_) {
+					auto root_id = opn_id;
+					while (auto next = fused_consumer(cg_.op_nodes_.at(root_id))) root_id = *next;
+					groups_[root_id].insert(opn_id);
+				}
+			}
+
+			//op of the group producing a tensor
+			std::optional<op_node_id> producer(node_id tenn_id, const unordered_set<op_node_id>& members) const {
+				if (!cg_.flow_nodes_.contains(tenn_id)) return std::nullopt; //data node
+				auto& input = cg_.flow_nodes_.at(tenn_id).input_;
+				if (!input || !members.contains(*input)) return std::nullopt;
+				return *input;
+			}
+
+			void collect_inputs(const op_node& opn, const unordered_set<op_node_id>& members,
+					vector<node_id>& inputs) const {
+				for (auto in_id: opn.inputs_) {
+					if (auto prod = producer(in_id, members))
+						collect_inputs(cg_.op_nodes_.at(*prod), members, inputs);
+					else if (!std::ranges::count(inputs, in_id))
+						inputs.push_back(in_id);
+				}
+			}
+
+			//instructions of opn after the ones of its operands, returns the operand of its result
+			unsigned emit(const op_node& opn, const unordered_set<op_node_id>& members,
+					const vector<node_id>& inputs, fused_block& block) const {
+				auto operand = [&](node_id in_id) {
+					if (auto prod = producer(in_id, members))
+						return emit(cg_.op_nodes_.at(*prod), members, inputs, block);
+					return static_cast<unsigned>(std::ranges::find(inputs, in_id) - inputs.begin());
+				};
+				fused_block::instr instr{opn.op_.type_, operand(opn.inputs_[0])};
+				if (opn.inputs_.size() > 1) instr.b_ = operand(opn.inputs_[1]);
+				block.instrs_.push_back(instr);
+				return block.inputs_ + block.instrs_.size() - 1;
+			}
+
+			void fuse(call_graph& fused, op_node_id root_id, const unordered_set<op_node_id>& members) {
+				auto& root = cg_.op_nodes_.at(root_id);
+				vector<node_id> inputs;
+				collect_inputs(root, members, inputs);
+
+				auto block = std::make_shared<fused_block>();
+				block->inputs_ = inputs.size();
+				if (is_elementwise(root.op_.type_)) {
+					emit(root, members, inputs, *block);
+				} else {
+					block->reduce_ = root.op_;
+					emit(cg_.op_nodes_.at(*producer(root.inputs_[0], members)), members, inputs, *block);
+				}
+
+				//the tensors between the ops of the group
+				for (auto opn_id: members) {
+					if (opn_id == root_id) continue;
+					auto out_id = cg_.op_nodes_.at(opn_id).out_;
+					fused.op_nodes_.erase(opn_id);
+					fused.flow_nodes_.erase(out_id);
+					std::erase(fused.internal_nodes_, out_id);
+				}
+				for (auto in_id: inputs) {
+					auto& node = fused.flow_nodes_.contains(in_id) ?
+						fused.flow_nodes_.at(in_id) : fused.data_nodes_.at(in_id);
+					std::erase_if(node.outputs_, [&members](auto id) { return members.contains(id); });
+					node.outputs_.push_back(root_id);
+				}
+				auto& fused_opn = fused.op_nodes_.at(root_id);
+				fused_opn.op_ = operation{op_type::fused};
+				fused_opn.op_.block_ = std::move(block);
+				fused_opn.inputs_ = std::move(inputs);
+			}
+
+			const call_graph& cg_;
+			unordered_map<op_node_id, unordered_set<op_node_id>> groups_;
+	};
+
+	/**
+	 * The graph with its elementwise chains fused, see fusion_pass.
+	 */
+	inline call_graph fuse_elementwise(const call_graph& cg) {
+		return fusion_pass{cg}.run();
+	}
+
+}
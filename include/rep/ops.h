@@ -1,7 +1,12 @@
 #pragma once
 
 #include "rep/rep_types.h"
+#include <algorithm>
 #include <compare>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 namespace plearn::rep {
 
@@ -20,12 +25,68 @@ namespace plearn::rep {
 
 		reduce_sum,
 		reduce_mean,
+
+		fused,
+		dense,
+
+		reshape,
+		transpose,
+		slice,
+		broadcast,
+	};
+
+
+	/**
+	 * Activations a dense op applies to its output.
+	 */
+	enum class activation {
+		none,
+		relu,
 	};
 
 
+	/**
+	 * Ops computing every output element from the input elements at the same index,
+	 * their output may use the buffer of an input.
+	 */
+	inline bool is_elementwise(op_type type) {
+		switch (type) {
+			case op_type::add:
+			case op_type::sub:
+			case op_type::mult:
+			case op_type::square:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+
+	/**
+	 * Ops whose output is a strided view of their input, they move no data.
+	 * See rep/views.h for their layouts.
+	 */
+	inline bool is_view(op_type type) {
+		switch (type) {
+			case op_type::reshape:
+			case op_type::transpose:
+			case op_type::slice:
+			case op_type::broadcast:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+
+	struct fused_block;
+
 	struct operation {
 		op_type type_;
 		int iarg0_{};
+		int iarg1_{};
+		//program of a fused op
+		std::shared_ptr<const fused_block> block_{};
 		friend auto operator<=>(const operation&, const operation&) = default;
 	};
 
@@ -49,6 +110,17 @@ namespace plearn::rep {
 		dot_product() : operation{op_type::dot_product} {}
 	};
 
+	/**
+	 * act(x A + b) of a vector x, the bias input b is optional.
+	 */
+	struct dense : public operation {
+		dense(activation act = activation::none) : operation{op_type::dense, static_cast<int>(act)} {}
+	};
+
+	inline activation dense_activation(const operation& op) {
+		return static_cast<activation>(op.iarg0_);
+	}
+
 	struct add : public operation {
 		add() : operation{op_type::add} {}
 	};
@@ -65,14 +137,108 @@ namespace plearn::rep {
 		square() : operation{op_type::square} {}
 	};
 
+	/**
+	 * Bitmask of reduced axes, 0 when only the axis in iarg0_ is reduced.
+	 */
+	inline int reduce_axes_mask(const std::vector<int>& dims) {
+		int mask = 0;
+		for (auto dim: dims) mask |= 1 << dim;
+		return dims.size() > 1 ? mask : 0;
+	}
+
+	inline int first_reduce_axis(const std::vector<int>& dims) {
+		if (dims.empty()) throw std::runtime_error("No axis to reduce");
+		return *std::ranges::min_element(dims);
+	}
+
 	struct reduce_sum : public operation {
 		reduce_sum(int dim) : operation{op_type::reduce_sum, dim} {}
+		reduce_sum(const std::vector<int>& dims) :
+			operation{op_type::reduce_sum, first_reduce_axis(dims), reduce_axes_mask(dims)} {}
 	};
 
 	struct reduce_mean : public operation {
 		reduce_mean(int dim) : operation{op_type::reduce_mean, dim} {}
+		reduce_mean(const std::vector<int>& dims) :
+			operation{op_type::reduce_mean, first_reduce_axis(dims), reduce_axes_mask(dims)} {}
 	};
 
+	/**
+	 * The axes a reduce op reduces, ascending.
+	 */
+	inline std::vector<unsigned> reduced_axes(const operation& op) {
+		if (op.iarg1_ == 0) return {static_cast<unsigned>(op.iarg0_)};
+		std::vector<unsigned> axes;
+		for (unsigned axis = 0; axis < sizeof(int) * 8; ++axis) {
+			if (op.iarg1_ & (1 << axis)) axes.push_back(axis);
+		}
+		return axes;
+	}
+
+	/**
+	 * The same elements in another shape of the same size.
+	 */
+	struct reshape : public operation {
+		reshape() : operation{op_type::reshape} {}
+	};
 
-}
+	/**
+	 * Permutes the axes, output axis i is input axis perm[i].
+	 * The permutation is packed into iarg0_, four bits per axis.
+	 */
+	struct transpose : public operation {
+		transpose(const std::vector<unsigned>& perm) : operation{op_type::transpose, pack_perm(perm)} {}
+
+		static int pack_perm(const std::vector<unsigned>& perm) {
+			if (perm.size() > 8) throw std::runtime_error("Too many axes to transpose");
+			uint32_t packed = 0;
+			for (unsigned i = 0; i < perm.size(); ++i) packed |= (perm[i] & 0xf) << (4*i);
+			return static_cast<int>(packed);
+		}
+	};
+
+	inline std::vector<unsigned> transpose_perm(const operation& op, unsigned rank) {
+		std::vector<unsigned> perm(rank);
+		auto packed = static_cast<uint32_t>(op.iarg0_);
+		for (unsigned i = 0; i < rank; ++i) perm[i] = (packed >> (4*i)) & 0xf;
+		return perm;
+	}
+
+	/**
+	 * The range of an axis starting at `begin`, its length is given by the output shape.
+	 */
+	struct slice : public operation {
+		slice(int axis, int begin) : operation{op_type::slice, axis, begin} {}
+	};
+
+	/**
+	 * Repeats the input to the output shape. Input axes are aligned with the trailing
+	 * output axes, those of size 1 and the missing leading ones are repeated.
+	 */
+	struct broadcast : public operation {
+		broadcast() : operation{op_type::broadcast} {}
+	};
 
+
+	/**
+	 * A chain of elementwise ops run as one loop by a fused op, optionally followed by a
+	 * reduction. Operands below inputs_ are inputs of the fused op, operand inputs_ + i
+	 * is the result of instruction i. The result of the last instruction is the output.
+	 */
+	struct fused_block {
+		struct instr {
+			op_type type_;
+			unsigned a_;
+			//unused by unary ops
+			unsigned b_{};
+			friend auto operator<=>(const instr&, const instr&) = default;
+		};
+
+		unsigned inputs_{};
+		std::vector<instr> instrs_{};
+		//reduce_sum/reduce_mean over contiguous axes, noop if the block is elementwise
+		operation reduce_{op_type::noop};
+	};
+
+
+}
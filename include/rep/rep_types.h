@@ -1,8 +1,13 @@
 #pragma once
 
 #include <algorithm>
+#include <compare>
+#include <concepts>
 #include <cstdint>
+#include <initializer_list>
 #include <memory>
+#include <span>
+#include <stdexcept>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -35,50 +40,121 @@ namespace plearn::rep {
 
 
 
+	/**
+	 * Dims of a shape, stored inline so shapes never allocate.
+	 */
+	struct shape_dims {
+		static constexpr unsigned max_rank = 8;
+
+		constexpr shape_dims() = default;
+
+		constexpr shape_dims(std::initializer_list<uint64_t> dims) {
+			for (auto dim: dims) push_back(dim);
+		}
+
+		constexpr explicit shape_dims(std::span<const uint64_t> dims) {
+			for (auto dim: dims) push_back(dim);
+		}
+
+		shape_dims(const vector<uint64_t>& dims) : shape_dims(std::span{dims}) {}
+
+		constexpr std::size_t size() const { return size_; }
+		constexpr bool empty() const { return size_ == 0; }
+
+		constexpr uint64_t& operator[](unsigned i) { return dims_[i]; }
+		constexpr uint64_t operator[](unsigned i) const { return dims_[i]; }
+
+		constexpr uint64_t* begin() { return dims_; }
+		constexpr uint64_t* end() { return dims_ + size_; }
+		constexpr const uint64_t* begin() const { return dims_; }
+		constexpr const uint64_t* end() const { return dims_ + size_; }
+		constexpr const uint64_t* data() const { return dims_; }
+		constexpr uint64_t back() const { return dims_[size_ - 1]; }
+
+		constexpr void push_back(uint64_t dim) {
+			if (size_ == max_rank) throw std::length_error("Shape rank exceeds shape_dims::max_rank");
+			dims_[size_++] = dim;
+		}
+
+		constexpr void insert(const uint64_t* pos, uint64_t dim) {
+			auto idx = pos - dims_;
+			push_back(0);
+			std::copy_backward(dims_ + idx, dims_ + size_ - 1, dims_ + size_);
+			dims_[idx] = dim;
+		}
+
+		constexpr void erase(const uint64_t* first, const uint64_t* last) {
+			auto from = first - dims_, to = last - dims_;
+			std::copy(dims_ + to, dims_ + size_, dims_ + from);
+			size_ -= to - from;
+		}
+
+		constexpr void erase(const uint64_t* pos) { erase(pos, pos + 1); }
+
+		friend constexpr bool operator==(const shape_dims& a, const shape_dims& b) {
+			return std::equal(a.begin(), a.end(), b.begin(), b.end());
+		}
+
+		friend constexpr auto operator<=>(const shape_dims& a, const shape_dims& b) {
+			return std::lexicographical_compare_three_way(a.begin(), a.end(), b.begin(), b.end());
+		}
+
+		private:
+			uint64_t dims_[max_rank]{};
+			unsigned size_{0};
+	};
+
+	/**
+	 * Row major shape of a tensor, its size is computed once on construction.
+	 */
 	struct shape_t {
-		int rank;
-		vector<uint64_t> dims;
+		int rank{0};
+		shape_dims dims;
+
+		constexpr uint64_t size() const { return size_; }
 
-		uint64_t size() const {
-			std::size_t size = 1;
-			for (auto dim : dims) {
-				size *= dim;
+		constexpr shape_t() = default;
+
+		constexpr shape_t(shape_dims _dims) : rank{static_cast<int>(_dims.size())}, dims{_dims} {
+			if (rank == 0) {
+				dims.push_back(1);
+				rank = 1;
 			}
-			return size;
+			for (auto dim: dims) size_ *= dim;
 		}
-		shape_t() = default;
-
-		/* template<typename IntType, template <typename> class coll> */
-		/* shape(const coll<IntType>& _dims) : */ 
-		/* 	rank{_dims.size()}, dims{} { */
-		/* 		std::copy(_dims.begin(), _dims.end(), dims.begin()); */
-		/* 	} */
-
-		shape_t(vector<uint64_t> _dims) : 
-			rank{_dims.size()}, dims{_dims} {
-				if (rank == 0) {
-					dims.push_back(1);
-					rank = 1;
-				}
-			}
 
-		shape_t(std::integral auto...dims) : 
-			rank{sizeof...(dims)}, dims{dims...} {}
+		shape_t(const vector<uint64_t>& _dims) : shape_t(shape_dims{_dims}) {}
 
-		shape_t operator*(const shape_t& other) const {
-			shape_t result;
-			result.rank = rank + other.rank;
-			result.dims.reserve(result.rank);
-			result.dims.insert(result.dims.end(), dims.begin(), dims.end());
-			result.dims.insert(result.dims.end(), other.dims.begin(), other.dims.end());
+		constexpr shape_t(std::integral auto...dims) :
+			shape_t(shape_dims{static_cast<uint64_t>(dims)...}) {}
+
+		/**
+		 * Elements between consecutive indices of every axis.
+		 */
+		constexpr shape_dims strides() const {
+			shape_dims result = dims;
+			uint64_t stride = 1;
+			for (auto i = dims.size(); i-- > 0;) {
+				result[i] = stride;
+				stride *= dims[i];
+			}
 			return result;
 		}
 
-		uint64_t operator[](int i) const {
+		constexpr shape_t operator*(const shape_t& other) const {
+			shape_dims result = dims;
+			for (auto dim: other.dims) result.push_back(dim);
+			return shape_t{result};
+		}
+
+		constexpr uint64_t operator[](int i) const {
 			return dims[i];
 		}
 
-		friend auto operator<=>(const shape_t&, const shape_t&) = default;
+		friend constexpr auto operator<=>(const shape_t&, const shape_t&) = default;
+
+		private:
+			uint64_t size_{1};
 	};
 	
 
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <rep/rep_types.h>
+#include <rep/ops.h>
+
+namespace plearn::rep {
+
+	/**
+	 * Where the elements of a view are: element (i0, i1, ...) is at
+	 * offset_ + i0*strides_[0] + i1*strides_[1] + ... of the viewed memory.
+	 */
+	struct view_layout {
+		uint64_t offset_{0};
+		shape_dims strides_{};
+	};
+
+	/**
+	 * Whether a view reads its elements in row major order without gaps.
+	 * Axes of size 1 are never stepped over, so their stride does not matter.
+	 */
+	inline bool is_contiguous(const shape_t& shape, const shape_dims& strides) {
+		uint64_t stride = 1;
+		for (auto i = shape.dims.size(); i-- > 0;) {
+			if (shape.dims[i] == 1) continue;
+			if (strides[i] != stride) return false;
+			stride *= shape.dims[i];
+		}
+		return true;
+	}
+
+	/**
+	 * Elements from the first to the last one a view reads, 0 if it is empty.
+	 */
+	inline uint64_t view_extent(const shape_t& shape, const shape_dims& strides) {
+		uint64_t extent = 1;
+		for (unsigned i = 0; i < shape.dims.size(); ++i) {
+			if (shape.dims[i] == 0) return 0;
+			extent += (shape.dims[i] - 1) * strides[i];
+		}
+		return extent;
+	}
+
+	inline shape_t transposed_shape(const shape_t& shape, const std::vector<unsigned>& perm) {
+		auto sorted = perm;
+		std::ranges::sort(sorted);
+		for (unsigned i = 0; i < sorted.size(); ++i) {
+			if (sorted[i] != i || perm.size() != shape.dims.size())
+				throw std::runtime_error("Invalid permutation");
+		}
+		shape_dims dims;
+		for (auto axis: perm) dims.push_back(shape.dims[axis]);
+		return shape_t{dims};
+	}
+
+	inline shape_t sliced_shape(const shape_t& shape, int axis, uint64_t begin, uint64_t end) {
+		if (axis < 0 || axis >= shape.rank || begin > end || end > shape.dims[axis])
+			throw std::runtime_error("Invalid slice");
+		auto dims = shape.dims;
+		dims[axis] = end - begin;
+		return shape_t{dims};
+	}
+
+	inline bool broadcastable(const shape_t& shape, const shape_t& to) {
+		if (shape.rank > to.rank) return false;
+		auto lead = to.rank - shape.rank;
+		for (int i = 0; i < shape.rank; ++i) {
+			if (shape.dims[i] != 1 && shape.dims[i] != to.dims[lead + i]) return false;
+		}
+		return true;
+	}
+
+	/**
+	 * The layout of the output of a view op on an input with the given strides.
+	 * A reshape of an input that is not contiguous has no layout, the input has to be
+	 * copied first.
+	 */
+	inline std::optional<view_layout> view_of(const operation& op, const shape_t& in_shape,
+			const shape_dims& in_strides, const shape_t& out_shape) {
+		view_layout layout;
+		switch (op.type_) {
+			case op_type::reshape:
+				if (!is_contiguous(in_shape, in_strides)) return std::nullopt;
+				layout.strides_ = out_shape.strides();
+				break;
+			case op_type::transpose:
+				for (auto axis: transpose_perm(op, in_shape.rank)) layout.strides_.push_back(in_strides[axis]);
+				break;
+			case op_type::slice:
+				layout.strides_ = in_strides;
+				layout.offset_ = op.iarg1_ * in_strides[op.iarg0_];
+				break;
+			case op_type::broadcast: {
+				auto lead = out_shape.rank - in_shape.rank;
+				for (int i = 0; i < out_shape.rank; ++i) {
+					bool repeated = i < lead || in_shape.dims[i - lead] != out_shape.dims[i];
+					layout.strides_.push_back(repeated ? 0 : in_strides[i - lead]);
+				}
+				break;
+			}
+			default:
+				throw std::runtime_error("Not a view op");
+		}
+		return layout;
+	}
+
+}
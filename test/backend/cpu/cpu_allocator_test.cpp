@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include <backend/cpu/cpu_allocator.h>
+#include <backend/cpu/cpu_types.h>
+
+using namespace plearn::backend::cpu;
+
+TEST(CpuAllocator, SizeClasses) {
+	unsigned last = 0;
+	for (uint64_t size = 1; size < 100000; size += size / 7 + 1) {
+		auto cls = buffer_pool::class_of(size);
+		auto cap = buffer_pool::class_size(cls);
+		EXPECT_GE(cap, size);
+		if (size > buffer_pool::min_floats) {
+			EXPECT_LE(cap, size + size / 4);
+			//the next smaller class is too small
+			EXPECT_LT(buffer_pool::class_size(cls - 1), size);
+		}
+		EXPECT_GE(cls, last);
+		last = cls;
+	}
+	EXPECT_EQ(buffer_pool::class_of(uint64_t{1} << 18), buffer_pool::local_classes - 1);
+}
+
+TEST(CpuAllocator, Recycles) {
+	buffer_pool pool;
+	auto a = pool.acquire(1000);
+	EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % buffer_pool::alignment, 0);
+	pool.release(a, 1000);
+	//same class
+	auto b = pool.acquire(1020);
+	EXPECT_EQ(a, b);
+	auto c = pool.acquire(10);
+	auto stats = pool.stats();
+	EXPECT_EQ(stats.heap_allocs_, 2);
+	EXPECT_EQ(stats.reuses_, 1);
+	EXPECT_EQ(stats.in_use_, 2);
+	pool.release(b, 1020);
+	pool.release(c, 10);
+	EXPECT_GT(pool.stats().cached_bytes_, 1000 * sizeof(float));
+	pool.trim();
+	EXPECT_EQ(pool.stats().cached_bytes_, 0);
+}
+
+TEST(CpuAllocator, ThreadCaches) {
+	auto& pool = buffer_pool::global();
+	auto in_use = pool.stats().in_use_;
+	float* released = nullptr;
+	std::thread worker{[&] {
+		released = pool.acquire(500);
+		pool.release(released, 500);
+		//served from the cache of the thread
+		EXPECT_EQ(pool.acquire(500), released);
+		pool.release(released, 500);
+	}};
+	worker.join();
+	//the cache of the thread went back to the pool when it exited
+	EXPECT_EQ(pool.stats().in_use_, in_use);
+	EXPECT_GE(pool.stats().cached_bytes_, 500 * sizeof(float));
+
+	cpu_tensor_factory fac;
+	std::unique_ptr<cpu_tensor> tens{fac.allocate({2, 3})};
+	EXPECT_EQ(pool.stats().in_use_, in_use + 1);
+	tens.reset();
+	EXPECT_EQ(pool.stats().in_use_, in_use);
+}
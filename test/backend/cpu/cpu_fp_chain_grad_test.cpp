@@ -1,19 +1,65 @@
+#include <cmath>
 #include <gtest/gtest.h>
 
 #include "backend/cpu/cpu_types.h"
 #include "backend/cpu/cpu_backend.h"
 #include <backend/cpu/cpu_fp_grad.h>
+#include <environ/exec_env.h>
 
 namespace plearn::backend::cpu {
 
-//NOT USED ANYMORE!
+namespace {
 
-// cpu_backend backend = cpu_backend{};
+	tensor_p sample(exec_env& env, const shape_t& shape, float seed) {
+		auto t = env.create_tensor(shape);
+		for (uint64_t i = 0; i < shape.size(); i++) t->data()[i] = std::sin(seed + 0.37f * i);
+		return t;
+	}
 
-// TEST(CpuFpChainGrad, VecMatMul) {
-// 	operation op = vecmatmul{};	
-// 	/* tensor_p v = backend.create_tensor(shape_t{3}); */
-// }
+}
+
+TEST(CpuFpGrad, MatVecMulDirections) {
+	cpu_backend backend;
+	exec_env env{&backend};
+	const uint64_t M = 3, N = 5, D = 2;
+	auto A = sample(env, shape_t{M, N}, 0.1f), b = sample(env, shape_t{N}, 0.9f);
+	auto dA = sample(env, shape_t{D, M, N}, 1.7f), db = sample(env, shape_t{D, N}, 2.3f);
+	vector<tensor_p> inputs{A, b};
+	auto output = env.create_tensor(shape_t{M});
+	auto dc = env.create_tensor(shape_t{D, M});
+
+	auto fp = backend.create_op_fw_diff_backend(matvecmul{});
+	fp->reset(inputs, output);
+	for (int seeded = 1; seeded < 4; seeded++) {
+		//dA b + A db, zero tangents are null
+		vector<tensor_p> tangents{seeded & 1 ? dA : nullptr, seeded & 2 ? db : nullptr};
+		fp->update_tangent(tangents, dc, D);
+		for (uint64_t d = 0; d < D; d++) {
+			for (uint64_t m = 0; m < M; m++) {
+				float expected = 0;
+				for (uint64_t n = 0; n < N; n++) {
+					if (seeded & 1) expected += dA->data()[(d*M + m)*N + n] * b->data()[n];
+					if (seeded & 2) expected += A->data()[m*N + n] * db->data()[d*N + n];
+				}
+				EXPECT_NEAR(dc->data()[d*M + m], expected, 1e-5) << seeded << " " << d << " " << m;
+			}
+		}
+	}
+}
+
+TEST(CpuFpGrad, SubtrahendOnly) {
+	cpu_backend backend;
+	exec_env env{&backend};
+	auto A = sample(env, shape_t{4}, 0.f), B = sample(env, shape_t{4}, 1.f);
+	auto dB = sample(env, shape_t{3, 4}, 2.f);
+	vector<tensor_p> inputs{A, B};
+	auto output = env.create_tensor(shape_t{4});
+	auto dC = env.create_tensor(shape_t{3, 4});
 
+	auto fp = backend.create_op_fw_diff_backend(sub{});
+	fp->reset(inputs, output);
+	fp->update_tangent({nullptr, dB}, dC, 3);
+	for (int i = 0; i < 12; i++) EXPECT_FLOAT_EQ(dC->data()[i], -dB->data()[i]);
 }
 
+}
@@ -0,0 +1,86 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <backend/cpu/cpu_gemm.h>
+
+using namespace plearn::backend::cpu;
+using plearn::backend::cpu::simd::isa;
+
+namespace {
+
+	std::vector<float> sample(uint64_t len, float seed) {
+		std::vector<float> v(len);
+		for (uint64_t i = 0; i < len; i++) v[i] = std::sin(seed + 0.37f * i);
+		return v;
+	}
+
+	//C [m, k] = op(A) [m, n] x op(B) [n, k] with ldc = k + pad
+	std::vector<float> naive_gemm(const std::vector<float>& A, const std::vector<float>& B,
+			std::vector<float> C, uint64_t m, uint64_t n, uint64_t k, uint64_t ldc,
+			bool add, bool tA, bool tB) {
+		for (uint64_t i = 0; i < m; ++i) {
+			for (uint64_t j = 0; j < k; ++j) {
+				double acc = add ? C[i*ldc + j] : 0;
+				for (uint64_t l = 0; l < n; ++l)
+					acc += (tA ? A[l*m + i] : A[i*n + l]) * (tB ? B[j*n + l] : B[l*k + j]);
+				C[i*ldc + j] = acc;
+			}
+		}
+		return C;
+	}
+
+	std::vector<isa> isas() {
+		std::vector<isa> sets{isa::scalar};
+		if (simd::supported(isa::avx2)) sets.push_back(isa::avx2);
+		return sets;
+	}
+
+}
+
+TEST(CpuGemm, Flags) {
+	//edge tiles in both dimensions, several inner slices and row blocks
+	struct dims { uint64_t m, n, k; };
+	for (auto [m, n, k]: {dims{1, 1, 1}, dims{6, 16, 16}, dims{7, 300, 17}, dims{80, 5, 33},
+			dims{13, 513, 2}}) {
+		auto A = sample(m*n, 0.2f), B = sample(n*k, 1.1f);
+		const uint64_t ldc = k + 3;
+		auto init = sample(m*ldc, 2.5f);
+		for (auto set: isas()) {
+			for (int flags = 0; flags < 8; ++flags) {
+				bool add = flags & 1, tA = flags & 2, tB = flags & 4;
+				auto expected = naive_gemm(A, B, init, m, n, k, ldc, add, tA, tB);
+				auto C = init;
+				gemm::sgemm(A.data(), B.data(), C.data(), m, n, k, tA ? m : n, tB ? n : k, ldc,
+						add, tA, tB, set);
+				for (uint64_t i = 0; i < C.size(); ++i)
+					ASSERT_NEAR(C[i], expected[i], 1e-3) << m << "x" << n << "x" << k
+						<< " flags " << flags << " at " << i;
+			}
+		}
+	}
+}
+
+TEST(CpuGemm, Gemv) {
+	const uint64_t m = 45, n = 70;
+	auto A = sample(m*n, 0.4f), x = sample(std::max(m, n), 1.7f);
+	for (auto set: isas()) {
+		for (bool add: {false, true}) {
+			//x [m] x A [m, n]
+			std::vector<float> vm(n, 1.f), vm_expected(n, add ? 1.f : 0.f);
+			gemm::sgemv_t(x.data(), A.data(), vm.data(), m, n, n, add, set);
+			for (uint64_t j = 0; j < n; ++j) {
+				for (uint64_t i = 0; i < m; ++i) vm_expected[j] += x[i] * A[i*n + j];
+				ASSERT_NEAR(vm[j], vm_expected[j], 1e-3);
+			}
+
+			//A [m, n] x x [n]
+			std::vector<float> mv(m, 1.f), mv_expected(m, add ? 1.f : 0.f);
+			gemm::sgemv(A.data(), x.data(), mv.data(), m, n, n, add, set);
+			for (uint64_t i = 0; i < m; ++i) {
+				for (uint64_t l = 0; l < n; ++l) mv_expected[i] += A[i*n + l] * x[l];
+				ASSERT_NEAR(mv[i], mv_expected[i], 1e-3);
+			}
+		}
+	}
+}
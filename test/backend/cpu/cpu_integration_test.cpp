@@ -1,3 +1,4 @@
+#include <cmath>
 #include <gtest/gtest.h>
 
 #include "backend/cpu/cpu_types.h"
@@ -354,5 +355,314 @@ TEST(CpuBackendIntegration, DiffBw) {
 }
 
 
+TEST(CpuBackendIntegration, DiffBwVjp) {
+	call_graph_builder cg_builder;
+
+	auto inn_id = cg_builder.add_input_node(shape_t{2});
+	auto data1n_id = cg_builder.add_data_node(shape_t{2, 3});
+	auto [op1n_id, flown_id] = 
+		cg_builder.add_op_node(vecmatmul{}, {inn_id, data1n_id}, shape_t{3});
+	auto data2n_id = cg_builder.add_data_node(shape_t{3});
+	auto [op2n_id, outn_id] = 
+		cg_builder.add_op_node(mult{}, {flown_id, data2n_id}, shape_t{3});
+	cg_builder.make_output(outn_id);
+
+	auto cg = cg_builder.build();
+
+	unique_ptr<cpu_backend> backend = std::make_unique<cpu_backend>();
+	unique_ptr<exec_env> env = std::make_unique<exec_env>(backend.get());
+
+	unordered_map<node_id, tensor_p> data_tensors;
+	data_tensors[data1n_id] = env->create_tensor(shape_t{2, 3}, new float[]{1, 2, 3, 4, 5, 6});
+	data_tensors[data2n_id] = env->create_tensor(shape_t{3}, new float[]{1, 2, 3});
+	auto input_ten = env->create_tensor(shape_t{2}, new float[]{1, 2});
+
+	env_section_builder section_builder{env.get(), backend.get(), cg};
+	auto section = section_builder
+		.set_data_tensors(std::move(data_tensors))
+		.set_diff_mode(diff_mode::vjp)
+		.build();
+
+	for (int i = 0; i < 2; ++i)
+	{
+	exec_params params{.calc_diffs = true};
+	params.inputs_[inn_id] = input_ten;
+	params.outputs_[outn_id] = env->create_tensor(shape_t{3});
+	params.cotangents_[outn_id] = env->create_tensor(shape_t{3}, new float[]{1, 1, 2});
+
+	auto result = section->execute(params);
+
+	//internal node = [9,12,15]
+	auto buf = params.outputs_.at(outn_id)->data();
+	EXPECT_FLOAT_EQ(buf[0], 9);
+	EXPECT_FLOAT_EQ(buf[1], 24);
+	EXPECT_FLOAT_EQ(buf[2], 45);
+
+	//cotangent of data2 = internal * seed
+	auto& data2_grad = result.grad_system_->at(data2n_id).at(outn_id).grad_;
+	ASSERT_EQ(data2_grad.in_shape, shape_t{3});
+	auto data2_grad_buf = data2_grad.back_->data();
+	EXPECT_FLOAT_EQ(data2_grad_buf[0], 9);
+	EXPECT_FLOAT_EQ(data2_grad_buf[1], 12);
+	EXPECT_FLOAT_EQ(data2_grad_buf[2], 30);
+
+	//cotangent of data1 = outer(input, data2 * seed)
+	auto data1_grad_buf = result.grad_system_->at(data1n_id).at(outn_id).grad_.back_->data();
+	EXPECT_FLOAT_EQ(data1_grad_buf[0], 1);
+	EXPECT_FLOAT_EQ(data1_grad_buf[1], 2);
+	EXPECT_FLOAT_EQ(data1_grad_buf[2], 6);
+	EXPECT_FLOAT_EQ(data1_grad_buf[3], 2);
+	EXPECT_FLOAT_EQ(data1_grad_buf[4], 4);
+	EXPECT_FLOAT_EQ(data1_grad_buf[5], 12);
+	}
+
+	//without a cotangent the output is seeded with ones
+	{
+	exec_params params{.calc_diffs = true};
+	params.inputs_[inn_id] = input_ten;
+	params.outputs_[outn_id] = env->create_tensor(shape_t{3});
+
+	auto result = section->execute(params);
+
+	auto data2_grad_buf = result.grad_system_->at(data2n_id).at(outn_id).grad_.back_->data();
+	EXPECT_FLOAT_EQ(data2_grad_buf[0], 9);
+	EXPECT_FLOAT_EQ(data2_grad_buf[1], 12);
+	EXPECT_FLOAT_EQ(data2_grad_buf[2], 15);
+	}
 }
 
+
+TEST(CpuBackendIntegration, BatchExecute) {
+	const int batch_size = 4;
+	call_graph_builder cg_builder;
+
+	auto inn_id = cg_builder.add_input_node(shape_t{2});
+	auto data1n_id = cg_builder.add_data_node(shape_t{2, 3});
+	auto [op1n_id, flown1_id] = 
+		cg_builder.add_op_node(vecmatmul{}, {inn_id, data1n_id}, shape_t{3});
+	auto data2n_id = cg_builder.add_data_node(shape_t{3});
+	auto [op2n_id, flown2_id] = 
+		cg_builder.add_op_node(add{}, {flown1_id, data2n_id}, shape_t{3});
+	auto [op3n_id, flown3_id] = 
+		cg_builder.add_op_node(square{}, {flown2_id}, shape_t{3});
+	auto [op4n_id, outn_id] = 
+		cg_builder.add_op_node(reduce_sum{0}, {flown3_id}, shape_t{1});
+	cg_builder.make_output(flown2_id);
+	cg_builder.make_output(outn_id);
+
+	auto cg = cg_builder.build();
+
+	unique_ptr<cpu_backend> backend = std::make_unique<cpu_backend>();
+	unique_ptr<exec_env> env = std::make_unique<exec_env>(backend.get());
+
+	unordered_map<node_id, tensor_p> data_tensors;
+	data_tensors[data1n_id] = env->create_tensor(shape_t{2, 3}, new float[]{1, 2, 3, 4, 5, 6});
+	data_tensors[data2n_id] = env->create_tensor(shape_t{3}, new float[]{1, 0, -1});
+
+	env_section_builder section_builder{env.get(), backend.get(), cg};
+	auto section = section_builder
+		.set_data_tensors(std::move(data_tensors))
+		.build();
+
+	auto input_ten = env->create_tensor(shape_t{batch_size, 2});
+	for (int i = 0; i < 2*batch_size; ++i) input_ten->data()[i] = i;
+
+	exec_params params{.batch_size = batch_size};
+	params.inputs_[inn_id] = input_ten;
+	params.outputs_[flown2_id] = env->create_tensor(shape_t{batch_size, 3}, tensor_init::zero);
+	params.outputs_[outn_id] = env->create_tensor(shape_t{batch_size, 1}, tensor_init::zero);
+	auto result = section->execute(params);
+	ASSERT_TRUE(result.success_);
+
+	//compare against executing the samples one by one
+	for (int b = 0; b < batch_size; ++b) {
+		exec_params single;
+		single.inputs_[inn_id] = env->create_tensor(shape_t{2}, 
+				new float[]{input_ten->data()[2*b], input_ten->data()[2*b + 1]});
+		single.outputs_[flown2_id] = env->create_tensor(shape_t{3}, tensor_init::zero);
+		single.outputs_[outn_id] = env->create_tensor(shape_t{1}, tensor_init::zero);
+		section->execute(single);
+
+		for (int i = 0; i < 3; ++i)
+			EXPECT_FLOAT_EQ(params.outputs_[flown2_id]->data()[3*b + i], 
+					single.outputs_[flown2_id]->data()[i]);
+		EXPECT_FLOAT_EQ(params.outputs_[outn_id]->data()[b], single.outputs_[outn_id]->data()[0]);
+	}
+	//sample 1: [2,3] x W + [1,0,-1] = [15,19,23]
+	EXPECT_FLOAT_EQ(params.outputs_[outn_id]->data()[1], 15*15 + 19*19 + 23*23);
+
+	params.calc_diffs = true;
+	EXPECT_THROW(section->execute(params), std::runtime_error);
+
+	//identity copies every sample, or repeats a shared input over the batch
+	auto identity = operation{op_type::identity};
+	auto copied = env->create_tensor(shape_t{batch_size, 2});
+	backend->exec_batch_op(identity, {input_ten}, copied, batch_size, {true});
+	for (int i = 0; i < 2*batch_size; ++i) EXPECT_FLOAT_EQ(copied->data()[i], i);
+	auto shared = env->create_tensor(shape_t{2}, new float[]{7, 8});
+	auto sample = env->create_tensor(shape_t{2});
+	backend->exec_op(identity, {shared}, sample);
+	EXPECT_FLOAT_EQ(sample->data()[0], 7);
+	EXPECT_FLOAT_EQ(sample->data()[1], 8);
+	auto short_out = env->create_tensor(shape_t{1});
+	EXPECT_THROW(backend->exec_op(identity, {shared}, short_out), std::runtime_error);
+	backend->exec_batch_op(identity, {shared}, copied, batch_size, {false});
+	for (int i = 0; i < 2*batch_size; ++i) EXPECT_FLOAT_EQ(copied->data()[i], 7 + i % 2);
+	EXPECT_THROW(backend->exec_batch_op(noop{}, {input_ten}, copied, batch_size, {true}),
+			std::runtime_error);
+
+	//the tangents of an identity are the ones of its input
+	auto fw_identity = backend->create_op_fw_diff_backend(identity);
+	vector<tensor_p> values{shared};
+	fw_identity->reset(values, shared);
+	auto in_tangent = env->create_tensor(shape_t{2, 2}, new float[]{1, 2, 3, 4});
+	auto out_tangent = env->create_tensor(shape_t{2, 2});
+	fw_identity->update_tangent({in_tangent}, out_tangent, 2);
+	for (int i = 0; i < 4; ++i) EXPECT_FLOAT_EQ(out_tangent->data()[i], i + 1);
+}
+
+
+TEST(CpuBackendIntegration, PlannedMemory) {
+	call_graph_builder cg_builder;
+
+	auto inn_id = cg_builder.add_input_node(shape_t{4});
+	auto wn_id = cg_builder.add_data_node(shape_t{4, 4});
+	auto [op1n_id, flow1n_id] = cg_builder.add_op_node(square{}, {inn_id}, shape_t{4});
+	auto [op2n_id, flow2n_id] = cg_builder.add_op_node(square{}, {flow1n_id}, shape_t{4});
+	auto [op3n_id, flow3n_id] = cg_builder.add_op_node(vecmatmul{}, {flow2n_id, wn_id}, shape_t{4});
+	auto [op4n_id, flow4n_id] = cg_builder.add_op_node(square{}, {flow3n_id}, shape_t{4});
+	auto [op5n_id, flow5n_id] = cg_builder.add_op_node(vecmatmul{}, {flow4n_id, wn_id}, shape_t{4});
+	auto [op6n_id, outn_id] = cg_builder.add_op_node(reduce_sum{0}, {flow5n_id}, shape_t{1});
+	cg_builder.make_output(outn_id);
+
+	auto cg = cg_builder.build();
+
+	unique_ptr<cpu_backend> backend = std::make_unique<cpu_backend>();
+	unique_ptr<exec_env> env = std::make_unique<exec_env>(backend.get());
+
+	unordered_map<node_id, tensor_p> data_tensors;
+	data_tensors[wn_id] = env->create_tensor(shape_t{4, 4}, tensor_init::identity);
+
+	env_section_builder section_builder{env.get(), backend.get(), cg};
+	auto section = section_builder
+		.set_data_tensors(std::move(data_tensors))
+		.build();
+	auto plan = section->plan_memory();
+	ASSERT_LT(plan.peak_bytes(), plan.unplanned_bytes());
+
+	thread_pool pool{2};
+	for (auto run_pool: {(thread_pool*)nullptr, &pool}) {
+		for (int run = 0; run < 2; ++run) {
+			exec_params params{.thread_pool_ = run_pool};
+			params.inputs_[inn_id] = env->create_tensor(shape_t{4}, new float[]{1, 2, 3, 4});
+			params.outputs_[outn_id] = env->create_tensor(shape_t{1}, tensor_init::zero);
+			section->execute(params);
+			//x^8 summed
+			EXPECT_FLOAT_EQ(params.outputs_[outn_id]->data()[0], 1 + 256 + 6561 + 65536);
+		}
+	}
+	(void)op1n_id; (void)op2n_id; (void)op3n_id; (void)op4n_id; (void)op5n_id; (void)op6n_id;
+}
+
+TEST(CpuBackendIntegration, BoundKernels) {
+	cpu_backend backend;
+	exec_env env{&backend};
+	auto sample = [&](const shape_t& shape) {
+		auto tens = env.create_tensor(shape);
+		for (uint64_t i = 0; i < shape.size(); i++) tens->data()[i] = std::sin(0.3f * i + shape.rank);
+		return tens;
+	};
+
+	struct op_case {
+		operation op;
+		vector<shape_t> inputs;
+		shape_t output;
+	};
+	vector<op_case> cases{
+		{matmul{}, {shape_t{3, 4}, shape_t{4, 5}}, shape_t{3, 5}},
+		{vecmatmul{}, {shape_t{4}, shape_t{4, 5}}, shape_t{5}},
+		{matvecmul{}, {shape_t{3, 4}, shape_t{4}}, shape_t{3}},
+		{dense{activation::relu}, {shape_t{4}, shape_t{4, 5}, shape_t{5}}, shape_t{5}},
+		{add{}, {shape_t{3, 4}, shape_t{3, 4}}, shape_t{3, 4}},
+		{sub{}, {shape_t{3, 4}, shape_t{3, 4}}, shape_t{3, 4}},
+		{mult{}, {shape_t{3, 4}, shape_t{3, 4}}, shape_t{3, 4}},
+		{square{}, {shape_t{3, 4}}, shape_t{3, 4}},
+		{dot_product{}, {shape_t{7}, shape_t{7}}, shape_t{1}},
+		{reduce_sum{1}, {shape_t{3, 4, 5}}, shape_t{3, 5}},
+		{reduce_mean{{0, 1}}, {shape_t{3, 4, 5}}, shape_t{5}},
+	};
+	for (auto& c: cases) {
+		vector<tensor_p> inputs;
+		for (auto& shape: c.inputs) inputs.push_back(sample(shape));
+		auto expected = env.create_tensor(c.output);
+		backend.exec_op(c.op, inputs, expected);
+
+		auto output = env.create_tensor(c.output);
+		auto kernel = backend.bind_op(c.op, inputs, output);
+		ASSERT_TRUE(kernel) << static_cast<int>(c.op.type_);
+		kernel();
+		for (uint64_t i = 0; i < c.output.size(); i++)
+			ASSERT_FLOAT_EQ(output->data()[i], expected->data()[i]) << static_cast<int>(c.op.type_);
+	}
+
+	//axes that are not contiguous go through exec_op
+	auto in = sample(shape_t{3, 4, 5});
+	auto out = env.create_tensor(shape_t{4});
+	EXPECT_FALSE(backend.bind_op(reduce_sum{{0, 2}}, {in}, out));
+
+	//transposed views read through the GEMM flags, bound or not
+	auto a = env.transpose(sample(shape_t{4, 3}), {1, 0});
+	auto b = env.transpose(sample(shape_t{5, 4}), {1, 0});
+	ASSERT_TRUE(backend.reads_strided(matmul{}, 0, a) && backend.reads_strided(matmul{}, 1, b));
+	vector<tensor_p> dense{env.materialize(a), env.materialize(b)};
+	auto expected = env.create_tensor(shape_t{3, 5});
+	backend.exec_op(matmul{}, dense, expected);
+	auto unbound = env.create_tensor(shape_t{3, 5});
+	backend.exec_op(matmul{}, {a, b}, unbound);
+	auto bound = env.create_tensor(shape_t{3, 5});
+	backend.bind_op(matmul{}, {a, b}, bound)();
+	for (uint64_t i = 0; i < 15; i++) {
+		EXPECT_FLOAT_EQ(unbound->data()[i], expected->data()[i]) << i;
+		EXPECT_FLOAT_EQ(bound->data()[i], expected->data()[i]) << i;
+	}
+}
+
+TEST(CpuBackendIntegration, Views) {
+	cpu_backend backend;
+	exec_env env{&backend};
+	auto base = env.create_tensor(shape_t{2, 3});
+	for (int i = 0; i < 6; i++) base->data()[i] = i;
+	auto values = [](tensor_p t) {
+		return vector<float>(t->data(), t->data() + t->shape().size());
+	};
+
+	auto transposed = env.transpose(base, {1, 0});
+	EXPECT_EQ(transposed->shape(), shape_t(3, 2));
+	EXPECT_EQ(transposed->strides(), (shape_dims{1, 3}));
+	EXPECT_FALSE(transposed->contiguous());
+	EXPECT_EQ(transposed->data(), base->data());
+	EXPECT_EQ(values(env.materialize(transposed)), (vector<float>{0, 3, 1, 4, 2, 5}));
+
+	auto sliced = env.slice(base, 1, 1, 3);
+	EXPECT_EQ(sliced->data(), base->data() + 1);
+	EXPECT_EQ(values(env.materialize(sliced)), (vector<float>{1, 2, 4, 5}));
+
+	//contiguous views need no copy
+	auto row = env.slice(base, 0, 1, 2);
+	EXPECT_TRUE(row->contiguous());
+	EXPECT_EQ(env.materialize(row), row);
+	auto flat = env.reshape(base, shape_t{6});
+	EXPECT_EQ(flat->data(), base->data());
+
+	//a reshape of a transpose is laid over a copy
+	auto reshaped = env.reshape(transposed, shape_t{6});
+	EXPECT_NE(reshaped->data(), base->data());
+	EXPECT_EQ(values(reshaped), (vector<float>{0, 3, 1, 4, 2, 5}));
+
+	auto repeated = env.broadcast(env.slice(row, 1, 0, 2), shape_t{2, 2, 2});
+	EXPECT_EQ(repeated->strides(), (shape_dims{0, 0, 1}));
+	EXPECT_EQ(values(env.materialize(repeated)), (vector<float>{3, 4, 3, 4, 3, 4, 3, 4}));
+	EXPECT_THROW((void)env.broadcast(base, shape_t{3, 3}), std::runtime_error);
+}
+
+}
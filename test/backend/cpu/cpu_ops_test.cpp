@@ -4,6 +4,7 @@
 #include <gmock/gmock.h>
 #include <immintrin.h>
 #include <new>
+#include <vector>
 
 #include <backend/cpu/cpu_ops.h>
 
@@ -182,6 +183,27 @@ TEST(CpuOpTest, Mult) {
 	delete[] c;
 }
 
+TEST(CpuOpTest, Dense) {
+	//more rows than one block
+	const uint64_t rows = 70, m = 9, n = 13;
+	std::vector<float> X(rows*m), A(m*n), b(n), C(rows*n);
+	for (uint64_t i = 0; i < X.size(); i++) X[i] = (i % 5) - 2.f;
+	for (uint64_t i = 0; i < A.size(); i++) A[i] = (i % 3) - 1.f;
+	for (uint64_t i = 0; i < n; i++) b[i] = i - 6.f;
+
+	for (auto act: {activation::none, activation::relu}) {
+		_cpu_dense(X.data(), A.data(), b.data(), C.data(), rows, m, n, act);
+		for (uint64_t r = 0; r < rows; r++) {
+			for (uint64_t j = 0; j < n; j++) {
+				float expected = b[j];
+				for (uint64_t i = 0; i < m; i++) expected += X[r*m + i] * A[i*n + j];
+				if (act == activation::relu) expected = std::max(expected, 0.f);
+				ASSERT_FLOAT_EQ(C[r*n + j], expected) << r << " " << j;
+			}
+		}
+	}
+}
+
 TEST(CpuOpTest, ReduceSum) {
 	auto a = new (std::align_val_t(32)) float[SIZE];
 	auto b = new (std::align_val_t(32)) float[dim1];
@@ -210,3 +232,74 @@ TEST(CpuOpTest, ReduceMean) {
 	delete[] b;
 }
 
+namespace {
+
+	//sum of A over the axes in `reduced`, by walking every element
+	std::vector<float> naive_reduce(const std::vector<float>& A, const std::vector<uint64_t>& shape,
+			const std::vector<unsigned>& reduced) {
+		std::vector<uint64_t> out_strides(shape.size(), 0);
+		uint64_t stride = 1;
+		for (auto i = shape.size(); i-- > 0;) {
+			if (std::ranges::find(reduced, i) != reduced.end()) continue;
+			out_strides[i] = stride;
+			stride *= shape[i];
+		}
+		std::vector<float> C(stride, 0.f);
+		std::vector<uint64_t> index(shape.size(), 0);
+		for (uint64_t i = 0; i < A.size(); i++) {
+			uint64_t out = 0;
+			for (unsigned d = 0; d < shape.size(); d++) out += index[d] * out_strides[d];
+			C[out] += A[i];
+			for (auto d = shape.size(); d-- > 0;) {
+				if (++index[d] < shape[d]) break;
+				index[d] = 0;
+			}
+		}
+		return C;
+	}
+
+	std::vector<float> iota_sample(uint64_t size) {
+		std::vector<float> A(size);
+		for (uint64_t i = 0; i < size; i++) A[i] = (i % 7) - 3.f;
+		return A;
+	}
+
+}
+
+TEST(CpuOpTest, ReduceAxes) {
+	std::vector<uint64_t> shape{3, 5, 7, 19};
+	auto A = iota_sample(3*5*7*19);
+	std::vector<std::vector<unsigned>> cases{
+		{0}, {1}, {2}, {3}, {0, 1}, {1, 2}, {2, 3}, {0, 2}, {1, 3}, {0, 3}, {0, 1, 3}, {0, 1, 2, 3}};
+	for (auto& axes: cases) {
+		auto expected = naive_reduce(A, shape, axes);
+		uint64_t count = A.size() / expected.size();
+
+		std::vector<float> C(expected.size(), -1.f);
+		_cpu_reduce_sum(A.data(), C.data(), axes, shape);
+		for (uint64_t i = 0; i < C.size(); i++)
+			ASSERT_FLOAT_EQ(C[i], expected[i]) << axes.size() << " axes, first " << axes[0];
+
+		//the mean accumulates the scaled sum into the output
+		std::fill(C.begin(), C.end(), 1.f);
+		_cpu_reduce_mean(A.data(), C.data(), axes, shape, true);
+		for (uint64_t i = 0; i < C.size(); i++)
+			ASSERT_NEAR(C[i], 1.f + expected[i] / count, 1e-5) << axes.size() << " axes, first " << axes[0];
+	}
+}
+
+TEST(CpuOpTest, ReduceThreaded) {
+	plearn::env::thread_pool pool{3};
+	//every kind of split: outer rows, inner rows, and blocks of a single row
+	std::vector<std::vector<uint64_t>> shapes{{512, 1024}, {64, 128, 64}, {300, 2000}};
+	for (auto& shape: shapes) {
+		auto A = iota_sample(shape[0] * shape[1] * (shape.size() > 2 ? shape[2] : 1));
+		for (unsigned axis = 0; axis < shape.size(); axis++) {
+			auto expected = naive_reduce(A, shape, {axis});
+			std::vector<float> C(expected.size());
+			_cpu_reduce_sum(A.data(), C.data(), {axis}, shape, false, &pool);
+			for (uint64_t i = 0; i < C.size(); i++)
+				ASSERT_FLOAT_EQ(C[i], expected[i]) << "axis " << axis;
+		}
+	}
+}
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <backend/cpu/cpu_backend.h>
+#include <backend/cpu/cpu_parallel.h>
+#include <environ/exec_env.h>
+
+using namespace plearn::backend::cpu;
+using plearn::env::thread_pool;
+using plearn::env::exec_env;
+using plearn::env::tensor_p;
+using plearn::rep::shape_t;
+using plearn::rep::add;
+
+namespace {
+
+	std::vector<float> sample(uint64_t len, float seed) {
+		std::vector<float> v(len);
+		for (uint64_t i = 0; i < len; i++) v[i] = std::sin(seed + i);
+		return v;
+	}
+
+	void expect_near(const std::vector<float>& a, const std::vector<float>& b) {
+		ASSERT_EQ(a.size(), b.size());
+		for (uint64_t i = 0; i < a.size(); i++) ASSERT_NEAR(a[i], b[i], 1e-3) << i;
+	}
+
+}
+
+TEST(CpuParallel, ParallelFor) {
+	thread_pool pool{3};
+	std::vector<std::atomic<int>> hits(1000);
+	parallel_for(pool, hits.size(), [&](uint64_t begin, uint64_t end) {
+		//nested splits from the workers are helped with, not waited on
+		parallel_for(pool, end - begin, [&](uint64_t b, uint64_t e) {
+			for (auto i = begin + b; i < begin + e; i++) hits[i]++;
+		});
+	});
+	for (auto& h: hits) EXPECT_EQ(h.load(), 1);
+
+	EXPECT_THROW(parallel_for(pool, 8, [](uint64_t begin, uint64_t) {
+		if (begin > 0) throw std::runtime_error("part failed");
+	}), std::runtime_error);
+}
+
+TEST(CpuParallel, InlineOnOtherPools) {
+	thread_pool intra{2};
+	thread_pool inter{1};
+	std::atomic<bool> inline_run{false};
+	std::atomic<bool> done{false};
+	inter.submit([&] {
+		auto caller = std::this_thread::get_id();
+		bool same = true;
+		parallel_for(intra, 4, [&](uint64_t, uint64_t) {
+			same = same && std::this_thread::get_id() == caller;
+		});
+		inline_run = same;
+		done = true;
+	});
+	while (!done) std::this_thread::yield();
+	EXPECT_TRUE(inline_run);
+}
+
+TEST(CpuParallel, Kernels) {
+	const uint64_t m = 37, n = 29, k = 53;
+	auto A = sample(m*n, 0.1f), B = sample(n*k, 0.7f);
+	auto At = sample(n*m, 0.3f), Bt = sample(k*n, 0.9f);
+	auto x = sample(n, 1.3f), y = sample(4099, 2.1f), z = sample(4099, 3.1f);
+
+	struct results {
+		std::vector<float> mm, mm_wide, mm_t, vm, mv, add, dot, red0, red1;
+	};
+	auto run = [&] {
+		results r{std::vector<float>(m*k), std::vector<float>(2*k), std::vector<float>(m*k),
+			std::vector<float>(k), std::vector<float>(m), std::vector<float>(y.size()),
+			std::vector<float>(1), std::vector<float>(n), std::vector<float>(m)};
+		_cpu_matmul(A.data(), B.data(), r.mm.data(), m, n, k);
+		//fewer rows than columns, split by columns
+		_cpu_matmul(A.data(), B.data(), r.mm_wide.data(), 2, n, k);
+		_cpu_matmul(At.data(), Bt.data(), r.mm_t.data(), m, n, k, false, true, true);
+		_cpu_vecmatmul(x.data(), B.data(), r.vm.data(), n, k);
+		_cpu_matvecmul(A.data(), x.data(), r.mv.data(), m, n);
+		_cpu_add(y.data(), z.data(), r.add.data(), y.size());
+		_cpu_dot_product(y.data(), z.data(), r.dot.data(), y.size());
+		_cpu_reduce_sum(A.data(), r.red0.data(), 0, {m, n});
+		_cpu_reduce_mean(A.data(), r.red1.data(), 1, {m, n});
+		return r;
+	};
+
+	auto serial = run();
+	//every kernel is split
+	cpu_backend backend{{.intra_op_threads = 4, .parallel_threshold = 1}};
+	ASSERT_NE(backend.intra_op_pool(), nullptr);
+	intra_op_scope scope{backend.parallel_settings()};
+	ASSERT_EQ(intra_op().pool_, backend.intra_op_pool());
+	auto split = run();
+
+	expect_near(split.mm, serial.mm);
+	expect_near(split.mm_wide, serial.mm_wide);
+	expect_near(split.mm_t, serial.mm_t);
+	expect_near(split.vm, serial.vm);
+	expect_near(split.mv, serial.mv);
+	expect_near(split.add, serial.add);
+	expect_near(split.dot, serial.dot);
+	expect_near(split.red0, serial.red0);
+	expect_near(split.red1, serial.red1);
+}
+
+TEST(CpuParallel, IndependentBackends) {
+	auto first = std::make_unique<cpu_backend>(
+			cpu_backend_options{.intra_op_threads = 2, .parallel_threshold = 1});
+	auto second = std::make_unique<cpu_backend>(
+			cpu_backend_options{.intra_op_threads = 3, .parallel_threshold = 1});
+	//kernels called outside of a backend run inline
+	EXPECT_EQ(intra_op().pool_, nullptr);
+	{
+		intra_op_scope scope{first->parallel_settings()};
+		EXPECT_EQ(intra_op().pool_, first->intra_op_pool());
+		intra_op_scope inner{second->parallel_settings()};
+		EXPECT_EQ(intra_op().pool_, second->intra_op_pool());
+	}
+	EXPECT_EQ(intra_op().pool_, nullptr);
+
+	auto y = sample(4099, 2.1f), z = sample(4099, 3.1f);
+	std::vector<float> expected(y.size());
+	for (uint64_t i = 0; i < y.size(); i++) expected[i] = y[i] + z[i];
+
+	//destroyed out of creation order, the other backend keeps its own pool
+	first.reset();
+	exec_env env{second.get()};
+	auto tensor_of = [&](const std::vector<float>& values) {
+		auto t = env.create_tensor(shape_t{values.size()});
+		std::copy(values.begin(), values.end(), t->data());
+		return t;
+	};
+	auto values = [&](const tensor_p& t) { return std::vector<float>(t->data(), t->data() + y.size()); };
+	std::vector<tensor_p> inputs{tensor_of(y), tensor_of(z)};
+	auto out = env.create_tensor(shape_t{y.size()});
+	second->exec_op(add{}, inputs, out);
+	expect_near(values(out), expected);
+	auto bound = env.create_tensor(shape_t{y.size()});
+	second->bind_op(add{}, inputs, bound)();
+	expect_near(values(bound), expected);
+
+	second.reset();
+	std::vector<float> serial(y.size());
+	_cpu_add(y.data(), z.data(), serial.data(), y.size());
+	expect_near(serial, expected);
+}
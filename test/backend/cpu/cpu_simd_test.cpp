@@ -0,0 +1,136 @@
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <backend/cpu/cpu_simd.h>
+
+using namespace plearn::backend::cpu;
+
+namespace {
+
+	std::vector<float> sample(uint64_t len, float seed) {
+		std::vector<float> v(len);
+		for (uint64_t i = 0; i < len; i++) v[i] = std::sin(seed + i) * 4;
+		return v;
+	}
+
+	//lengths around the vector widths and unroll factors, with tails
+	const uint64_t lengths[] = {0, 1, 7, 8, 15, 16, 17, 31, 33, 63, 64, 65, 127, 1000};
+
+	const simd::isa sets[] = {simd::isa::avx2, simd::isa::avx512};
+
+}
+
+TEST(CpuSimd, Elementwise) {
+	auto& ref = simd::kernels_for(simd::isa::scalar);
+	for (auto set: sets) {
+		if (!simd::supported(set)) continue;
+		auto& k = simd::kernels_for(set);
+		for (auto len: lengths) {
+			//offset by one, unaligned
+			auto a = sample(len + 1, 0.5f);
+			auto b = sample(len + 1, 1.5f);
+			std::vector<float> expected(len + 1), out(len + 1);
+
+			ref.add(a.data() + 1, b.data() + 1, expected.data(), len);
+			k.add(a.data() + 1, b.data() + 1, out.data(), len);
+			EXPECT_EQ(out, expected) << "add " << len;
+
+			ref.sub(a.data() + 1, b.data() + 1, expected.data(), len);
+			k.sub(a.data() + 1, b.data() + 1, out.data(), len);
+			EXPECT_EQ(out, expected) << "sub " << len;
+
+			ref.mult(a.data() + 1, b.data() + 1, expected.data(), len);
+			k.mult(a.data() + 1, b.data() + 1, out.data(), len);
+			EXPECT_EQ(out, expected) << "mult " << len;
+
+			ref.square(a.data() + 1, expected.data(), len);
+			k.square(a.data() + 1, out.data(), len);
+			EXPECT_EQ(out, expected) << "square " << len;
+
+			//in place
+			auto inplace = a;
+			k.add(inplace.data(), b.data(), inplace.data(), len + 1);
+			ref.add(a.data(), b.data(), expected.data(), len + 1);
+			EXPECT_EQ(inplace, expected) << "inplace " << len;
+		}
+	}
+}
+
+TEST(CpuSimd, Dot) {
+	auto& ref = simd::kernels_for(simd::isa::scalar);
+	for (auto set: sets) {
+		if (!simd::supported(set)) continue;
+		auto& k = simd::kernels_for(set);
+		for (auto len: lengths) {
+			auto a = sample(len, 0.5f);
+			auto b = sample(len, 1.5f);
+			double exact = 0;
+			for (uint64_t i = 0; i < len; i++) exact += (double)a[i] * b[i];
+			//summation order differs
+			auto tolerance = 1e-5 * (len + 1) * 16;
+			EXPECT_NEAR(ref.dot(a.data(), b.data(), len), exact, tolerance) << len;
+			EXPECT_NEAR(k.dot(a.data(), b.data(), len), exact, tolerance) << len;
+		}
+	}
+}
+
+TEST(CpuSimd, Sum) {
+	auto& ref = simd::kernels_for(simd::isa::scalar);
+	for (auto set: sets) {
+		if (!simd::supported(set)) continue;
+		auto& k = simd::kernels_for(set);
+		for (auto len: lengths) {
+			auto a = sample(len + 1, 0.5f);
+			double exact = 0;
+			for (uint64_t i = 1; i <= len; i++) exact += a[i];
+			auto tolerance = 1e-5 * (len + 1) * 4;
+			EXPECT_NEAR(ref.sum(a.data() + 1, len), exact, tolerance) << len;
+			EXPECT_NEAR(k.sum(a.data() + 1, len), exact, tolerance) << len;
+		}
+	}
+}
+
+TEST(CpuSimd, Optimizers) {
+	auto& ref = simd::kernels_for(simd::isa::scalar);
+	simd::sgd_coeffs sgd{0.1f, 0.9f, 0.01f};
+	simd::adam_coeffs adam{0.01f, 0.9f, 0.999f, 1e-8f, 0.f, 0.01f, 1 / (1 - 0.81f), 1 / (1 - 0.998f)};
+	for (auto set: sets) {
+		if (!simd::supported(set)) continue;
+		auto& k = simd::kernels_for(set);
+		for (auto len: lengths) {
+			auto g = sample(len, 0.5f);
+			auto p = sample(len, 1.5f), expected_p = p;
+			auto v = sample(len, 2.5f), expected_v = v;
+			ref.sgd(expected_p.data(), g.data(), expected_v.data(), len, sgd);
+			k.sgd(p.data(), g.data(), v.data(), len, sgd);
+			//fused multiply-adds round once
+			for (uint64_t i = 0; i < len; i++) {
+				EXPECT_NEAR(p[i], expected_p[i], 1e-5) << "sgd " << len << " " << i;
+				EXPECT_NEAR(v[i], expected_v[i], 1e-5) << "sgd " << len << " " << i;
+			}
+			//without momentum
+			auto plain = expected_p;
+			ref.sgd(expected_p.data(), g.data(), nullptr, len, sgd);
+			k.sgd(plain.data(), g.data(), nullptr, len, sgd);
+			for (uint64_t i = 0; i < len; i++) EXPECT_NEAR(plain[i], expected_p[i], 1e-5) << len;
+
+			auto m = sample(len, 3.5f), expected_m = m;
+			for (auto& x: v) x = std::abs(x);
+			expected_v = v;
+			expected_p = p;
+			ref.adam(expected_p.data(), g.data(), expected_m.data(), expected_v.data(), len, adam);
+			k.adam(p.data(), g.data(), m.data(), v.data(), len, adam);
+			for (uint64_t i = 0; i < len; i++) {
+				EXPECT_NEAR(p[i], expected_p[i], 1e-5) << "adam " << len << " " << i;
+				EXPECT_NEAR(m[i], expected_m[i], 1e-5) << "adam " << len << " " << i;
+				EXPECT_NEAR(v[i], expected_v[i], 1e-4) << "adam " << len << " " << i;
+			}
+		}
+	}
+}
+
+TEST(CpuSimd, Dispatch) {
+	EXPECT_TRUE(simd::supported(simd::best_isa()));
+	EXPECT_EQ(&simd::active(), &simd::kernels_for(simd::best_isa()));
+}
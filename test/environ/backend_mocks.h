@@ -32,6 +32,10 @@ class MockBackend : public backend_t {
 		unique_ptr<tensor_back_t> create_tensor(const shape_t& s, float*) override {
 			return std::make_unique<MockTensorBack>(s, tensor_init::no_init);
 		}
+
+		unique_ptr<tensor_back_t> create_view(tensor_back_t&, uint64_t, const shape_t& s) override {
+			return std::make_unique<MockTensorBack>(s, tensor_init::no_init);
+		}
 		unique_ptr<fw_op_diff_backend_t> create_op_fw_diff_backend(
 				const operation&  ) override { return nullptr; }
 
@@ -50,6 +54,10 @@ class MockExecEnv : public exec_env {
 			auto back_tensor = std::make_unique<MockTensorBack>(s, init);
 			return tens_fac_.create(s, std::move(back_tensor));
 		}
+		tensor_p create_view(const tensor_p&, uint64_t, const shape_t& s) override {
+			auto back_tensor = std::make_unique<MockTensorBack>(s, tensor_init::no_init);
+			return tens_fac_.create(s, std::move(back_tensor));
+		}
 
 };
 
@@ -60,7 +68,7 @@ class MockBwOpDiffBackend : public bw_op_diff_backend_t {
 				(const vector<tensor_p>& inputs, const tensor_p& output)
 				, (override));
 		MOCK_METHOD(void, update_grad,
-				(unsigned input_idx, const gradient& out_grad, gradient& var_out_grad)
+				(unsigned input_idx, const gradient& out_grad, gradient& var_out_grad, bool accumulate)
 				, (override));
 };
 
@@ -8,7 +8,6 @@
 #include "rep/call_graph.h"
 #include "rep/diff_info.h"
 #include "rep/rep_types.h"
-#include <environ/fp_diff_env.h>
 #include <environ/bw_diff_page.h>
 #include <memory>
 
@@ -64,6 +63,46 @@ TEST(BwDiffEnv, Builder) {
 			tensor_init::identity);
 }
 
+TEST(BwDiffEnv, BuilderVjp) {
+	call_graph_builder cg_builder;
+
+	auto inn_id = cg_builder.add_input_node(shape_t{2});
+	auto data1n_id = cg_builder.add_data_node(shape_t{2, 3});
+	auto [op1n_id, flown_id] = 
+		cg_builder.add_op_node(vecmatmul{}, {inn_id, data1n_id}, shape_t{3});
+	auto data2n_id = cg_builder.add_data_node(shape_t{3, 4});
+	auto [op2n_id, outn_id] = 
+		cg_builder.add_op_node(vecmatmul{}, {flown_id, data2n_id}, shape_t{4});
+	cg_builder.make_output(outn_id);
+
+	auto cg = cg_builder.build();
+
+	auto diff_graph = diff_info_builder(cg)
+		.all_data_nodes().find_dependencies().build();
+
+	auto mock_backend = std::make_unique<MockBackend>();
+
+	auto bw_diff_page = bw_diff_page_builder(cg, diff_graph.get(), mock_backend.get())
+		.mode(diff_mode::vjp)
+		.build();
+
+	auto grad_sys = bw_diff_page->get_grad_system();
+	ASSERT_EQ(grad_sys->size(), 5);
+
+	//cotangents have the shape of the node, not node * output
+#define MOCK_TENSOR_BACK(node_id) ((MockTensorBack*)(*grad_sys)[node_id][outn_id].grad_.back_.get())
+	ASSERT_EQ(MOCK_TENSOR_BACK(outn_id)->shape_, shape_t{4});
+	ASSERT_EQ(MOCK_TENSOR_BACK(flown_id)->shape_, shape_t{3});
+	ASSERT_EQ(MOCK_TENSOR_BACK(data1n_id)->shape_, shape_t(2,3));
+	ASSERT_EQ(MOCK_TENSOR_BACK(data2n_id)->shape_, shape_t(3,4));
+#undef MOCK_TENSOR_BACK
+
+	auto& data1_grad = (*grad_sys)[data1n_id][outn_id].grad_;
+	ASSERT_EQ(data1_grad.out_shape, shape_t{4});
+	ASSERT_EQ(data1_grad.cols(), 1);
+	ASSERT_FALSE((*grad_sys)[outn_id][outn_id].identity_);
+}
+
 TEST(BwDiffEnv, OpDiffEnvExecute) {
 	auto exec_env = MockExecEnv();
 	unique_ptr<MockBwOpDiffBackend> mock_diff_backend = std::make_unique<MockBwOpDiffBackend>();
@@ -86,7 +125,7 @@ TEST(BwDiffEnv, OpDiffEnvExecute) {
 	in_grad_maps.push_back(in_grad_map2.get());
 
 	EXPECT_CALL(*mock_diff_backend, reset(_,_));
-	EXPECT_CALL(*mock_diff_backend, update_grad(_,_,_)).Times(2);
+	EXPECT_CALL(*mock_diff_backend, update_grad(_,_,_,false)).Times(2);
 
 	bw_op_diff_env bw_op_de{std::move(mock_diff_backend), &out_grad_map, std::move(in_grad_maps)};
 
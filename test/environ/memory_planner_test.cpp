@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+#include <rep/call_graph_runner.h>
+#include <rep/compiled_graph.h>
+#include <environ/memory_planner.h>
+#include <environ/checkpointing.h>
+#include <environ/env_section.h>
+
+namespace plearn::env {
+
+TEST(MemoryPlanner, Plan) {
+	call_graph_builder builder;
+
+	auto inn_id = builder.add_input_node(shape_t{4});
+	auto datan_id = builder.add_data_node(shape_t{4});
+	auto wn_id = builder.add_data_node(shape_t{4, 4});
+	[[maybe_unused]] auto [op1n_id, flow1n_id] = builder.add_op_node(mult{}, {inn_id, datan_id}, shape_t{4});
+	[[maybe_unused]] auto [op2n_id, flow2n_id] = builder.add_op_node(square{}, {flow1n_id}, shape_t{4});
+	[[maybe_unused]] auto [op3n_id, flow3n_id] = builder.add_op_node(vecmatmul{}, {flow2n_id, wn_id}, shape_t{4});
+	[[maybe_unused]] auto [op4n_id, flow4n_id] = builder.add_op_node(square{}, {flow3n_id}, shape_t{4});
+	[[maybe_unused]] auto [op5n_id, flow5n_id] = builder.add_op_node(vecmatmul{}, {flow4n_id, wn_id}, shape_t{4});
+	[[maybe_unused]] auto [op6n_id, flow6n_id] = builder.add_op_node(square{}, {flow5n_id}, shape_t{4});
+	[[maybe_unused]] auto [op7n_id, outn_id] = builder.add_op_node(reduce_sum{0}, {flow6n_id}, shape_t{1});
+	builder.make_output(outn_id);
+
+	auto cg = builder.build();
+	auto schedule = call_graph_schedule::forward(cg);
+
+	auto plan = memory_planner{cg, schedule}.build();
+	ASSERT_EQ(plan.blocks_.size(), 6);
+	//squares take over the buffer of their input
+	EXPECT_EQ(plan.blocks_.at(flow1n_id).offset_, plan.blocks_.at(flow2n_id).offset_);
+	EXPECT_EQ(plan.blocks_.at(flow3n_id).offset_, plan.blocks_.at(flow4n_id).offset_);
+	EXPECT_EQ(plan.blocks_.at(flow5n_id).offset_, plan.blocks_.at(flow6n_id).offset_);
+	//the input of a matmul is alive while its output is written
+	EXPECT_FALSE(plan.blocks_.at(flow2n_id).overlaps(plan.blocks_.at(flow3n_id)));
+	EXPECT_FALSE(plan.blocks_.at(flow4n_id).overlaps(plan.blocks_.at(flow5n_id)));
+	//flow5 reuses the memory of flow1
+	EXPECT_EQ(plan.blocks_.at(flow5n_id).offset_, plan.blocks_.at(flow1n_id).offset_);
+	EXPECT_EQ(plan.arena_size_, 12);
+	EXPECT_EQ(plan.peak_bytes(), 12 * sizeof(float));
+	EXPECT_EQ(plan.unplanned_bytes(), 24 * sizeof(float));
+
+	auto batch_plan = memory_planner{cg, schedule}.batch_size(2).build();
+	EXPECT_EQ(batch_plan.arena_size_, 16);
+
+	//nothing is shared
+	auto kept_plan = memory_planner{cg, schedule}.keep_alive(true).build();
+	for (auto& [id, block]: kept_plan.blocks_) {
+		for (auto& [other_id, other_block]: kept_plan.blocks_) {
+			if (id != other_id) {
+				EXPECT_FALSE(block.overlaps(other_block));
+			}
+		}
+	}
+	EXPECT_GE(kept_plan.peak_bytes(), kept_plan.unplanned_bytes());
+}
+
+TEST(MemoryPlanner, Checkpoints) {
+	call_graph_builder builder;
+	auto inn_id = builder.add_input_node(shape_t{16});
+	vector<node_id> flow_ids;
+	auto prev = inn_id;
+	for (int i = 0; i < 8; i++) {
+		auto [_, flown_id] = builder.add_op_node(square{}, {prev}, shape_t{16});
+		flow_ids.push_back(flown_id);
+		prev = flown_id;
+	}
+	auto [_, outn_id] = builder.add_op_node(reduce_sum{0}, {prev}, shape_t{1});
+	builder.make_output(outn_id);
+	auto cg = builder.build();
+	auto schedule = call_graph_schedule::forward(cg);
+
+	//the checkpoints are kept, the other tensors share memory
+	unordered_set<node_id> checkpoints{flow_ids[2], flow_ids[5]};
+	auto plan = memory_planner{cg, schedule}.checkpoints(checkpoints).build();
+	ASSERT_EQ(plan.blocks_.size(), 8);
+	for (int i: {2, 5}) {
+		for (int later = i + 1; later < 8; later++) {
+			EXPECT_FALSE(plan.blocks_.at(flow_ids[i]).overlaps(plan.blocks_.at(flow_ids[later])))
+				<< i << " " << later;
+		}
+	}
+	auto kept_plan = memory_planner{cg, schedule}.keep_alive(true).build();
+	EXPECT_EQ(kept_plan.arena_size_, 8 * 16);
+	EXPECT_LT(plan.arena_size_, kept_plan.arena_size_);
+
+	//everything fits, nothing is recomputed
+	compiled_graph graph{cg, schedule};
+	auto all = select_checkpoints(cg, graph, 8 * 16 * sizeof(float));
+	EXPECT_EQ(all.size(), 8);
+	//of the plans fitting in 5 tensors, storing every other tensor recomputes least
+	auto some = select_checkpoints(cg, graph, 5 * 16 * sizeof(float));
+	EXPECT_EQ(some.size(), 4);
+	//nothing fits, segments of two tensors and two stored need the least memory
+	auto least = select_checkpoints(cg, graph, 1);
+	EXPECT_EQ(least.size(), 2);
+
+	//the buffers of the recomputed segments, none if every tensor is stored
+	EXPECT_EQ(segment_recomputer::buffer_bytes(cg, graph, all), 0);
+	EXPECT_GT(segment_recomputer::buffer_bytes(cg, graph, some), 0);
+	EXPECT_GT(segment_recomputer::buffer_bytes(cg, graph, least),
+			segment_recomputer::buffer_bytes(cg, graph, some));
+	//a section storing every tensor is not checkpointed
+	auto ample = env_section_builder{nullptr, nullptr, cg}
+		.set_checkpoint_budget(8 * 16 * sizeof(float)).build();
+	EXPECT_FALSE(ample->checkpointed());
+	EXPECT_EQ(ample->recompute_bytes(), 0);
+	auto tight = env_section_builder{nullptr, nullptr, cg}
+		.set_checkpoint_budget(5 * 16 * sizeof(float)).build();
+	EXPECT_TRUE(tight->checkpointed());
+	EXPECT_EQ(tight->recompute_bytes(), segment_recomputer::buffer_bytes(cg, graph, some));
+}
+
+}
@@ -1,6 +1,8 @@
 #include "model/layers.h"
 #include "rep/ops.h"
 #include "rep/rep_types.h"
+#include <array>
+#include <cmath>
 #include <gtest/gtest.h>
 
 #include <model/model.h>
@@ -39,6 +41,34 @@ TEST(Model, Execute) {
 }
 
 
+TEST(Model, ReduceAxes) {
+	Model m;
+	auto input = m.add_input({2, 3, 2});
+	auto variable = m.add_variable({2, 3, 2});
+
+	auto prod = input * variable;
+	auto reduce = prod.reduce_mean({0, 2});
+	ASSERT_EQ(reduce->shape(), shape_t{3});
+
+	m.set_output(reduce);
+	m.compile({.mode = diff_mode::vjp});
+
+	variable.set_tensor(Tensors::create({2, 3, 2}, new float[]{1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}));
+	auto input_ten = Tensors::create({2, 3, 2}, new float[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12});
+	auto output = m.execute({input_ten}, true);
+
+	auto out_data = output.tensor_of(reduce)->data();
+	EXPECT_FLOAT_EQ(out_data[0], (1 + 2 + 7 + 8) / 4.f);
+	EXPECT_FLOAT_EQ(out_data[1], (3 + 4 + 9 + 10) / 4.f);
+	EXPECT_FLOAT_EQ(out_data[2], (5 + 6 + 11 + 12) / 4.f);
+
+	//d mean / d variable is input / 4, summed over the output in vjp mode
+	auto diffs = output.grad_of(variable, reduce).data();
+	for (int i = 0; i < 12; i++)
+		EXPECT_FLOAT_EQ(diffs[i], (i + 1) / 4.f);
+}
+
+
 TEST(Model, Layers) {
 	Model m;
 	auto input = m.add_input({3});
@@ -61,5 +91,653 @@ TEST(Model, Layers) {
 	ASSERT_EQ(out_diffs[2], 6);
 }
 
+
+TEST(Model, DenseRelu) {
+	Model m;
+	auto input = m.add_input({3});
+	auto dense = DenseLayer(input, 2, {.act = activation::relu});
+	auto output = dense.output();
+	m.compile();
+
+	dense.set_tensors(Tensors::create({3, 2}, new float[]{1, -1, 0, 1, 1, -1}), 
+					  Tensors::create({2}, new float[]{0, -10}));
+	auto result = m.execute({Tensors::create({3}, new float[]{1, 2, 3})}, true);
+
+	//pre-activations 4 and -12
+	auto out_data = result.tensor_of(output)->data();
+	EXPECT_FLOAT_EQ(out_data[0], 4);
+	EXPECT_FLOAT_EQ(out_data[1], 0);
+
+	//Jacobians, d out_j / d A_ik = x_i if j == k and out_j > 0
+	auto A_diffs = result.grad_of(dense.A(), output).data();
+	for (int i = 0; i < 3; i++) {
+		for (int k = 0; k < 2; k++) {
+			for (int j = 0; j < 2; j++) {
+				EXPECT_FLOAT_EQ(A_diffs[(i*2 + k)*2 + j], j == k && j == 0 ? i + 1 : 0);
+			}
+		}
+	}
+	auto b_diffs = result.grad_of(dense.b(), output).data();
+	EXPECT_FLOAT_EQ(b_diffs[0], 1);
+	EXPECT_FLOAT_EQ(b_diffs[1], 0);
+	EXPECT_FLOAT_EQ(b_diffs[2], 0);
+	EXPECT_FLOAT_EQ(b_diffs[3], 0);
+
+	auto batch = m.execute({Tensors::create({2, 3}, new float[]{1, 2, 3, -1, -2, -3})});
+	auto batch_data = batch.tensor_of(output)->data();
+	EXPECT_FLOAT_EQ(batch_data[0], 4);
+	EXPECT_FLOAT_EQ(batch_data[1], 0);
+	EXPECT_FLOAT_EQ(batch_data[2], 0);
+	EXPECT_FLOAT_EQ(batch_data[3], 0);
 }
 
+
+TEST(Model, BatchExecute) {
+	Model m;
+	auto input = m.add_input({3});
+	auto dense = DenseLayer(input, 2);
+	auto output = dense.output();
+	m.compile();
+
+	dense.set_tensors(Tensors::create({3, 2}, new float[]{1, 0, 0, 1, 1, 1}), 
+					  Tensors::create({2}, new float[]{1, -1}));
+	auto input_t = Tensors::create({2, 3}, new float[]{1, 2, 3, 4, 5, 6});
+	auto result = m.execute({input_t});
+
+	auto out = result.tensor_of(output);
+	ASSERT_EQ(out->shape(), shape_t(2, 2));
+	auto out_data = out->data();
+	EXPECT_FLOAT_EQ(out_data[0], 1 + 3 + 1);
+	EXPECT_FLOAT_EQ(out_data[1], 2 + 3 - 1);
+	EXPECT_FLOAT_EQ(out_data[2], 4 + 6 + 1);
+	EXPECT_FLOAT_EQ(out_data[3], 5 + 6 - 1);
+
+	EXPECT_THROW(m.execute({Tensors::create({2, 4})}), std::runtime_error);
+}
+
+
+TEST(Model, Fusion) {
+	const uint64_t rows = 5, cols = 300;
+	struct Graph {
+		Model m;
+		Model::ModelTensor input, variable, mean_out, sum_out;
+	};
+	auto build = [&](Graph& g, bool fuse) {
+		g.input = g.m.add_input({rows, cols});
+		g.variable = g.m.add_variable({rows, cols});
+		//one block reducing the innermost axis, one the leading axis
+		g.mean_out = ((g.input - g.variable) * g.input).square().reduce_mean(1);
+		g.sum_out = (g.input * g.variable + g.input).reduce_sum(0);
+		g.m.set_output(g.mean_out);
+		g.m.set_output(g.sum_out);
+		g.m.compile({.mode = diff_mode::vjp, .fuse = fuse});
+		auto var = Tensors::create({rows, cols});
+		for (uint64_t i = 0; i < rows*cols; i++) var->data()[i] = std::cos(i * 0.1f);
+		g.variable.set_tensor(var);
+	};
+	Graph fused, plain;
+	build(fused, true);
+	build(plain, false);
+	EXPECT_LT(fused.m.planned_memory_bytes(), plain.m.planned_memory_bytes());
+
+	auto input = [&](uint64_t batch) {
+		auto shape = batch == 1 ? shape_t{rows, cols} : shape_t{batch, rows, cols};
+		auto t = Tensors::create(shape);
+		for (uint64_t i = 0; i < shape.size(); i++) t->data()[i] = std::sin(i * 0.3f);
+		return t;
+	};
+	auto expect_near = [](tensor_p a, tensor_p b) {
+		ASSERT_EQ(a->shape(), b->shape());
+		for (uint64_t i = 0; i < a->shape().size(); i++)
+			ASSERT_NEAR(a->data()[i], b->data()[i], 1e-4) << i;
+	};
+
+	auto f = fused.m.execute({input(1)}, true);
+	auto p = plain.m.execute({input(1)}, true);
+	expect_near(f.tensor_of(fused.mean_out), p.tensor_of(plain.mean_out));
+	expect_near(f.tensor_of(fused.sum_out), p.tensor_of(plain.sum_out));
+	for (auto [fo, po]: {std::pair{fused.mean_out, plain.mean_out}, {fused.sum_out, plain.sum_out}}) {
+		auto& fg = f.grad_of(fused.variable, fo);
+		auto& pg = p.grad_of(plain.variable, po);
+		for (uint64_t i = 0; i < rows*cols; i++)
+			ASSERT_NEAR(fg.data()[i], pg.data()[i], 1e-4) << i;
+	}
+
+	auto fb = fused.m.execute({input(3)});
+	auto pb = plain.m.execute({input(3)});
+	expect_near(fb.tensor_of(fused.mean_out), pb.tensor_of(plain.mean_out));
+	expect_near(fb.tensor_of(fused.sum_out), pb.tensor_of(plain.sum_out));
+}
+
+
+TEST(Model, ParallelExecute) {
+	Model m;
+	auto input = m.add_input({3});
+	//two independent towers joined at the end
+	auto left = DenseLayer(input, 2);
+	auto right = DenseLayer(input, 2);
+	auto left_out = left.output();
+	auto right_out = right.output();
+	auto output = (left_out + right_out).reduce_sum(0);
+	m.unset_output(left_out);
+	m.unset_output(right_out);
+	m.set_output(output);
+	m.compile({.inter_op_threads = 2});
+
+	left.set_tensors(Tensors::create({3, 2}, new float[]{1, 0, 0, 1, 1, 1}), 
+					 Tensors::create({2}, new float[]{1, -1}));
+	right.set_tensors(Tensors::create({3, 2}, new float[]{2, 0, 0, 2, 0, 0}), 
+					  Tensors::create({2}, new float[]{0, 0}));
+
+	for (int run = 0; run < 10; ++run) {
+		auto input_t = Tensors::create({3}, new float[]{1, 2, 3});
+		auto result = m.execute({input_t}, true);
+		//left: [5, 4], right: [2, 4]
+		EXPECT_FLOAT_EQ(result.tensor_of(output)->data()[0], 15);
+		auto diffs = result.grad_of(right.A(), output).data();
+
+		EXPECT_FLOAT_EQ(diffs[0], 1);
+		EXPECT_FLOAT_EQ(diffs[1], 1);
+		EXPECT_FLOAT_EQ(diffs[5], 3);
+	}
+}
+
+
+TEST(Model, RepeatedDiffs) {
+	Model m;
+	auto input = m.add_input({3});
+	auto variable = m.add_variable({3});
+
+	//difference is consumed twice, its gradient is accumulated
+	auto difference = input - variable;
+	auto sum = difference.square() + difference;
+	auto reduce = sum.reduce_sum(0);
+
+	m.set_output(reduce);
+	m.compile();
+
+	variable.set_tensor(Tensors::create({3}, new float[]{1, 2, 3}));
+
+	for (int run = 0; run < 3; ++run) {
+		auto output = m.execute({Tensors::create({3}, new float[]{2,4,6})}, true);
+		EXPECT_FLOAT_EQ(output.tensor_of(reduce)->data()[0], 1 + 4 + 9 + 1 + 2 + 3);
+		auto diffs = output.grad_of(variable, reduce).data();
+		EXPECT_FLOAT_EQ(diffs[0], -3);
+		EXPECT_FLOAT_EQ(diffs[1], -5);
+		EXPECT_FLOAT_EQ(diffs[2], -7);
+	}
+}
+
+
+TEST(Model, PooledBuffers) {
+	Model m;
+	auto input = m.add_input({3});
+	auto dense = DenseLayer(input, 40);
+	auto output = dense.output().reduce_sum(0);
+	m.set_output(output);
+	m.compile();
+	dense.set_tensors(Tensors::create({3, 40}), Tensors::create({40}));
+
+	auto& pool = backend::cpu::buffer_pool::global();
+	auto input_t = Tensors::create({3}, new float[]{1, 2, 3});
+	//the section keeps the outputs of the last run bound until the next one
+	for (int run = 0; run < 2; ++run) m.execute({input_t});
+	//outputs of later runs reuse the released buffers
+	auto heap_allocs = pool.stats().heap_allocs_;
+	for (int run = 0; run < 5; ++run) m.execute({input_t});
+	EXPECT_EQ(pool.stats().heap_allocs_, heap_allocs);
+}
+
+
+TEST(Model, ExternalBuffers) {
+	int deleted = 0;
+	{
+		Model m;
+		auto input = m.add_input({3});
+		auto variable = m.add_variable({3});
+		auto reduce = (input * variable).reduce_sum(0);
+		m.set_output(reduce);
+		m.compile();
+
+		//the variable frees its memory through the deleter
+		variable.set_tensor(Tensors::create({3}, new float[]{1, 2, 3}, [&deleted](float* data) {
+			++deleted;
+			delete [] data;
+		}));
+
+		//inputs read the caller memory directly
+		std::vector<float> request{1, 1, 1};
+		auto input_t = Tensors::create({3}, request.data(), ownership::borrowed);
+		EXPECT_EQ(input_t->data(), request.data());
+		EXPECT_FLOAT_EQ(m.execute({input_t}).tensor_of(reduce)->data()[0], 6);
+		request[2] = 2;
+		EXPECT_FLOAT_EQ(m.execute({input_t}).tensor_of(reduce)->data()[0], 9);
+		EXPECT_EQ(deleted, 0);
+	}
+	EXPECT_EQ(deleted, 1);
+}
+
+
+TEST(Model, ExecContext) {
+	Model m;
+	auto input = m.add_input({3});
+	auto dense = DenseLayer(input, 2);
+	auto output = dense.output();
+	m.compile();
+	dense.set_tensors(Tensors::create({3, 2}, new float[]{1, 0, 0, 1, 1, 1}),
+					  Tensors::create({2}, new float[]{1, -1}));
+
+	auto ctx = m.create_context();
+	auto& pool = backend::cpu::buffer_pool::global();
+	auto heap_allocs = pool.stats().heap_allocs_;
+	for (float x = 0; x < 3; ++x) {
+		std::copy_n(std::array{x, 2.f, 3.f}.begin(), 3, ctx.input(0)->data());
+		ctx.execute();
+		auto out = ctx.tensor_of(output)->data();
+		EXPECT_FLOAT_EQ(out[0], x + 3 + 1);
+		EXPECT_FLOAT_EQ(out[1], 2 + 3 - 1);
+	}
+	EXPECT_EQ(pool.stats().heap_allocs_, heap_allocs);
+
+	//caller buffers, and variables replaced after the context was created
+	std::vector<float> in{1, 1, 1}, out(2);
+	ctx.bind_input(0, Tensors::create({3}, in.data(), ownership::borrowed));
+	ctx.bind_output(0, Tensors::create({2}, out.data(), ownership::borrowed));
+	dense.set_tensors(Tensors::create({3, 2}, new float[]{1, 1, 1, 1, 1, 1}),
+					  Tensors::create({2}, new float[]{0, 0}));
+	ctx.execute();
+	EXPECT_FLOAT_EQ(out[0], 3);
+	EXPECT_FLOAT_EQ(out[1], 3);
+	EXPECT_THROW(ctx.bind_output(0, Tensors::create({3})), std::runtime_error);
+
+	auto batch_ctx = m.create_context(2);
+	ASSERT_EQ(batch_ctx.input(0)->shape(), shape_t(2, 3));
+	std::copy_n(std::array{1.f, 2.f, 3.f, 4.f, 5.f, 6.f}.begin(), 6, batch_ctx.input(0)->data());
+	batch_ctx.execute();
+	auto batch_out = batch_ctx.output(0)->data();
+	EXPECT_FLOAT_EQ(batch_out[1], 1 + 2 + 3);
+	EXPECT_FLOAT_EQ(batch_out[2], 4 + 5 + 6);
+}
+
+TEST(Model, Views) {
+	Model m;
+	auto input = m.add_input({2, 3});
+	auto weights = m.add_variable({2, 4});
+	auto bias = m.add_variable({4});
+	//the GEMM reads the transposed input, the broadcast bias is copied for the add
+	auto product = input.transpose().matmul(weights);
+	auto biased = product.slice(0, 1, 3) + bias.broadcast({2, 4});
+	auto flat = biased.reshape({8});
+	m.set_output(flat);
+	m.compile({.mode = diff_mode::vjp});
+
+	auto W = Tensors::create({2, 4});
+	for (int i = 0; i < 8; i++) W->data()[i] = i * 0.5f - 1;
+	weights.set_tensor(W);
+	bias.set_tensor(Tensors::create({4}, new float[]{1, 2, 3, 4}));
+
+	auto x = [](int b, int i, int j) { return (b + 1) * (i * 3 + j + 1.f); };
+	auto expected = [&](int b, int r, int k) {
+		return x(b, 0, r + 1) * W->data()[k] + x(b, 1, r + 1) * W->data()[4 + k] + k + 1;
+	};
+	auto input_ten = Tensors::create({2, 3});
+	for (int i = 0; i < 6; i++) input_ten->data()[i] = x(0, i / 3, i % 3);
+
+	auto result = m.execute({input_ten}, true);
+	auto out = result.tensor_of(flat)->data();
+	for (int i = 0; i < 8; i++) EXPECT_FLOAT_EQ(out[i], expected(0, i / 4, i % 4)) << i;
+
+	//seeded with ones, the bias is repeated over two rows and the weights see the sliced columns of the input
+	auto bias_grad = result.grad_of(bias, flat).data();
+	for (int k = 0; k < 4; k++) EXPECT_FLOAT_EQ(bias_grad[k], 2);
+	auto weights_grad = result.grad_of(weights, flat).data();
+	for (int i = 0; i < 8; i++)
+		EXPECT_FLOAT_EQ(weights_grad[i], x(0, i / 4, 1) + x(0, i / 4, 2)) << i;
+	auto cotangent = Tensors::create({8});
+	EXPECT_THROW((void)m.execute({input_ten}, true, {cotangent, cotangent}), std::runtime_error);
+
+	//without diffs the views are laid over the tensors they view
+	auto batch = Tensors::create({2, 2, 3});
+	for (int i = 0; i < 12; i++) batch->data()[i] = x(i / 6, i / 3 % 2, i % 3);
+	auto batch_out = m.execute({batch}).tensor_of(flat)->data();
+	for (int i = 0; i < 16; i++)
+		EXPECT_FLOAT_EQ(batch_out[i], expected(i / 8, i / 4 % 2, i % 4)) << i;
+
+	auto ctx = m.create_context();
+	ctx.bind_input(0, input_ten);
+	ctx.execute();
+	for (int i = 0; i < 8; i++)
+		EXPECT_FLOAT_EQ(ctx.tensor_of(flat)->data()[i], expected(0, i / 4, i % 4)) << i;
+}
+
+TEST(Model, StridedDiffs) {
+	Model m;
+	auto input = m.add_input({2, 3});
+	auto weights = m.add_variable({3, 2});
+	auto mixing = m.add_variable({2, 2});
+	//the backward pass of the second product reads the input and the first weights
+	auto out = input.matmul(weights).matmul(mixing);
+	m.set_output(out);
+	m.compile({.mode = diff_mode::vjp});
+
+	auto filled = [](const shape_t& shape, float scale) {
+		auto t = Tensors::create(shape);
+		for (uint64_t i = 0; i < shape.size(); i++) t->data()[i] = scale * (i + 1) - 2;
+		return t;
+	};
+	//transposed views of the caller and their contiguous copies
+	auto input_t = Tensors::transpose(filled({3, 2}, 1), {1, 0});
+	auto weights_t = Tensors::transpose(filled({2, 3}, 0.5f), {1, 0});
+	auto mixing_t = Tensors::transpose(filled({2, 2}, -1), {1, 0});
+	ASSERT_FALSE(input_t->contiguous());
+
+	auto run = [&](const tensor_p& x, const tensor_p& W, const tensor_p& V) {
+		weights.set_tensor(W);
+		mixing.set_tensor(V);
+		auto result = m.execute({x}, true);
+		auto copy = [](gradient& g, uint64_t size) {
+			return vector<float>(g.data(), g.data() + size);
+		};
+		auto values = result.tensor_of(out)->data();
+		return std::array{vector<float>(values, values + 4),
+			copy(result.grad_of(weights, out), 6), copy(result.grad_of(mixing, out), 4)};
+	};
+	auto expected = run(Tensors::materialize(input_t), Tensors::materialize(weights_t),
+			Tensors::materialize(mixing_t));
+	auto strided = run(input_t, weights_t, mixing_t);
+	for (unsigned k = 0; k < expected.size(); k++) {
+		for (unsigned i = 0; i < expected[k].size(); i++)
+			EXPECT_FLOAT_EQ(strided[k][i], expected[k][i]) << k << " " << i;
+	}
+}
+
+TEST(Model, Jvp) {
+	//the same graph with x as input, and as variable for the Jacobians of the reference
+	struct graph {
+		Model m;
+		Model::ModelTensor x, W, b, v, out1, out2, out3;
+
+		graph(bool x_input, diff_mode mode, unsigned threads = 0) {
+			x = x_input ? m.add_input({3}) : m.add_variable({3});
+			W = m.add_variable({3, 4});
+			b = m.add_variable({4});
+			v = m.add_variable({4});
+			auto h = x.dense(W, b, activation::relu);
+			out1 = (h * v - h).square();
+			auto p = x.reshape({1, 3}).matmul(W).slice(1, 1, 3).reduce_mean({0, 1});
+			out2 = p + h.dot_product(v);
+			out3 = b.square();
+			m.set_output(out1);
+			m.set_output(out2);
+			m.set_output(out3);
+			m.compile({.mode = mode, .directions = 2, .inter_op_threads = threads});
+			auto W_ten = Tensors::create({3, 4});
+			for (int i = 0; i < 12; i++) W_ten->data()[i] = std::sin(1.3f * i + 0.2f);
+			W.set_tensor(W_ten);
+			b.set_tensor(Tensors::create({4}, new float[]{0.1f, -0.2f, 0.3f, 0.4f}));
+			v.set_tensor(Tensors::create({4}, new float[]{1.5f, -0.5f, 2, 0.25f}));
+		}
+	};
+	auto x_ten = Tensors::create({3}, new float[]{0.5f, -1, 2});
+	graph fw{true, diff_mode::jvp}, ref{false, diff_mode::jacobian};
+	//independent ops propagate their tangents concurrently
+	graph parallel{true, diff_mode::jvp, 3};
+	ref.x.set_tensor(x_ten);
+	auto jacobians = ref.m.execute({}, true);
+
+	auto tangent = [](uint64_t size, float seed) {
+		auto t = Tensors::create({2, size});
+		for (uint64_t i = 0; i < 2 * size; i++) t->data()[i] = std::cos(seed + 0.7f * i);
+		return t;
+	};
+	auto tx = tangent(3, 0.1f), tW = tangent(12, 1.f), tv = tangent(4, 2.f);
+	for (bool with_x: {true, false}) {
+		vector<std::pair<Model::ModelTensor, tensor_p>> seeds{{fw.W, tW}, {fw.v, tv}};
+		if (with_x) seeds.emplace_back(fw.x, tx);
+		auto result = fw.m.jvp({x_ten}, seeds);
+		EXPECT_FLOAT_EQ(result.tensor_of(fw.out1)->data()[2],
+				ref.m.execute({}).tensor_of(ref.out1)->data()[2]);
+
+		//J t, summed over the seeded tensors
+		auto expect = [&](Model::ModelTensor ref_out, uint64_t out_size, uint64_t d, uint64_t o) {
+			double sum = 0;
+			auto add = [&](Model::ModelTensor var, const tensor_p& t) {
+				auto J = jacobians.grad_of(var, ref_out).data();
+				auto size = var->shape().size();
+				for (uint64_t i = 0; i < size; i++) sum += t->data()[d*size + i] * J[i*out_size + o];
+			};
+			add(ref.W, tW);
+			add(ref.v, tv);
+			if (with_x) add(ref.x, tx);
+			return sum;
+		};
+		for (uint64_t d = 0; d < 2; d++) {
+			for (uint64_t o = 0; o < 4; o++) {
+				EXPECT_NEAR(result.tangent_of(fw.out1)->data()[d*4 + o], expect(ref.out1, 4, d, o), 1e-4)
+					<< d << " " << o;
+			}
+			EXPECT_NEAR(result.tangent_of(fw.out2)->data()[d], expect(ref.out2, 1, d, 0), 1e-4) << d;
+		}
+		EXPECT_NE(result.tangent_of(fw.out2)->data()[1], 0.f);
+		vector<std::pair<Model::ModelTensor, tensor_p>> parallel_seeds{
+			{parallel.W, tW}, {parallel.v, tv}};
+		if (with_x) parallel_seeds.emplace_back(parallel.x, tx);
+		auto parallel_result = parallel.m.jvp({x_ten}, parallel_seeds);
+		for (int i = 0; i < 8; i++) {
+			EXPECT_FLOAT_EQ(parallel_result.tangent_of(parallel.out1)->data()[i],
+					result.tangent_of(fw.out1)->data()[i]) << i;
+		}
+		for (int d = 0; d < 2; d++) {
+			EXPECT_FLOAT_EQ(parallel_result.tangent_of(parallel.out2)->data()[d],
+					result.tangent_of(fw.out2)->data()[d]) << d;
+		}
+		//b has no tangent
+		for (int i = 0; i < 8; i++) EXPECT_EQ(result.tangent_of(fw.out3)->data()[i], 0.f);
+	}
+	EXPECT_THROW((void)ref.m.jvp({}, {}), std::runtime_error);
+}
+
+TEST(Model, AutomaticMode) {
+	//three variable elements and 21 output elements are accumulated forward
+	auto build = [](Model& m, diff_mode mode) {
+		auto x = m.add_input({3});
+		auto C = m.add_input({3, 20});
+		auto v = m.add_variable({3});
+		auto h = x * v;
+		auto wide = h.vecmatmul(C);
+		auto sum = h.square().reduce_sum(0);
+		m.set_output(wide);
+		m.set_output(sum);
+		m.compile({.mode = mode});
+		v.set_tensor(Tensors::create({3}, new float[]{0.5f, -1, 2}));
+		return std::array{v, wide, sum};
+	};
+	Model automatic, reference;
+	auto [v, wide, sum] = build(automatic, diff_mode::automatic);
+	auto [ref_v, ref_wide, ref_sum] = build(reference, diff_mode::jacobian);
+	EXPECT_TRUE(automatic.forward_jacobians());
+	EXPECT_FALSE(reference.forward_jacobians());
+
+	auto x = Tensors::create({3}, new float[]{1, 2, -3});
+	auto C = Tensors::create({3, 20});
+	for (int i = 0; i < 60; i++) C->data()[i] = std::sin(0.3f * i);
+	for (int run = 0; run < 2; run++) {
+		auto result = automatic.execute({x, C}, true);
+		auto expected = reference.execute({x, C}, true);
+		for (int i = 0; i < 60; i++) {
+			EXPECT_NEAR(result.grad_of(v, wide).data()[i], expected.grad_of(ref_v, ref_wide).data()[i], 1e-5) << i;
+		}
+		for (int i = 0; i < 3; i++)
+			EXPECT_NEAR(result.grad_of(v, sum).data()[i], expected.grad_of(ref_v, ref_sum).data()[i], 1e-5) << i;
+		EXPECT_FLOAT_EQ(result.tensor_of(sum)->data()[0], 0.25f + 4 + 36);
+	}
+
+	//a single scalar output is accumulated reverse
+	Model deep;
+	auto input = deep.add_input({8});
+	auto dense = DenseLayer(input, 16);
+	auto out = dense.output().reduce_sum(0);
+	deep.set_output(out);
+	deep.compile({.mode = diff_mode::automatic});
+	EXPECT_FALSE(deep.forward_jacobians());
+}
+
+TEST(Model, FrozenVariables) {
+	Model m;
+	auto x = m.add_input({3});
+	auto W1 = m.add_variable({3, 4});
+	auto b1 = m.add_variable({4});
+	auto W2 = m.add_variable({4, 2});
+	auto h = x.dense(W1, b1, activation::relu);
+	auto out = h.vecmatmul(W2);
+	m.set_output(out);
+	//fine tune the head only
+	W1.freeze();
+	b1.set_requires_grad(false);
+	m.compile({.mode = diff_mode::vjp});
+	EXPECT_FALSE(W1->requires_grad());
+	EXPECT_TRUE(W2->requires_grad());
+	EXPECT_THROW(W2.freeze(), std::runtime_error);
+
+	auto W1_ten = Tensors::create({3, 4});
+	for (int i = 0; i < 12; i++) W1_ten->data()[i] = (i % 5) * 0.25f - 0.5f;
+	W1.set_tensor(W1_ten);
+	float b1_val[] = {0.1f, -0.2f, 0.3f, 0.f};
+	b1.set_tensor(Tensors::create({4}, new float[]{0.1f, -0.2f, 0.3f, 0.f}));
+	auto W2_ten = Tensors::create({4, 2});
+	for (int i = 0; i < 8; i++) W2_ten->data()[i] = i * 0.5f - 2;
+	W2.set_tensor(W2_ten);
+
+	auto x_ten = Tensors::create({3}, new float[]{1, -2, 3});
+	auto result = m.execute({x_ten}, true);
+	float h_val[4];
+	for (int j = 0; j < 4; j++) {
+		h_val[j] = b1_val[j];
+		for (int i = 0; i < 3; i++) h_val[j] += x_ten->data()[i] * W1_ten->data()[i*4 + j];
+		h_val[j] = std::max(h_val[j], 0.f);
+	}
+	//seeded with ones, the gradient of the head is h repeated over the columns
+	auto W2_grad = result.grad_of(W2, out).data();
+	for (int i = 0; i < 8; i++) EXPECT_FLOAT_EQ(W2_grad[i], h_val[i / 2]) << i;
+	EXPECT_THROW((void)result.grad_of(W1, out), std::runtime_error);
+	EXPECT_THROW((void)result.grad_of(b1, out), std::runtime_error);
+}
+
+TEST(Model, Checkpointing) {
+	//a stack of layers, with a skip connection over the middle ones
+	struct graph {
+		Model m;
+		vector<Model::ModelTensor> weights;
+		Model::ModelTensor out;
+
+		graph(const vector<int>& checkpointed_layers, uint64_t budget) {
+			auto x = m.add_input({8});
+			auto h = x;
+			Model::ModelTensor skip;
+			for (int l = 0; l < 12; l++) {
+				auto W = m.add_variable({8, 8});
+				auto b = m.add_variable({8});
+				weights.push_back(W);
+				weights.push_back(b);
+				h = h.dense(W, b, activation::relu);
+				if (l == 1) skip = h;
+				if (l == 4) h = (h + skip).square();
+				if (std::ranges::count(checkpointed_layers, l)) h.checkpoint();
+			}
+			out = h.reduce_sum(0);
+			m.set_output(out);
+			m.compile({.mode = diff_mode::vjp, .checkpoint_budget = budget});
+			for (unsigned i = 0; i < weights.size(); i++) {
+				auto size = weights[i]->shape().size();
+				auto t = Tensors::create(weights[i]->shape());
+				for (uint64_t j = 0; j < size; j++) t->data()[j] = 0.4f * std::sin(0.9f * j + i);
+				weights[i].set_tensor(t);
+			}
+		}
+	};
+	graph reference{{}, 0}, manual{{3, 6, 9}, 0}, budgeted{{}, 64 * sizeof(float)};
+	auto kept_bytes = reference.m.planned_memory_bytes(1, true);
+	EXPECT_LT(manual.m.planned_memory_bytes(1, true), kept_bytes);
+	EXPECT_LT(budgeted.m.planned_memory_bytes(1, true), kept_bytes);
+
+	auto x_ten = Tensors::create({8});
+	for (int i = 0; i < 8; i++) x_ten->data()[i] = std::cos(0.5f * i);
+	for (int run = 0; run < 2; run++) {
+		auto expected = reference.m.execute({x_ten}, true);
+		for (auto* g: {&manual, &budgeted}) {
+			auto result = g->m.execute({x_ten}, true);
+			EXPECT_FLOAT_EQ(result.tensor_of(g->out)->data()[0],
+					expected.tensor_of(reference.out)->data()[0]);
+			for (unsigned i = 0; i < g->weights.size(); i++) {
+				auto grad = result.grad_of(g->weights[i], g->out).data();
+				auto ref_grad = expected.grad_of(reference.weights[i], reference.out).data();
+				for (uint64_t j = 0; j < g->weights[i]->shape().size(); j++)
+					EXPECT_NEAR(grad[j], ref_grad[j], 1e-5) << i << " " << j;
+			}
+		}
+		x_ten->data()[0] += 1;
+	}
+}
+
+TEST(Model, TrainStep) {
+	//the loss w . x has the gradient x, which stays the same over the updates
+	struct graph {
+		Model m;
+		Model::ModelTensor w, frozen, loss;
+		tensor_p w_ten, frozen_ten;
+
+		graph(diff_mode mode) {
+			auto x = m.add_input({20});
+			w = m.add_variable({20});
+			frozen = m.add_variable({20});
+			loss = (x * frozen).dot_product(w);
+			m.set_output(loss);
+			frozen.freeze();
+			m.compile({.mode = mode});
+			w_ten = Tensors::create({20});
+			for (int i = 0; i < 20; i++) w_ten->data()[i] = std::sin(0.3f * i);
+			w.set_tensor(w_ten);
+			frozen_ten = Tensors::create({20});
+			for (int i = 0; i < 20; i++) frozen_ten->data()[i] = 1;
+			frozen.set_tensor(frozen_ten);
+		}
+	};
+	auto x_ten = Tensors::create({20});
+	for (int i = 0; i < 20; i++) x_ten->data()[i] = std::cos(0.7f * i) + 0.1f;
+	auto x = [&](int i) { return x_ten->data()[i]; };
+	auto w0 = [](int i) { return std::sin(0.3f * i); };
+
+	//sgd with momentum: the velocity is g, then 1.9 g
+	graph sgd{diff_mode::vjp};
+	auto sgd_opt = sgd.m.create_optimizer({.type_ = optimizer_type::sgd, .lr_ = 0.1f, .momentum_ = 0.9f});
+	auto data = sgd.w_ten->data();
+	sgd.m.train_step({x_ten}, sgd_opt);
+	for (int i = 0; i < 20; i++) EXPECT_NEAR(data[i], w0(i) - 0.1f * x(i), 1e-5) << i;
+	sgd.m.train_step({x_ten}, sgd_opt);
+	for (int i = 0; i < 20; i++) EXPECT_NEAR(data[i], w0(i) - 0.29f * x(i), 1e-5) << i;
+	EXPECT_EQ(sgd.w_ten->data(), data);
+	EXPECT_EQ(sgd_opt.steps(), 2);
+
+	//the first bias corrected Adam step is lr sign(g), AdamW also decays the weights
+	for (auto type: {optimizer_type::adam, optimizer_type::adamw}) {
+		graph adam{diff_mode::jacobian};
+		auto opt = adam.m.create_optimizer({.type_ = type, .lr_ = 0.01f, .weight_decay_ = 0.5f});
+		auto result = adam.m.train_step({x_ten}, opt);
+		float loss = 0;
+		for (int i = 0; i < 20; i++) loss += x(i) * w0(i);
+		EXPECT_NEAR(result.tensor_of(adam.loss)->data()[0], loss, 1e-4);
+		for (int i = 0; i < 20; i++) {
+			auto g = x(i) + (type == optimizer_type::adam ? 0.5f * w0(i) : 0.f);
+			auto decay = type == optimizer_type::adamw ? 0.01f * 0.5f * w0(i) : 0.f;
+			EXPECT_NEAR(adam.w_ten->data()[i], w0(i) - 0.01f * (g > 0 ? 1 : -1) - decay, 1e-5) << i;
+		}
+		//the frozen variable is left as it is
+		for (int i = 0; i < 20; i++) EXPECT_EQ(adam.frozen_ten->data()[i], 1.f);
+	}
+
+	graph jvp{diff_mode::jvp};
+	auto jvp_opt = jvp.m.create_optimizer({});
+	EXPECT_THROW((void)jvp.m.train_step({x_ten}, jvp_opt), std::runtime_error);
+}
+
+}
@@ -4,6 +4,7 @@
 #include <rep/rep_types.h>
 #include <rep/call_graph.h>
 #include <rep/call_graph_runner.h>
+#include <rep/compiled_graph.h>
 
 using namespace plearn::rep;
 
@@ -116,3 +117,100 @@ TEST(CallGraph, Runner) {
 
 }
 
+
+TEST(CallGraph, Schedule) {
+	call_graph_builder builder;
+
+	auto in1n_id = builder.add_input_node(shape_t{10});
+	auto in2n_id = builder.add_input_node(shape_t{10});
+	auto datan_id = builder.add_data_node(shape_t{10});
+	auto [op1n_id, flow1n_id] = builder.add_op_node(add{}, {in1n_id, datan_id}, shape_t{10});
+	auto [op2n_id, flow2n_id] = builder.add_op_node(mult{}, {in2n_id, datan_id}, shape_t{10});
+	auto [op3n_id, outn_id] = builder.add_op_node(sub{}, {flow1n_id, flow2n_id}, shape_t{10});
+	builder.make_output(outn_id);
+
+	auto cg = builder.build();
+
+	auto schedule = call_graph_schedule::forward(cg);
+	ASSERT_EQ(schedule.size(), 3);
+	auto& ops = schedule.ops();
+	ASSERT_TRUE(ops[0]->id_ == op1n_id || ops[0]->id_ == op2n_id);
+	ASSERT_TRUE(ops[1]->id_ == op1n_id || ops[1]->id_ == op2n_id);
+	ASSERT_NE(ops[0]->id_, ops[1]->id_);
+	ASSERT_EQ(ops[2]->id_, op3n_id);
+}
+
+TEST(CallGraph, BackwardRunnerFanOut) {
+	call_graph_builder builder;
+
+	auto inn_id = builder.add_input_node(shape_t{10});
+	auto datan_id = builder.add_data_node(shape_t{10});
+	auto [op1n_id, flow1n_id] = builder.add_op_node(add{}, {inn_id, datan_id}, shape_t{10});
+	//flow1 is consumed by two ops
+	auto [op2n_id, flow2n_id] = builder.add_op_node(square{}, {flow1n_id}, shape_t{10});
+	auto [op3n_id, flow3n_id] = builder.add_op_node(mult{}, {flow1n_id, datan_id}, shape_t{10});
+	auto [op4n_id, outn_id] = builder.add_op_node(sub{}, {flow2n_id, flow3n_id}, shape_t{10});
+	builder.make_output(outn_id);
+	//not reached, no output depends on it
+	auto [op5n_id, flow5n_id] = builder.add_op_node(mult{}, {inn_id, datan_id}, shape_t{10});
+
+	auto cg = builder.build();
+
+	auto bw_runner = call_graph_backward_runner(cg);
+	ASSERT_EQ(bw_runner.consumers(op1n_id), 2);
+	ASSERT_EQ(bw_runner.producers(op4n_id).size(), 2);
+	ASSERT_EQ(bw_runner.ops().size(), 4);
+
+	bw_runner.reset();
+	auto& ready_ops = bw_runner.ready_ops();
+	ASSERT_EQ(ready_ops.size(), 1);
+	ASSERT_TRUE(ready_ops.contains(op4n_id));
+	bw_runner.op_finished(op4n_id);
+	ASSERT_EQ(ready_ops.size(), 2);
+	bw_runner.op_finished(op2n_id);
+	//op3 still has to add to the gradient of flow1
+	ASSERT_EQ(ready_ops.size(), 1);
+	ASSERT_TRUE(ready_ops.contains(op3n_id));
+	bw_runner.op_finished(op3n_id);
+	ASSERT_EQ(ready_ops.size(), 1);
+	ASSERT_TRUE(ready_ops.contains(op1n_id));
+	bw_runner.op_finished(op1n_id);
+	ASSERT_EQ(ready_ops.size(), 0);
+	ASSERT_EQ(bw_runner.state(), run_state::READY);
+	(void)op5n_id; (void)flow5n_id;
+}
+
+TEST(CallGraph, Compiled) {
+	call_graph_builder builder;
+
+	auto inn_id = builder.add_input_node(shape_t{10});
+	auto datan_id = builder.add_data_node(shape_t{10});
+	auto [op1n_id, flow1n_id] = builder.add_op_node(add{}, {inn_id, datan_id}, shape_t{10});
+	auto [op2n_id, flow2n_id] = builder.add_op_node(square{}, {flow1n_id}, shape_t{10});
+	auto [op3n_id, outn_id] = builder.add_op_node(mult{}, {flow1n_id, flow2n_id}, shape_t{10});
+	builder.make_output(outn_id);
+
+	auto cg = builder.build();
+	compiled_graph graph{cg};
+
+	ASSERT_EQ(graph.op_count(), 3);
+	ASSERT_EQ(graph.node_count(), outn_id + 1);
+	//ops in schedule order
+	ASSERT_EQ(graph.op(0).id_, op1n_id);
+	ASSERT_EQ(graph.op(1).id_, op2n_id);
+	ASSERT_EQ(graph.op(2).id_, op3n_id);
+	ASSERT_EQ(graph.output(2), outn_id);
+
+	auto inputs = graph.inputs(2);
+	ASSERT_EQ(vector<node_id>(inputs.begin(), inputs.end()), (vector<node_id>{flow1n_id, flow2n_id}));
+	auto consumers = graph.consumers(0);
+	ASSERT_EQ(vector<unsigned>(consumers.begin(), consumers.end()), (vector<unsigned>{1, 2}));
+	ASSERT_TRUE(graph.consumers(2).empty());
+
+	ASSERT_EQ(graph.producer(flow2n_id), 1);
+	ASSERT_EQ(graph.producer(inn_id), -1);
+	ASSERT_EQ(graph.producer(datan_id), -1);
+	ASSERT_TRUE(graph.is_flow(inn_id));
+	ASSERT_FALSE(graph.is_flow(datan_id));
+	for (unsigned idx = 0; idx < 3; ++idx) ASSERT_TRUE(graph.reached(idx));
+}
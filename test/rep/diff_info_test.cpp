@@ -86,3 +86,65 @@ TEST(ForwardProp, Builder) {
 	}
 }
 
+
+TEST(DiffCosts, Estimate) {
+	//few variable elements, a wide output: forward
+	call_graph_builder wide_builder;
+	auto xn_id = wide_builder.add_input_node(shape_t{2});
+	auto cn_id = wide_builder.add_input_node(shape_t{2, 50});
+	auto vn_id = wide_builder.add_data_node(shape_t{2});
+	auto [_, hn_id] = wide_builder.add_op_node(mult{}, {xn_id, vn_id}, shape_t{2});
+	auto [__, wide_id] = wide_builder.add_op_node(vecmatmul{}, {hn_id, cn_id}, shape_t{50});
+	wide_builder.make_output(wide_id);
+	auto wide = wide_builder.build();
+	auto wide_costs = estimate_diff_costs(wide, *diff_info_builder(wide).find_dependencies().build());
+	//2 directions or 50 columns through the product and the vecmatmul
+	EXPECT_EQ(wide_costs.forward_, 2 * (4 + 100));
+	EXPECT_EQ(wide_costs.reverse_, 50 * (4 + 100));
+	EXPECT_TRUE(wide_costs.prefer_forward());
+
+	//large variables, a small output: reverse
+	call_graph_builder deep_builder;
+	auto inn_id = deep_builder.add_input_node(shape_t{1, 64});
+	auto data1n_id = deep_builder.add_data_node(shape_t{64, 32});
+	auto [op1n_id, flown_id] = deep_builder.add_op_node(matmul{}, {inn_id, data1n_id}, shape_t{1, 32});
+	auto data2n_id = deep_builder.add_data_node(shape_t{32, 4});
+	auto [op2n_id, outn_id] = deep_builder.add_op_node(matmul{}, {flown_id, data2n_id}, shape_t{1, 4});
+	deep_builder.make_output(outn_id);
+	auto deep = deep_builder.build();
+	auto deep_costs = estimate_diff_costs(deep, *diff_info_builder(deep).find_dependencies().build());
+	EXPECT_EQ(deep_costs.reverse_, 4 * (64*32 + 32*4));
+	EXPECT_FALSE(deep_costs.prefer_forward());
+}
+
+TEST(ForwardProp, ConstantDataNodes) {
+	call_graph_builder cg_builder;
+	auto inn_id = cg_builder.add_input_node(shape_t{8});
+	auto data1n_id = cg_builder.add_data_node(shape_t{8, 4});
+	auto [op1n_id, flown_id] =
+		cg_builder.add_op_node(vecmatmul{}, {inn_id, data1n_id}, shape_t{4});
+	auto data2n_id = cg_builder.add_data_node(shape_t{4, 2});
+	auto [op2n_id, outn_id] =
+		cg_builder.add_op_node(vecmatmul{}, {flown_id, data2n_id}, shape_t{2});
+	cg_builder.make_output(outn_id);
+	auto cg = cg_builder.build();
+
+	//the first layer is frozen
+	auto info = diff_info_builder{cg}
+		.variable_nodes({data2n_id})
+		.find_dependencies()
+		.build();
+	auto& deps = info->dependencies();
+	ASSERT_EQ(info->variable_nodes(), vector<node_id>{data2n_id});
+	EXPECT_FALSE(deps.at(data1n_id).depends_on_any());
+	EXPECT_FALSE(deps.at(flown_id).depends_on_any());
+	EXPECT_TRUE(deps.at(outn_id).depends_on(data2n_id));
+
+	//no variables at all
+	auto frozen = diff_info_builder{cg}
+		.variable_nodes({})
+		.find_dependencies()
+		.build();
+	EXPECT_TRUE(frozen->variable_nodes().empty());
+	EXPECT_FALSE(frozen->dependencies().at(outn_id).depends_on_any());
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <rep/rep_types.h>
+#include <rep/call_graph.h>
+#include <rep/fusion.h>
+
+using namespace plearn::rep;
+
+TEST(Fusion, ElementwiseChain) {
+	call_graph_builder builder;
+	auto inn_id = builder.add_input_node(shape_t{3, 4});
+	auto datan_id = builder.add_data_node(shape_t{3, 4});
+	auto [subn_id, diffn_id] = builder.add_op_node(sub{}, {inn_id, datan_id}, shape_t{3, 4});
+	auto [sqn_id, sqoutn_id] = builder.add_op_node(square{}, {diffn_id}, shape_t{3, 4});
+	auto [redn_id, outn_id] = builder.add_op_node(reduce_sum(1), {sqoutn_id}, shape_t{3});
+	builder.make_output(outn_id);
+
+	auto cg = fuse_elementwise(builder.build());
+
+	ASSERT_EQ(cg.op_nodes_.size(), 1);
+	auto& opn = cg.op_nodes_.at(redn_id);
+	ASSERT_EQ(opn.op_.type_, op_type::fused);
+	ASSERT_EQ(opn.inputs_, (vector<node_id>{inn_id, datan_id}));
+	ASSERT_EQ(opn.out_, outn_id);
+
+	auto& block = *opn.op_.block_;
+	ASSERT_EQ(block.inputs_, 2);
+	ASSERT_EQ(block.instrs_.size(), 2);
+	EXPECT_EQ(block.instrs_[0].type_, op_type::sub);
+	EXPECT_EQ(block.instrs_[0].a_, 0);
+	EXPECT_EQ(block.instrs_[0].b_, 1);
+	EXPECT_EQ(block.instrs_[1].type_, op_type::square);
+	EXPECT_EQ(block.instrs_[1].a_, 2);
+	EXPECT_EQ(block.reduce_, reduce_sum(1));
+
+	EXPECT_TRUE(cg.internal_nodes_.empty());
+	EXPECT_EQ(cg.flow_nodes_.size(), 2);
+	EXPECT_EQ(cg.flow_nodes_.at(inn_id).outputs_, vector<node_id>{redn_id});
+	EXPECT_EQ(cg.data_nodes_.at(datan_id).outputs_, vector<node_id>{redn_id});
+	(void)subn_id; (void)sqn_id;
+}
+
+TEST(Fusion, SharedTensorsKept) {
+	call_graph_builder builder;
+	auto inn_id = builder.add_input_node(shape_t{8});
+	auto datan_id = builder.add_data_node(shape_t{8});
+	//diff is read by two ops, sq is an output
+	auto [subn_id, diffn_id] = builder.add_op_node(sub{}, {inn_id, datan_id}, shape_t{8});
+	auto [sqn_id, sqoutn_id] = builder.add_op_node(square{}, {diffn_id}, shape_t{8});
+	auto [multn_id, prodn_id] = builder.add_op_node(mult{}, {sqoutn_id, diffn_id}, shape_t{8});
+	auto [addn_id, outn_id] = builder.add_op_node(add{}, {prodn_id, inn_id}, shape_t{8});
+	builder.make_output(sqoutn_id);
+	builder.make_output(outn_id);
+
+	auto cg = fuse_elementwise(builder.build());
+
+	//only mult and add are fused
+	ASSERT_EQ(cg.op_nodes_.size(), 3);
+	ASSERT_TRUE(cg.op_nodes_.contains(subn_id));
+	ASSERT_TRUE(cg.op_nodes_.contains(sqn_id));
+	auto& opn = cg.op_nodes_.at(addn_id);
+	ASSERT_EQ(opn.op_.type_, op_type::fused);
+	ASSERT_EQ(opn.inputs_, (vector<node_id>{sqoutn_id, diffn_id, inn_id}));
+	EXPECT_EQ(opn.op_.block_->reduce_.type_, op_type::noop);
+	EXPECT_EQ(cg.internal_nodes_, vector<node_id>{diffn_id});
+	EXPECT_FALSE(cg.flow_nodes_.contains(prodn_id));
+	(void)multn_id;
+}
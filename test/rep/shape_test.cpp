@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+
+#include <rep/rep_types.h>
+
+using namespace plearn::rep;
+
+//shapes are literal types
+static_assert(shape_t{2, 3, 4}.size() == 24);
+static_assert((shape_t{5} * shape_t{2, 3}).rank == 3);
+static_assert(shape_t{2, 3, 4}.strides() == shape_dims{12, 4, 1});
+
+TEST(Shape, Dims) {
+	shape_t shape{2, 3, 4};
+	EXPECT_EQ(shape.rank, 3);
+	EXPECT_EQ(shape.size(), 24u);
+	EXPECT_EQ(shape[1], 3u);
+	EXPECT_EQ(shape_t(std::vector<uint64_t>{2, 3, 4}), shape);
+
+	//rank 0 is a scalar of one element
+	shape_t scalar{shape_dims{}};
+	EXPECT_EQ(scalar.rank, 1);
+	EXPECT_EQ(scalar.size(), 1u);
+
+	auto batched = shape_t{7} * shape;
+	EXPECT_EQ(batched, (shape_t{7, 2, 3, 4}));
+	EXPECT_EQ(batched.size(), 7*24u);
+	EXPECT_LT(shape, batched);
+
+	auto dims = batched.dims;
+	dims.erase(dims.begin());
+	EXPECT_EQ(dims, shape.dims);
+	dims.insert(dims.begin() + 1, 5);
+	EXPECT_EQ(dims, (shape_dims{2, 5, 3, 4}));
+
+	shape_dims full;
+	for (unsigned i = 0; i < shape_dims::max_rank; ++i) full.push_back(1);
+	EXPECT_THROW(full.push_back(1), std::length_error);
+}